@@ -1,9 +1,86 @@
 #!/usr/bin/env python3
+# Print the positions in one frame of a capture.
+#
+# Usage: load.py [FILE [FRAME]]
+#
+# Only uncompressed points can be read here.  Compressed captures can
+# be converted with "pcindex IN OUT", and raw depth captures with
+# "pcindex --key-distance MM IN OUT".  See src/pcfile.hpp for the
+# format.
 import struct
+import sys
 
-with open('out1.dat', 'rb') as fp:
-    d = fp.read(4)
-    count, = struct.unpack('I', d)
-    for i in range(count):
-        x, y, z, c = struct.unpack('fffI', fp.read(16))
-        print((x, y, z))
+FILE_MAGIC = b'PCTRACK\0'
+INDEX_MAGIC = b'PCINDEX\0'
+KEY_MAGIC = b'PCDKEY\0\0'
+V1_HEADER = '<8sII II ffff II QQQ'
+FRAME_HEADER = '<IIQQQ'
+INDEX_HEADER = '<8sQ'
+INDEX_ENTRY = '<QQ'
+FRAME_RAW = 0
+ENCODINGS = {0: 'raw', 1: 'delta', 2: 'depth'}
+
+def read_frames(data):
+    """Get the payload offset, point count and encoding of each frame."""
+    if data[:8] != FILE_MAGIC:
+        # Legacy files are just frames of a count and points.
+        frames, offset = [], 0
+        while offset + 4 <= len(data):
+            count, = struct.unpack_from('<I', data, offset)
+            if offset + 4 + count * 16 > len(data):
+                break
+            frames.append((offset + 4, count, FRAME_RAW))
+            offset += 4 + count * 16
+        return frames
+    header = struct.unpack_from(V1_HEADER, data)
+    version, header_size = header[1], header[2]
+    if version not in (1, 2):
+        sys.exit('Unsupported file version {}'.format(version))
+    if header[9] != 16 or header[10] != 0:
+        sys.exit('Unsupported point format')
+    index_offset = header[13]
+    if index_offset:
+        magic, count = struct.unpack_from(INDEX_HEADER, data, index_offset)
+        start = index_offset + struct.calcsize(INDEX_HEADER)
+        size = struct.calcsize(INDEX_ENTRY)
+        if magic != INDEX_MAGIC or count > (len(data) - start) // size:
+            sys.exit('Corrupt index')
+        offsets = [struct.unpack_from(INDEX_ENTRY, data, start + i * size)[0]
+                   for i in range(count)]
+    else:
+        # The file was not closed, so scan the frames.
+        offsets, offset = [], header_size
+        size = struct.calcsize(FRAME_HEADER)
+        while offset + size <= len(data):
+            magic = data[offset:offset + 8]
+            if magic == INDEX_MAGIC:
+                break
+            if magic == KEY_MAGIC:
+                offset += 16 + header[3] * header[4] * 2
+                continue
+            fh = struct.unpack_from(FRAME_HEADER, data, offset)
+            if offset + size + fh[2] > len(data):
+                break
+            offsets.append(offset)
+            offset += size + fh[2]
+    frames = []
+    for offset in offsets:
+        count, encoding, size, timestamp, host_time = struct.unpack_from(
+            FRAME_HEADER, data, offset)
+        frames.append((offset + struct.calcsize(FRAME_HEADER), count,
+                       encoding))
+    return frames
+
+path = sys.argv[1] if len(sys.argv) > 1 else 'out1.dat'
+frame = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+with open(path, 'rb') as fp:
+    data = fp.read()
+frames = read_frames(data)
+if not 0 <= frame < len(frames):
+    sys.exit('No frame {}, file has {} frames'.format(frame, len(frames)))
+offset, count, encoding = frames[frame]
+if encoding != FRAME_RAW:
+    sys.exit('Cannot read {} frames'.format(ENCODINGS.get(encoding, encoding)))
+for i in range(count):
+    x, y, z, c = struct.unpack_from('fffI', data, offset + i * 16)
+    print((x, y, z))
@@ -0,0 +1,102 @@
+#include "activity.hpp"
+#include "defs.hpp"
+#include "soa.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+ActivityMeter::ActivityMeter(const PointFileHeader &header)
+    : m_pixels(static_cast<double>(header.width) * header.height),
+      m_timestamp_rate(header.timestamp_rate), m_started(false),
+      m_first(0), m_last_time(0.0), m_has_centroid(false) {
+    if (!(m_pixels > 0.0) || !(m_timestamp_rate > 0.0)) {
+        die("Capture has no image size or timestamp rate.");
+    }
+}
+
+ActivitySample ActivityMeter::measure(const PointFrame &frame) {
+    if (!m_started) {
+        m_first = frame.timestamp;
+        m_started = true;
+    }
+    ActivitySample s;
+    s.time = (frame.timestamp - m_first) / m_timestamp_rate;
+    s.foreground = frame.count / m_pixels;
+    s.speed = 0.0f;
+    PointBounds b = point_bounds(frame.points(), frame.count);
+    bool has_centroid = b.count > 0;
+    if (has_centroid && m_has_centroid && s.time > m_last_time) {
+        double d2 = 0.0;
+        for (int k = 0; k < 3; k++) {
+            double d = b.centroid[k] - m_centroid[k];
+            d2 += d * d;
+        }
+        s.speed = std::sqrt(d2) / (s.time - m_last_time);
+    }
+    if (has_centroid) {
+        std::memcpy(m_centroid, b.centroid, sizeof(m_centroid));
+    }
+    m_has_centroid = has_centroid;
+    m_last_time = s.time;
+    return s;
+}
+
+ActivityWriter::ActivityWriter()
+    : m_fp(nullptr), m_rate(0.0), m_count(0), m_has_last(false) { }
+
+ActivityWriter::~ActivityWriter() {
+    if (m_fp) {
+        std::fclose(m_fp);
+    }
+}
+
+void ActivityWriter::open(const std::string &path, double rate) {
+    if (m_fp) {
+        close();
+    }
+    m_fp = std::fopen(path.c_str(), "w");
+    if (!m_fp) {
+        die("Could not create %s: %s", path.c_str(), std::strerror(errno));
+    }
+    m_path = path;
+    m_rate = rate;
+    m_count = 0;
+    m_has_last = false;
+    std::fputs("stream,frame,time,foreground,speed\n", m_fp);
+}
+
+void ActivityWriter::add(const ActivitySample &sample) {
+    if (!m_has_last) {
+        m_last = sample;
+        m_has_last = true;
+    }
+    // Write every sample time up to this frame, interpolating from the
+    // last frame.
+    for (;;) {
+        double t = m_count / m_rate;
+        if (t > sample.time) {
+            break;
+        }
+        double span = sample.time - m_last.time;
+        double f = span > 0.0 ? (t - m_last.time) / span : 1.0;
+        float fg = m_last.foreground +
+            (sample.foreground - m_last.foreground) * f;
+        float speed = m_last.speed + (sample.speed - m_last.speed) * f;
+        std::fprintf(m_fp, "0,%zu,%.4f,%.6f,%.6f\n", m_count, t, fg, speed);
+        m_count++;
+    }
+    m_last = sample;
+}
+
+void ActivityWriter::close() {
+    if (!m_fp) {
+        return;
+    }
+    bool ok = !std::ferror(m_fp);
+    ok = !std::fclose(m_fp) && ok;
+    m_fp = nullptr;
+    if (!ok) {
+        die("Could not write %s.", m_path.c_str());
+    }
+}
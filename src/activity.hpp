@@ -0,0 +1,81 @@
+#ifndef PCTRACK_ACTIVITY_HPP
+#define PCTRACK_ACTIVITY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "frame.hpp"
+
+// Motion activity of a capture, for aligning it with ordinary video.
+//
+// The activity of each frame is the fraction of the depth image in
+// the foreground and the speed of the foreground's centroid, the same
+// signals that ts_extract in timesync measures in video.  Frames are
+// resampled to a fixed rate as they arrive, so a capture of any length
+// is processed in constant memory, and the result is written in the
+// signal file format which ts_align reads.
+
+/// Motion activity at one time.
+struct ActivitySample {
+    /// Time since the first frame, in seconds.
+    double time;
+    /// Fraction of the depth image in the foreground.
+    float foreground;
+    /// Speed of the centroid of the foreground, in meters per second,
+    /// or zero when there is no foreground in this frame or the last.
+    float speed;
+};
+
+/// Measures the activity of each frame of a capture, in order.
+class ActivityMeter {
+private:
+    double m_pixels;
+    double m_timestamp_rate;
+    bool m_started;
+    uint64_t m_first;
+    double m_last_time;
+    bool m_has_centroid;
+    float m_centroid[3];
+
+public:
+    explicit ActivityMeter(const PointFileHeader &header);
+
+    /// Measure the next frame.
+    ActivitySample measure(const PointFrame &frame);
+};
+
+/// Writes activity resampled to a fixed rate, with linear interpolation
+/// between frames.
+class ActivityWriter {
+private:
+    std::FILE *m_fp;
+    std::string m_path;
+    double m_rate;
+    std::size_t m_count;
+    bool m_has_last;
+    ActivitySample m_last;
+
+public:
+    ActivityWriter();
+    ActivityWriter(const ActivityWriter &) = delete;
+    ~ActivityWriter();
+    ActivityWriter &operator=(const ActivityWriter &) = delete;
+
+    /// Create a signal file with the given sample rate.  Errors are
+    /// fatal.
+    void open(const std::string &path, double rate);
+
+    /// Add the activity of a frame, and write the samples up to it.
+    /// Frames must be in order of time.
+    void add(const ActivitySample &sample);
+
+    /// Close the file.  Errors are fatal.
+    void close();
+
+    /// Get the number of samples written.
+    std::size_t sample_count() const { return m_count; }
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "background.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+DepthBackgroundConfig default_background_config(int key_distance) {
+    DepthBackgroundConfig cfg;
+    cfg.history = 900;
+    cfg.absorb = 9000;
+    cfg.var_threshold = 16.0f;
+    cfg.min_distance = static_cast<float>(key_distance);
+    cfg.var_init = 15.0f * 15.0f;
+    cfg.var_min = 2.0f * 2.0f;
+    cfg.var_max = 100.0f * 100.0f;
+    return cfg;
+}
+
+DepthBackground::DepthBackground(int width, int height,
+                                 const DepthBackgroundConfig &cfg)
+    : m_width(width), m_height(height), m_cfg(cfg),
+      m_mean(width * height), m_var(width * height) {}
+
+void DepthBackground::init(const unsigned short *key) {
+    for (int i = 0, n = m_width * m_height; i < n; i++) {
+        m_mean[i] = key[i];
+        m_var[i] = m_cfg.var_init;
+    }
+}
+
+namespace {
+
+struct Params {
+    float alpha, fg_alpha, threshold, min_distance;
+    float var_init, var_min, var_max;
+};
+
+// Update a single pixel.  The vector code below must give the same
+// results.
+inline bool update_pixel(const Params &p, unsigned short depth,
+                         float &mean, float &var) {
+    if (!depth) {
+        return false;
+    }
+    float d = depth;
+    if (mean == 0.0f) {
+        mean = d;
+        var = p.var_init;
+        return false;
+    }
+    float diff = d - mean, diff2 = diff * diff;
+    bool fg = -diff > p.min_distance && diff2 > p.threshold * var;
+    mean += (fg ? p.fg_alpha : p.alpha) * diff;
+    if (!fg) {
+        float v = var + p.alpha * (diff2 - var);
+        var = std::min(std::max(v, p.var_min), p.var_max);
+    }
+    return fg;
+}
+
+}
+
+int DepthBackground::apply(const unsigned short *depth,
+                           unsigned char *mask) {
+    return apply(depth, mask, 0, m_width * m_height);
+}
+
+int DepthBackground::apply(const unsigned short *depth,
+                           unsigned char *mask, int begin, int end) {
+    Params p;
+    p.alpha = 1.0f / m_cfg.history;
+    p.fg_alpha = 1.0f / m_cfg.absorb;
+    p.threshold = m_cfg.var_threshold;
+    p.min_distance = m_cfg.min_distance;
+    p.var_init = m_cfg.var_init;
+    p.var_min = m_cfg.var_min;
+    p.var_max = m_cfg.var_max;
+
+    float *mp = m_mean.data(), *vp = m_var.data();
+    int n = end, i = begin, count = 0;
+
+#if defined(__SSE2__)
+    const __m128i zeroi = _mm_setzero_si128();
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 alpha = _mm_set1_ps(p.alpha);
+    const __m128 fg_alpha = _mm_set1_ps(p.fg_alpha);
+    const __m128 threshold = _mm_set1_ps(p.threshold);
+    const __m128 min_distance = _mm_set1_ps(p.min_distance);
+    const __m128 var_init = _mm_set1_ps(p.var_init);
+    const __m128 var_min = _mm_set1_ps(p.var_min);
+    const __m128 var_max = _mm_set1_ps(p.var_max);
+    for (; i + 4 <= n; i += 4) {
+        __m128i raw = _mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(depth + i));
+        __m128 d = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zeroi));
+        __m128 m = _mm_loadu_ps(mp + i);
+        __m128 v = _mm_loadu_ps(vp + i);
+
+        __m128 valid = _mm_cmpneq_ps(d, zero);
+        __m128 unknown = _mm_and_ps(valid, _mm_cmpeq_ps(m, zero));
+        __m128 known = _mm_andnot_ps(unknown, valid);
+
+        __m128 diff = _mm_sub_ps(d, m);
+        __m128 diff2 = _mm_mul_ps(diff, diff);
+        __m128 fg = _mm_and_ps(
+            _mm_cmpgt_ps(_mm_sub_ps(zero, diff), min_distance),
+            _mm_cmpgt_ps(diff2, _mm_mul_ps(threshold, v)));
+        fg = _mm_and_ps(fg, known);
+
+        __m128 a = _mm_or_ps(_mm_and_ps(fg, fg_alpha),
+                             _mm_andnot_ps(fg, alpha));
+        __m128 m1 = _mm_add_ps(m, _mm_mul_ps(a, diff));
+        __m128 v1 = _mm_add_ps(v, _mm_mul_ps(alpha, _mm_sub_ps(diff2, v)));
+        v1 = _mm_min_ps(_mm_max_ps(v1, var_min), var_max);
+        v1 = _mm_or_ps(_mm_and_ps(fg, v), _mm_andnot_ps(fg, v1));
+
+        m = _mm_or_ps(_mm_and_ps(known, m1), _mm_andnot_ps(known, m));
+        v = _mm_or_ps(_mm_and_ps(known, v1), _mm_andnot_ps(known, v));
+        m = _mm_or_ps(_mm_and_ps(unknown, d), _mm_andnot_ps(unknown, m));
+        v = _mm_or_ps(_mm_and_ps(unknown, var_init),
+                      _mm_andnot_ps(unknown, v));
+        _mm_storeu_ps(mp + i, m);
+        _mm_storeu_ps(vp + i, v);
+
+        __m128i fgi = _mm_castps_si128(fg);
+        fgi = _mm_packs_epi32(fgi, fgi);
+        fgi = _mm_packs_epi16(fgi, fgi);
+        int bits = _mm_cvtsi128_si32(fgi);
+        std::memcpy(mask + i, &bits, 4);
+        count += __builtin_popcount(_mm_movemask_ps(fg));
+    }
+#endif
+
+    for (; i < n; i++) {
+        bool fg = update_pixel(p, depth[i], mp[i], vp[i]);
+        mask[i] = fg ? 0xff : 0;
+        count += fg;
+    }
+    return count;
+}
@@ -0,0 +1,60 @@
+#ifndef PCTRACK_BACKGROUND_HPP
+#define PCTRACK_BACKGROUND_HPP
+
+#include <vector>
+
+/// Parameters for the depth background model.
+struct DepthBackgroundConfig {
+    /// Number of frames over which the background is averaged.
+    int history;
+    /// Number of frames before a stationary foreground object is
+    /// absorbed into the background.
+    int absorb;
+    /// Threshold on the squared Mahalanobis distance, as in OpenCV's
+    /// BackgroundSubtractorMOG2.
+    float var_threshold;
+    /// Minimum distance in front of the background, in millimeters,
+    /// for a pixel to be considered foreground.
+    float min_distance;
+    /// Variance assigned to newly observed pixels, in mm^2.
+    float var_init;
+    /// Limits on the variance, in mm^2.
+    float var_min, var_max;
+};
+
+/// Adaptive per-pixel background model for depth images.  Each pixel
+/// has a running mean and variance, which are updated every frame.
+/// Pixels significantly closer than the background are foreground.
+class DepthBackground {
+private:
+    int m_width, m_height;
+    DepthBackgroundConfig m_cfg;
+    std::vector<float> m_mean;
+    std::vector<float> m_var;
+
+public:
+    DepthBackground(int width, int height, const DepthBackgroundConfig &cfg);
+
+    /// Seed the model from a depth key, e.g. from fill_depth_key().
+    /// Pixels with zero depth are unknown, and will be initialized
+    /// from the first valid depth seen at that pixel.
+    void init(const unsigned short *key);
+
+    /// Classify a depth image and update the model.  Foreground
+    /// pixels are set to 0xff in the mask, other pixels are set to
+    /// zero.  Returns the number of foreground pixels.
+    int apply(const unsigned short *depth, unsigned char *mask);
+
+    /// Same as apply(), but only for pixels in the range [begin, end).
+    /// Disjoint ranges may be processed concurrently.
+    int apply(const unsigned short *depth, unsigned char *mask,
+              int begin, int end);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+};
+
+/// Get the default background model parameters for a given key distance.
+DepthBackgroundConfig default_background_config(int key_distance);
+
+#endif
@@ -0,0 +1,761 @@
+#include "defs.hpp"
+#include "background.hpp"
+#include "codec.hpp"
+#include "convert.hpp"
+#include "depthfilter.hpp"
+#include "depthkey.hpp"
+#include "frame.hpp"
+#include "pcfile.hpp"
+#include "segment.hpp"
+#include "soa.hpp"
+#include "source.hpp"
+#include "spatial.hpp"
+#include "track.hpp"
+#include "voxel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Number of frames in each input set.
+const int FRAME_COUNT = 16;
+// Minimum time for each timing sample, in seconds.
+const double SAMPLE_TIME = 0.2;
+// Number of random frames for checks.
+const int RANDOM_CHECK_COUNT = 3000;
+// Number of random queries for checks of each spatial index.
+const int SPATIAL_CHECK_COUNT = 200;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+// A fixed set of frames, with everything derived from them which the
+// kernels take as input.
+struct InputSet {
+    std::string name;
+    int width, height;
+    std::vector<unsigned short> key;
+    std::vector<std::vector<unsigned short>> depth;
+    std::vector<std::vector<unsigned char>> color;
+    std::vector<std::vector<unsigned char>> mask;
+    std::vector<std::vector<Point>> points;
+    std::vector<std::vector<unsigned char>> encoded;
+};
+
+struct Result {
+    std::string name, input;
+    double frame_time;
+    double pixels, bytes;
+};
+
+class Bench {
+private:
+    std::vector<Result> m_results;
+    std::string m_filter;
+    int m_repeat;
+
+public:
+    Bench(const std::string &filter, int repeat)
+        : m_filter(filter), m_repeat(repeat) {}
+
+    /// Time a kernel which processes a number of frames per call.
+    /// The reported time is the median over samples of the time per
+    /// frame.  Pixels and bytes are per frame.
+    template<class F>
+    void run(const InputSet &in, const char *name, int frames_per_call,
+             double bytes, F func);
+
+    /// Test whether a kernel passes the filter.
+    bool enabled(const char *name) const {
+        return m_filter.empty() ||
+            std::string(name).find(m_filter) != std::string::npos;
+    }
+
+    void print_table(std::FILE *fp) const;
+    void write_json(std::FILE *fp) const;
+};
+
+template<class F>
+void Bench::run(const InputSet &in, const char *name, int frames_per_call,
+                double bytes, F func) {
+    if (!enabled(name)) {
+        return;
+    }
+    func();
+    std::vector<double> samples;
+    for (int i = 0; i < m_repeat; i++) {
+        long calls = 0;
+        Clock::time_point t0 = Clock::now();
+        double elapsed;
+        do {
+            func();
+            calls++;
+            elapsed = seconds(Clock::now() - t0);
+        } while (elapsed < SAMPLE_TIME);
+        samples.push_back(elapsed / (calls * frames_per_call));
+    }
+    std::sort(samples.begin(), samples.end());
+    Result r;
+    r.name = name;
+    r.input = in.name;
+    r.frame_time = samples[samples.size() / 2];
+    r.pixels = static_cast<double>(in.width) * in.height;
+    r.bytes = bytes;
+    m_results.push_back(r);
+    std::fprintf(stderr, "%-22s %-10s %9.3f ms\n",
+                 name, in.name.c_str(), r.frame_time * 1e3);
+}
+
+void Bench::print_table(std::FILE *fp) const {
+    std::fprintf(fp, "%-22s %-10s %10s %10s %10s\n",
+                 "kernel", "input", "ns/pixel", "frames/s", "MB/s");
+    for (const Result &r : m_results) {
+        std::fprintf(fp, "%-22s %-10s %10.3f %10.1f %10.1f\n",
+                     r.name.c_str(), r.input.c_str(),
+                     r.frame_time / r.pixels * 1e9, 1.0 / r.frame_time,
+                     r.bytes / r.frame_time * 1e-6);
+    }
+}
+
+void Bench::write_json(std::FILE *fp) const {
+    std::fprintf(fp, "{\n  \"results\": [");
+    for (std::size_t i = 0; i < m_results.size(); i++) {
+        const Result &r = m_results[i];
+        std::fprintf(fp,
+                     "%s\n    {\"name\": \"%s\", \"input\": \"%s\", "
+                     "\"ns_per_pixel\": %.6g, \"frames_per_second\": %.6g, "
+                     "\"bytes_per_second\": %.6g}",
+                     i ? "," : "", r.name.c_str(), r.input.c_str(),
+                     r.frame_time / r.pixels * 1e9, 1.0 / r.frame_time,
+                     r.bytes / r.frame_time);
+    }
+    std::fprintf(fp, "\n  ]\n}\n");
+}
+
+// Read frames from a source, using the first for the depth key.
+void load_frames(InputSet &in, FrameSource &source, int key_distance) {
+    in.width = source.width();
+    in.height = source.height();
+    int n = in.width * in.height;
+    const unsigned short *depth;
+    const unsigned char *color;
+    uint32_t timestamp;
+    if (!source.next(depth, color, timestamp)) {
+        die("No frames in input.");
+    }
+    in.key.resize(n);
+    fill_depth_key(depth, in.key.data(), in.width, in.height);
+
+    DepthBackground background(
+        in.width, in.height, default_background_config(key_distance));
+    background.init(in.key.data());
+    RayTable rays(in.width, in.height, kinect_intrinsics(in.width, in.height));
+    PointEncoder encoder;
+    for (int i = 0; i < FRAME_COUNT && source.next(depth, color, timestamp);
+         i++) {
+        in.depth.emplace_back(depth, depth + n);
+        in.color.emplace_back(color, color + n * 3);
+        in.mask.emplace_back(n);
+        background.apply(depth, in.mask.back().data());
+        in.points.emplace_back(n);
+        std::vector<Point> &points = in.points.back();
+        points.resize(convert_points(
+            rays, depth, color, in.mask.back().data(), points.data()));
+        in.encoded.emplace_back();
+        encoder.encode(rays, points.data(), points.size(),
+                       in.encoded.back());
+    }
+}
+
+// Compare the depth key fill with the brute-force search on one
+// frame.  Returns false if they differ.
+bool check_depth_key(const unsigned short *depth, int w, int h) {
+    std::vector<unsigned short> fast(w * h), slow(w * h);
+    int fast_unfilled = fill_depth_key(depth, fast.data(), w, h);
+    int slow_unfilled = fill_depth_key_slow(depth, slow.data(), w, h);
+    return fast_unfilled == slow_unfilled && fast == slow;
+}
+
+// Compare the SIMD depth filter with the scalar one on one frame.
+// Returns false if the masks or the counts differ.
+bool check_depth_filter(const unsigned short *depth,
+                        const unsigned char *mask, int w, int h) {
+    DepthFilter filter(w, h, default_depth_filter_config());
+    std::vector<unsigned char> simd(mask, mask + w * h), scalar(simd);
+    DepthFilterStats a = filter.apply(depth, simd.data());
+    DepthFilterStats b = filter.apply_scalar(depth, scalar.data());
+    return simd == scalar && a.input == b.input && a.flying == b.flying &&
+        a.isolated == b.isolated;
+}
+
+// Compare kd-tree radius and nearest neighbor queries around random
+// points with a brute-force search.  Returns the number of queries
+// which differ.
+int check_kdtree(const KdTree &tree, const std::vector<Point> &points,
+                 int count) {
+    const float radius = 0.02f;
+    const int k = 8;
+    std::mt19937 rng(1);
+    std::vector<uint32_t> found, expected;
+    std::vector<std::pair<float, uint32_t>> all(points.size());
+    int bad = 0;
+    for (int i = 0; i < count; i++) {
+        const float *p = points[rng() % points.size()].v;
+        expected.clear();
+        for (std::size_t j = 0; j < points.size(); j++) {
+            const float *q = points[j].v;
+            float dx = q[0] - p[0], dy = q[1] - p[1], dz = q[2] - p[2];
+            float d2 = dx * dx + dy * dy + dz * dz;
+            all[j] = std::make_pair(d2, static_cast<uint32_t>(j));
+            if (d2 <= radius * radius) {
+                expected.push_back(j);
+            }
+        }
+        tree.radius_search(p, radius, found);
+        std::sort(found.begin(), found.end());
+        bool ok = found == expected;
+
+        // Ties may come in any order, so only distances are compared.
+        std::partial_sort(all.begin(), all.begin() + k, all.end());
+        uint32_t index[k];
+        float dist2[k];
+        tree.knn(p, k, index, dist2);
+        for (int j = 0; j < k; j++) {
+            ok = ok && dist2[j] == all[j].first;
+        }
+        bad += !ok;
+    }
+    return bad;
+}
+
+// Check kernels against their reference versions on a set of frames.
+// Returns the number of failed checks.
+int run_checks(const Bench &bench, const InputSet &in) {
+    int failed = 0;
+    if (bench.enabled("depthkey.check")) {
+        int bad = 0;
+        for (const std::vector<unsigned short> &depth : in.depth) {
+            bad += !check_depth_key(depth.data(), in.width, in.height);
+        }
+        std::fprintf(stderr, "%-22s %-10s %d/%zu frames differ\n",
+                     "depthkey.check", in.name.c_str(), bad,
+                     in.depth.size());
+        failed += bad > 0;
+    }
+    if (bench.enabled("depthfilter.check")) {
+        int bad = 0;
+        for (std::size_t i = 0; i < in.depth.size(); i++) {
+            bad += !check_depth_filter(in.depth[i].data(), in.mask[i].data(),
+                                       in.width, in.height);
+        }
+        std::fprintf(stderr, "%-22s %-10s %d/%zu frames differ\n",
+                     "depthfilter.check", in.name.c_str(), bad,
+                     in.depth.size());
+        failed += bad > 0;
+    }
+    if (bench.enabled("spatial.check")) {
+        // Every pixel of the first frame, built on one thread and on
+        // several, so that subtrees are built separately.
+        std::vector<unsigned char> full_mask(in.width * in.height, 1);
+        std::vector<Point> points(full_mask.size());
+        RayTable rays(in.width, in.height,
+                      kinect_intrinsics(in.width, in.height));
+        points.resize(convert_points(rays, in.depth[0].data(),
+                                     in.color[0].data(), full_mask.data(),
+                                     points.data()));
+        int bad = 0, total = 0;
+        for (int threads : { 1, 4 }) {
+            KdTree tree;
+            tree.build(points.data(), points.size(), threads);
+            bad += check_kdtree(tree, points, SPATIAL_CHECK_COUNT);
+            total += SPATIAL_CHECK_COUNT;
+        }
+        std::fprintf(stderr, "%-22s %-10s %d/%d queries differ\n",
+                     "spatial.check", in.name.c_str(), bad, total);
+        failed += bad > 0;
+    }
+    return failed;
+}
+
+// Check the depth key fill on small random frames, with scattered
+// holes, rectangular holes, unfilled regions wider than the search
+// radius, and the largest depth, which is treated as a hole.
+int run_random_checks(const Bench &bench, int count) {
+    if (!bench.enabled("depthkey.check")) {
+        return 0;
+    }
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> depth_dist(400, 4000);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<unsigned short> depth;
+    int bad = 0;
+    for (int i = 0; i < count; i++) {
+        int w = 1 + rng() % 160, h = 1 + rng() % 32;
+        double holes = unit(rng), largest = 0.05 * unit(rng);
+        depth.resize(w * h);
+        for (unsigned short &d : depth) {
+            double u = unit(rng);
+            d = u < holes ? 0 : u < holes + largest ? 0xffff :
+                depth_dist(rng);
+        }
+        for (int j = rng() % 4; j > 0; j--) {
+            int x0 = rng() % w, y0 = rng() % h;
+            int x1 = std::min<int>(x0 + rng() % 140, w);
+            int y1 = std::min<int>(y0 + rng() % 32, h);
+            for (int y = y0; y < y1; y++) {
+                std::fill(depth.begin() + y * w + x0,
+                          depth.begin() + y * w + x1, 0);
+            }
+        }
+        bad += !check_depth_key(depth.data(), w, h);
+    }
+    std::fprintf(stderr, "%-22s %-10s %d/%d frames differ\n",
+                 "depthkey.check", "random", bad, count);
+    return bad > 0;
+}
+
+// Check the depth filter on small random frames of sloped surfaces,
+// with nearer boxes, flying pixels along their edges, isolated
+// pixels, holes, and background pixels left out of the mask.  Sizes
+// vary so that the edges of the image and of each group of four
+// pixels are covered.
+int run_random_filter_checks(const Bench &bench, int count) {
+    if (!bench.enabled("depthfilter.check")) {
+        return 0;
+    }
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<int> depth_dist(400, 4000);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<unsigned short> depth;
+    std::vector<unsigned char> mask;
+    int bad = 0;
+    for (int i = 0; i < count; i++) {
+        int w = 1 + rng() % 80, h = 1 + rng() % 24;
+        depth.resize(w * h);
+        mask.resize(w * h);
+        double base = depth_dist(rng), sx = 20.0 * unit(rng),
+            sy = 20.0 * unit(rng);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                depth[y * w + x] = base + sx * x + sy * y;
+            }
+        }
+        for (int j = rng() % 4; j > 0; j--) {
+            int x0 = rng() % w, y0 = rng() % h;
+            int x1 = std::min<int>(x0 + 1 + rng() % 30, w);
+            int y1 = std::min<int>(y0 + 1 + rng() % 12, h);
+            int near = depth_dist(rng);
+            double flying = unit(rng);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    unsigned short &d = depth[y * w + x];
+                    bool edge = x == x0 || x == x1 - 1 || y == y0 ||
+                        y == y1 - 1;
+                    d = edge && unit(rng) < flying ? (d + near) / 2 : near;
+                }
+            }
+        }
+        double isolated = 0.1 * unit(rng), holes = 0.2 * unit(rng),
+            unmasked = 0.3 * unit(rng);
+        for (int j = 0; j < w * h; j++) {
+            double u = unit(rng);
+            if (u < isolated) {
+                depth[j] = depth_dist(rng);
+            } else if (u < isolated + holes) {
+                depth[j] = 0;
+            }
+            mask[j] = unit(rng) >= unmasked;
+        }
+        bad += !check_depth_filter(depth.data(), mask.data(), w, h);
+    }
+    std::fprintf(stderr, "%-22s %-10s %d/%d frames differ\n",
+                 "depthfilter.check", "random", bad, count);
+    return bad > 0;
+}
+
+void run_kernels(Bench &bench, const InputSet &in, int key_distance,
+                 const std::string &dir) {
+    int w = in.width, h = in.height, n = w * h;
+    int frames = static_cast<int>(in.depth.size());
+    Intrinsics intr = kinect_intrinsics(w, h);
+    RayTable rays(w, h, intr);
+    std::size_t point_total = 0, encoded_total = 0;
+    for (int i = 0; i < frames; i++) {
+        point_total += in.points[i].size();
+        encoded_total += in.encoded[i].size();
+    }
+    double point_bytes = static_cast<double>(point_total) / frames *
+        sizeof(Point);
+    double encoded_bytes = static_cast<double>(encoded_total) / frames;
+    int frame = 0;
+    auto next_frame = [&frame, frames]() {
+        int f = frame;
+        frame = (frame + 1) % frames;
+        return f;
+    };
+
+    std::vector<unsigned short> key(n);
+    bench.run(in, "depthkey.fill", 1, n * 2.0, [&]() {
+        fill_depth_key(in.depth[next_frame()].data(), key.data(), w, h);
+    });
+
+    DepthBackground background(w, h, default_background_config(key_distance));
+    background.init(in.key.data());
+    std::vector<unsigned char> mask(n);
+    bench.run(in, "background.apply", 1, n * 2.0, [&]() {
+        background.apply(in.depth[next_frame()].data(), mask.data());
+    });
+
+    // The filter clears the mask, so each run starts from a copy.
+    DepthFilter depth_filter(w, h, default_depth_filter_config());
+    bench.run(in, "depthfilter.apply", 1, n * 3.0, [&]() {
+        int f = next_frame();
+        std::copy(in.mask[f].begin(), in.mask[f].end(), mask.begin());
+        depth_filter.apply(in.depth[f].data(), mask.data());
+    });
+
+    Segmenter segmenter(rays, default_segment_config());
+    std::vector<Blob> blobs;
+    bench.run(in, "segment.blobs", 1, n * 3.0, [&]() {
+        int f = next_frame();
+        segmenter.segment(in.depth[f].data(), in.mask[f].data(), blobs);
+    });
+
+    // A crowd of objects on a grid, each walking in its own direction.
+    const int CROWD_SIZE = 256;
+    std::vector<std::vector<Blob>> crowd(frames);
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < CROWD_SIZE; i++) {
+            float a = 2.399963f * i, t = f / 30.0f;
+            Blob b = Blob();
+            b.pixel_count = 1000;
+            b.centroid[0] = (i % 16) * 0.8f + 0.5f * std::cos(a) * t;
+            b.centroid[1] = 0.0f;
+            b.centroid[2] = (i / 16) * 0.8f + 0.5f * std::sin(a) * t;
+            crowd[f].push_back(b);
+        }
+    }
+    Tracker tracker(default_tracker_config());
+    int crowd_frame = 0;
+    bench.run(in, "track.update_256", 1, 0.0, [&]() {
+        // Restart the walk when the frames run out.
+        int f = crowd_frame % frames;
+        if (f == 0) {
+            tracker = Tracker(default_tracker_config());
+        }
+        tracker.update(crowd[f], crowd_frame / 30.0);
+        crowd_frame++;
+    });
+
+    std::vector<Point> points(n);
+    bench.run(in, "convert.simd", 1, n * 6.0, [&]() {
+        int f = next_frame();
+        convert_points(rays, in.depth[f].data(), in.color[f].data(),
+                       in.mask[f].data(), points.data());
+    });
+    bench.run(in, "convert.scalar", 1, n * 6.0, [&]() {
+        int f = next_frame();
+        convert_points_scalar(rays, in.depth[f].data(), in.color[f].data(),
+                              in.mask[f].data(), points.data());
+    });
+
+    // Cell sizes for coarse and fine downsampling.
+    VoxelGrid voxel_coarse(0.02f), voxel_fine(0.005f);
+    bench.run(in, "voxel.apply_20mm", 1, point_bytes, [&]() {
+        int f = next_frame();
+        voxel_coarse.apply(in.points[f].data(), in.points[f].size(),
+                           points.data());
+    });
+    bench.run(in, "voxel.apply_5mm", 1, point_bytes, [&]() {
+        int f = next_frame();
+        voxel_fine.apply(in.points[f].data(), in.points[f].size(),
+                         points.data());
+    });
+
+    // The same kernels on both point layouts.  The crop kernels
+    // include a copy of the frame, since they work in place.
+    std::vector<PointFrame> aos(frames);
+    std::vector<PointFrameSoA> soa(frames);
+    for (int f = 0; f < frames; f++) {
+        aos[f].reserve(in.points[f].size());
+        aos[f].count = in.points[f].size();
+        std::copy(in.points[f].begin(), in.points[f].end(), aos[f].points());
+        to_soa(aos[f], soa[f]);
+    }
+    PointFrame aos_out;
+    PointFrameSoA soa_out;
+    aos_out.reserve(n);
+    soa_out.reserve(n);
+    bench.run(in, "layout.to_soa", 1, point_bytes, [&]() {
+        to_soa(aos[next_frame()], soa_out);
+    });
+    bench.run(in, "layout.to_aos", 1, point_bytes, [&]() {
+        to_aos(soa[next_frame()], aos_out);
+    });
+    bench.run(in, "bounds.aos", 1, point_bytes, [&]() {
+        const PointFrame &f = aos[next_frame()];
+        point_bounds(f.points(), f.count);
+    });
+    bench.run(in, "bounds.soa", 1, point_bytes, [&]() {
+        point_bounds(soa[next_frame()]);
+    });
+    // A small rotation about the vertical axis, applied to the largest
+    // frame over and over.
+    int largest = 0;
+    for (int f = 0; f < frames; f++) {
+        largest = aos[f].count > aos[largest].count ? f : largest;
+    }
+    RigidTransform xf = identity_transform();
+    xf.r[0][0] = xf.r[2][2] = std::cos(0.01f);
+    xf.r[0][2] = std::sin(0.01f);
+    xf.r[2][0] = -xf.r[0][2];
+    xf.t[1] = 0.001f;
+    to_aos(soa[largest], aos_out);
+    to_soa(aos[largest], soa_out);
+    double largest_bytes = aos[largest].count * sizeof(Point);
+    bench.run(in, "transform.aos", 1, largest_bytes, [&]() {
+        transform_points(xf, aos_out.points(), aos_out.count);
+    });
+    bench.run(in, "transform.soa", 1, largest_bytes, [&]() {
+        transform_points(xf, soa_out);
+    });
+    CropBox box = { { -1.0f, -1.0f, 0.5f }, { 1.0f, 1.0f, 3.0f } };
+    bench.run(in, "crop.aos", 1, point_bytes, [&]() {
+        const PointFrame &f = aos[next_frame()];
+        std::copy(f.points(), f.points() + f.count, aos_out.points());
+        crop_points(box, aos_out.points(), f.count);
+    });
+    bench.run(in, "crop.soa", 1, point_bytes, [&]() {
+        const PointFrameSoA &f = soa[next_frame()];
+        std::copy(f.x.begin(), f.x.begin() + f.count, soa_out.x.begin());
+        std::copy(f.y.begin(), f.y.begin() + f.count, soa_out.y.begin());
+        std::copy(f.z.begin(), f.z.begin() + f.count, soa_out.z.begin());
+        std::copy(f.color.begin(), f.color.begin() + f.count,
+                  soa_out.color.begin());
+        soa_out.count = f.count;
+        crop_points(box, soa_out);
+    });
+
+    // Neighborhoods of 2 cm, as for outlier filters and normals.
+    PointGrid grid(0.02f);
+    KdTree tree;
+    bench.run(in, "spatial.grid_build", 1, point_bytes, [&]() {
+        int f = next_frame();
+        grid.build(in.points[f].data(), in.points[f].size());
+    });
+    bench.run(in, "spatial.kdtree_build", 1, point_bytes, [&]() {
+        int f = next_frame();
+        tree.build(in.points[f].data(), in.points[f].size());
+    });
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    // Every pixel of the largest frame with depth, about 300,000
+    // points, as for indexing frames which are not keyed.
+    std::vector<unsigned char> full_mask(n, 1);
+    std::vector<Point> full(n);
+    full.resize(convert_points(rays, in.depth[largest].data(),
+                               in.color[largest].data(), full_mask.data(),
+                               full.data()));
+    double full_bytes = full.size() * sizeof(Point);
+    bench.run(in, "spatial.grid_300k", 1, full_bytes, [&]() {
+        grid.build(full.data(), full.size());
+    });
+    bench.run(in, "spatial.kdtree_300k", 1, full_bytes, [&]() {
+        tree.build(full.data(), full.size(), 1);
+    });
+    bench.run(in, "spatial.kdtree_300k_mt", 1, full_bytes, [&]() {
+        tree.build(full.data(), full.size(), threads);
+    });
+    std::vector<uint32_t> neighbors(n * 8);
+    std::vector<float> neighbor_dist(n * 8);
+    bench.run(in, "spatial.grid_count", 1, point_bytes, [&]() {
+        int f = next_frame();
+        grid.build(in.points[f].data(), in.points[f].size());
+        grid.count_neighbors(0.02f, neighbors.data(), threads);
+    });
+    bench.run(in, "spatial.kdtree_knn8", 1, point_bytes, [&]() {
+        int f = next_frame();
+        tree.build(in.points[f].data(), in.points[f].size());
+        tree.knn_batch(in.points[f].data(), in.points[f].size(), 8,
+                       neighbors.data(), neighbor_dist.data(), threads);
+    });
+
+    PointEncoder encoder;
+    std::vector<unsigned char> buffer;
+    bench.run(in, "codec.encode_points", 1, point_bytes, [&]() {
+        int f = next_frame();
+        encoder.encode(rays, in.points[f].data(), in.points[f].size(),
+                       buffer);
+    });
+    bench.run(in, "codec.decode_points", 1, encoded_bytes, [&]() {
+        int f = next_frame();
+        if (!decode_points(rays, in.encoded[f].data(), in.encoded[f].size(),
+                           points.data(), in.points[f].size())) {
+            die("Could not decode frame.");
+        }
+    });
+    std::vector<unsigned short> depth(n);
+    bench.run(in, "codec.encode_depth", 1, n * 2.0, [&]() {
+        buffer.clear();
+        encode_depth(in.depth[next_frame()].data(), w, h, buffer);
+    });
+    std::vector<std::vector<unsigned char>> depth_encoded(frames);
+    for (int i = 0; i < frames; i++) {
+        encode_depth(in.depth[i].data(), w, h, depth_encoded[i]);
+    }
+    bench.run(in, "codec.decode_depth", 1, n * 2.0, [&]() {
+        const std::vector<unsigned char> &e = depth_encoded[next_frame()];
+        if (!decode_depth(e.data(), e.data() + e.size(), depth.data(),
+                          w, h)) {
+            die("Could not decode frame.");
+        }
+    });
+
+    // Each call writes every frame to a new file, so the time includes
+    // writing the index.  Writes usually only reach the page cache.
+    PointFileHeader header = point_file_header(w, h, intr,
+                                               KINECT_TIMESTAMP_RATE);
+    header.key_distance = key_distance;
+    struct FileKernel {
+        const char *write_name, *read_name, *suffix;
+        uint32_t encoding;
+        double bytes;
+    };
+    const FileKernel file_kernels[] = {
+        { "file.write_raw", "file.read_raw", "raw", FRAME_RAW, point_bytes },
+        { "file.write_delta", "file.read_delta", "delta", FRAME_DELTA,
+          point_bytes },
+        { "file.write_depth", "file.read_depth", "depth", FRAME_DEPTH_RGB,
+          n * 5.0 },
+    };
+    for (const FileKernel &k : file_kernels) {
+        std::string path = dir + "/pctrack_bench_" + in.name + "_" +
+            k.suffix + ".pc";
+        auto write_file = [&]() {
+            PointFileWriter writer;
+            writer.open(path, header);
+            if (k.encoding == FRAME_DEPTH_RGB) {
+                writer.write_depth_key(in.key.data());
+                for (int i = 0; i < frames; i++) {
+                    writer.write_depth_frame(in.depth[i].data(),
+                                             in.color[i].data(), i, i);
+                }
+            } else {
+                writer.set_encoding(k.encoding);
+                for (int i = 0; i < frames; i++) {
+                    writer.write_frame(in.points[i].data(),
+                                       in.points[i].size(), i, i);
+                }
+            }
+            writer.close();
+        };
+        bench.run(in, k.write_name, frames, k.bytes, write_file);
+        if (!bench.enabled(k.read_name)) {
+            std::remove(path.c_str());
+            continue;
+        }
+        if (!bench.enabled(k.write_name)) {
+            write_file();
+        }
+
+        // Raw frames are keyed in order, so they are read through
+        // FrameReader, starting again at the end of the file.
+        FrameReader reader;
+        reader.open(path);
+        PointFrame frame;
+        bench.run(in, k.read_name, 1, k.bytes, [&]() {
+            if (!reader.next(frame)) {
+                reader.seek(0);
+                reader.next(frame);
+            }
+        });
+        reader.close();
+        std::remove(path.c_str());
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    const char *json_path = nullptr, *replay = nullptr;
+    std::string filter, dir = "/tmp";
+    int repeat = 5, key_distance = 100;
+    bool check = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(std::stoi(argv[++i]), 1);
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (arg == "--check") {
+            check = true;
+        } else {
+            die("Usage: pctrack_bench [--check] [--json FILE] "
+                "[--replay RAW_FILE] [--filter NAME] [--repeat N] "
+                "[--dir DIR]");
+        }
+    }
+
+    // The synthetic frames are always the same, and recorded frames
+    // are the first frames of the capture.
+    std::vector<InputSet> inputs(1);
+    {
+        SyntheticSource source(default_synthetic_config(640, 480));
+        inputs[0].name = "synthetic";
+        load_frames(inputs[0], source, key_distance);
+    }
+    if (replay) {
+        ReplaySource source(replay, false);
+        inputs.emplace_back();
+        inputs.back().name = "recorded";
+        load_frames(inputs.back(), source, key_distance);
+        if (inputs.back().depth.empty()) {
+            die("Not enough frames: %s", replay);
+        }
+    }
+
+    Bench bench(filter, repeat);
+    if (check) {
+        int failed = run_random_checks(bench, RANDOM_CHECK_COUNT) +
+            run_random_filter_checks(bench, RANDOM_CHECK_COUNT);
+        for (const InputSet &in : inputs) {
+            failed += run_checks(bench, in);
+        }
+        if (failed) {
+            die("%d checks failed.", failed);
+        }
+        return 0;
+    }
+    for (const InputSet &in : inputs) {
+        run_kernels(bench, in, key_distance, dir);
+    }
+    bool use_stdout = json_path && !std::strcmp(json_path, "-");
+    bench.print_table(use_stdout ? stderr : stdout);
+    if (json_path) {
+        std::FILE *fp = use_stdout ? stdout : std::fopen(json_path, "w");
+        if (!fp) {
+            die("Could not open file: %s", json_path);
+        }
+        bench.write_json(fp);
+        if (!use_stdout && std::fclose(fp)) {
+            die("Could not write file: %s", json_path);
+        }
+    }
+    return 0;
+}
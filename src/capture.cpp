@@ -0,0 +1,269 @@
+#include "capture.hpp"
+#include "background.hpp"
+#include "convert.hpp"
+#include "defs.hpp"
+#include "pcfile.hpp"
+#include "voxel.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const double FRAME_PERIOD = 1.0 / 30.0;
+
+// Sent to a stage to make it exit.
+const int STOP = -1;
+
+// Wait a little while, yielding at first and then sleeping.
+void backoff(int &spins) {
+    if (spins < 64) {
+        spins++;
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+template<class T>
+void wait_pop(SpscRing<T> &ring, T &item) {
+    int spins = 0;
+    while (!ring.pop(item)) {
+        backoff(spins);
+    }
+}
+
+void wait_push(SpscRing<int> &ring, int item) {
+    while (!ring.push(item)) {
+        std::this_thread::yield();
+    }
+}
+
+template<class D>
+double seconds(D d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+}
+
+CaptureStats::CaptureStats()
+    : frames(0), dropped(0), late(0),
+      acquire_time(0.0), convert_time(0.0), write_time(0.0),
+      observe_time(0.0), max_latency(0.0), wall_time(0.0) {}
+
+CaptureStages::CaptureStages()
+    : filter(nullptr), voxel_size(0.0f), observer(nullptr) {}
+
+FrameObserver::~FrameObserver() {}
+
+void print_capture_stats(const CaptureStats &stats) {
+    std::fprintf(stderr, "Frames: %u written, %u dropped, %u late.\n",
+                 stats.frames, stats.dropped, stats.late);
+    if (!stats.frames || stats.wall_time <= 0.0) {
+        return;
+    }
+    double scale = 1000.0 / stats.frames;
+    std::fprintf(stderr,
+                 "Time per frame: acquire %.2f ms, convert %.2f ms, "
+                 "write %.2f ms, wall %.2f ms.\n",
+                 stats.acquire_time * scale, stats.convert_time * scale,
+                 stats.write_time * scale, stats.wall_time * scale);
+    if (stats.observe_time > 0.0) {
+        std::fprintf(stderr, "Time per frame: observe %.2f ms.\n",
+                     stats.observe_time * scale);
+    }
+    if (stats.filter.input) {
+        print_depth_filter_stats(stats.filter);
+    }
+    double busy = stats.acquire_time + stats.convert_time +
+        stats.write_time + stats.observe_time;
+    std::fprintf(stderr, "Overlap: %.2fx, max latency %.1f ms.\n",
+                 busy / stats.wall_time, stats.max_latency * 1000.0);
+}
+
+int CapturePipeline::default_worker_count() {
+    // Leave a core each for the device and writer threads.
+    int n = static_cast<int>(std::thread::hardware_concurrency()) - 2;
+    return std::min(std::max(n, 1), 8);
+}
+
+CapturePipeline::CapturePipeline(const RayTable &rays,
+                                 DepthBackground &background,
+                                 PointFileWriter &writer, int frame_count,
+                                 int worker_count, int slot_count,
+                                 bool raw, const CaptureStages &stages)
+    : m_rays(rays), m_background(background), m_writer(writer),
+      m_width(rays.width), m_height(rays.height),
+      m_frame_count(frame_count), m_accepted(0), m_finished(false),
+      m_raw(raw), m_filter(raw ? nullptr : stages.filter),
+      m_observer(raw ? nullptr : stages.observer),
+      m_free(slot_count), m_write(slot_count + 1), m_late(0) {
+    int n = m_width * m_height;
+    if (!raw && stages.voxel_size > 0.0f) {
+        m_voxel.reset(new VoxelGrid(stages.voxel_size));
+    }
+    worker_count = raw ? 0 : std::min(std::max(worker_count, 1), m_height);
+
+    m_frames.reserve(slot_count);
+    for (int i = 0; i < slot_count; i++) {
+        std::unique_ptr<Frame> f(new Frame);
+        f->depth.resize(n);
+        f->color.resize(n * 3);
+        if (!raw) {
+            f->mask.resize(n);
+            f->points.resize(n);
+        }
+        f->band_count.resize(worker_count);
+        f->remaining = 0;
+        m_frames.push_back(std::move(f));
+        m_free.push(i);
+    }
+
+    m_start = Clock::now();
+    m_bands.resize(worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        Band &b = m_bands[i];
+        b.begin = m_height * i / worker_count * m_width;
+        b.end = m_height * (i + 1) / worker_count * m_width;
+        b.convert_time = 0.0;
+        b.queue.reset(new SpscRing<int>(slot_count + 1));
+    }
+    for (int i = 0; i < worker_count; i++) {
+        m_bands[i].thread = std::thread(&CapturePipeline::run_band, this, i);
+    }
+    m_write_thread = std::thread(&CapturePipeline::run_writer, this);
+}
+
+CapturePipeline::~CapturePipeline() {
+    finish();
+}
+
+bool CapturePipeline::submit(const unsigned short *depth,
+                             const unsigned char *color,
+                             uint32_t timestamp, bool block) {
+    if (!accepting()) {
+        return false;
+    }
+    int slot;
+    if (!m_free.pop(slot)) {
+        if (!block) {
+            m_stats.dropped++;
+            return false;
+        }
+        wait_pop(m_free, slot);
+    }
+    Clock::time_point t0 = Clock::now();
+    Frame &f = *m_frames[slot];
+    int n = m_width * m_height;
+    f.arrival = t0;
+    f.timestamp = m_unwrap(timestamp);
+    std::memcpy(f.depth.data(), depth, n * sizeof(*depth));
+    std::memcpy(f.color.data(), color, n * 3);
+    f.remaining.store(static_cast<int>(m_bands.size()),
+                      std::memory_order_relaxed);
+    for (Band &b : m_bands) {
+        wait_push(*b.queue, slot);
+    }
+    wait_push(m_write, slot);
+    m_accepted++;
+    m_stats.acquire_time += seconds(Clock::now() - t0);
+    return true;
+}
+
+void CapturePipeline::finish() {
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+    for (Band &b : m_bands) {
+        wait_push(*b.queue, STOP);
+    }
+    wait_push(m_write, STOP);
+    for (Band &b : m_bands) {
+        b.thread.join();
+        m_stats.convert_time += b.convert_time;
+        m_stats.filter += b.filter;
+    }
+    m_write_thread.join();
+    m_stats.late = m_late.load();
+    m_stats.wall_time = seconds(Clock::now() - m_start);
+}
+
+void CapturePipeline::run_band(int band) {
+    Band &b = m_bands[band];
+    while (true) {
+        int slot;
+        wait_pop(*b.queue, slot);
+        if (slot == STOP) {
+            break;
+        }
+        Frame &f = *m_frames[slot];
+        Clock::time_point t0 = Clock::now();
+        m_background.apply(f.depth.data(), f.mask.data(), b.begin, b.end);
+        if (m_filter) {
+            b.filter += m_filter->apply(f.depth.data(), f.mask.data(),
+                                        b.begin, b.end);
+        }
+        f.band_count[band] = convert_points(
+            m_rays, f.depth.data(), f.color.data(), f.mask.data(),
+            f.points.data() + b.begin, b.begin, b.end);
+        Clock::time_point t1 = Clock::now();
+        b.convert_time += seconds(t1 - t0);
+        if (f.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (seconds(t1 - f.arrival) > FRAME_PERIOD) {
+                m_late.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void CapturePipeline::run_writer() {
+    while (true) {
+        int slot;
+        wait_pop(m_write, slot);
+        if (slot == STOP) {
+            break;
+        }
+        Frame &f = *m_frames[slot];
+        int spins = 0;
+        while (f.remaining.load(std::memory_order_acquire) != 0) {
+            backoff(spins);
+        }
+
+        if (m_observer) {
+            Clock::time_point t0 = Clock::now();
+            m_observer->observe(f.depth.data(), f.mask.data(), f.timestamp);
+            m_stats.observe_time += seconds(Clock::now() - t0);
+        }
+
+        Clock::time_point t0 = Clock::now();
+        uint64_t host_time = std::chrono::duration_cast<
+            std::chrono::microseconds>(f.arrival - m_start).count();
+        if (m_raw) {
+            m_writer.write_depth_frame(
+                f.depth.data(), f.color.data(), f.timestamp, host_time);
+        } else {
+            // Move the bands together, then write them.
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < m_bands.size(); i++) {
+                std::size_t count = f.band_count[i];
+                const Point *src = f.points.data() + m_bands[i].begin;
+                if (src != f.points.data() + n) {
+                    std::memmove(f.points.data() + n, src,
+                                 count * sizeof(Point));
+                }
+                n += count;
+            }
+            if (m_voxel) {
+                n = m_voxel->apply(f.points.data(), n, f.points.data());
+            }
+            m_writer.write_frame(f.points.data(), n, f.timestamp, host_time);
+        }
+        Clock::time_point t1 = Clock::now();
+        m_stats.write_time += seconds(t1 - t0);
+        m_stats.max_latency =
+            std::max(m_stats.max_latency, seconds(t1 - f.arrival));
+        m_stats.frames++;
+        wait_push(m_free, slot);
+    }
+}
@@ -0,0 +1,197 @@
+#ifndef PCTRACK_CAPTURE_HPP
+#define PCTRACK_CAPTURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "depthfilter.hpp"
+#include "point.hpp"
+#include "ring.hpp"
+
+class DepthBackground;
+class PointFileWriter;
+class VoxelGrid;
+struct RayTable;
+
+/// Extends the device's 32-bit timestamps, which wrap around, to 64
+/// bits.
+class TimestampUnwrapper {
+private:
+    uint64_t m_value;
+    bool m_first;
+
+public:
+    TimestampUnwrapper() : m_value(0), m_first(true) {}
+
+    uint64_t operator()(uint32_t timestamp) {
+        if (m_first) {
+            m_first = false;
+            m_value = timestamp;
+        } else {
+            m_value += static_cast<uint32_t>(
+                timestamp - static_cast<uint32_t>(m_value));
+        }
+        return m_value;
+    }
+};
+
+/// Timing and frame counters for a capture.  Times are in seconds.
+struct CaptureStats {
+    /// Number of frames written.
+    unsigned frames;
+    /// Number of frames discarded because the pipeline was full.
+    unsigned dropped;
+    /// Number of frames which took longer than one frame period to
+    /// convert, measured from when the frame arrived.
+    unsigned late;
+    /// Time spent receiving and copying frames from the device.
+    double acquire_time;
+    /// Time spent keying, filtering, and converting frames, summed
+    /// over threads.
+    double convert_time;
+    /// Time spent writing frames to disk.
+    double write_time;
+    /// Time spent in the frame observer.
+    double observe_time;
+    /// Longest time between arrival of a frame and writing it.
+    double max_latency;
+    /// Total time for the capture.
+    double wall_time;
+    /// Pixels removed by the depth filter, if any.
+    DepthFilterStats filter;
+
+    CaptureStats();
+};
+
+/// Receives each keyed frame of a capture, before it is written.
+/// Calls are made from one thread at a time, in frame order.
+class FrameObserver {
+public:
+    virtual ~FrameObserver();
+
+    /// Observe a frame.  The mask is nonzero for foreground pixels, and
+    /// the timestamp is in ticks of the device clock.
+    virtual void observe(const unsigned short *depth,
+                         const unsigned char *mask,
+                         uint64_t timestamp) = 0;
+};
+
+/// Optional stages of a capture, after keying.  None are used in raw
+/// mode.
+struct CaptureStages {
+    /// Filter applied to the mask of each frame before it is
+    /// converted, or null.
+    const DepthFilter *filter;
+    /// Size of the voxels each frame is downsampled to, in meters, or
+    /// zero to disable downsampling.
+    float voxel_size;
+    /// Observer passed each keyed frame, or null.
+    FrameObserver *observer;
+
+    CaptureStages();
+};
+
+/// Print capture statistics to stderr.
+void print_capture_stats(const CaptureStats &stats);
+
+/// Multi-threaded capture pipeline.  Frames are submitted from the
+/// device thread, keyed and converted by a pool of workers which each
+/// handle a band of rows, and written in order by a writer thread.
+/// The stages are connected by lock-free rings of preallocated frame
+/// slots.  If no slot is free when a frame arrives, the frame is
+/// dropped and counted, rather than stalling the device.
+///
+/// In raw mode there are no workers, and the writer stores the depth
+/// and color images themselves.  Otherwise, if there is a depth
+/// filter, the workers apply it to their band after keying.  If a
+/// voxel size is given, the writer downsamples each frame with a
+/// VoxelGrid, and if there is an observer, the writer passes it each
+/// frame.
+class CapturePipeline {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Frame {
+        Clock::time_point arrival;
+        uint64_t timestamp;
+        std::vector<unsigned short> depth;
+        std::vector<unsigned char> color;
+        std::vector<unsigned char> mask;
+        std::vector<Point> points;
+        std::vector<std::size_t> band_count;
+        std::atomic<int> remaining;
+    };
+
+    struct Band {
+        int begin, end;
+        double convert_time;
+        DepthFilterStats filter;
+        std::unique_ptr<SpscRing<int>> queue;
+        std::thread thread;
+    };
+
+    const RayTable &m_rays;
+    DepthBackground &m_background;
+    PointFileWriter &m_writer;
+    int m_width, m_height;
+    unsigned m_frame_count;
+    unsigned m_accepted;
+    bool m_finished;
+    bool m_raw;
+    const DepthFilter *m_filter;
+    std::unique_ptr<VoxelGrid> m_voxel;
+    FrameObserver *m_observer;
+
+    std::vector<std::unique_ptr<Frame>> m_frames;
+    std::vector<Band> m_bands;
+    SpscRing<int> m_free;
+    SpscRing<int> m_write;
+    std::thread m_write_thread;
+    std::atomic<unsigned> m_late;
+    TimestampUnwrapper m_unwrap;
+
+    CaptureStats m_stats;
+    Clock::time_point m_start;
+
+    void run_band(int band);
+    void run_writer();
+
+public:
+    /// Create a pipeline which writes the given number of frames to a
+    /// file, using the given number of worker threads.  The filter
+    /// and observer must outlive the pipeline.
+    CapturePipeline(const RayTable &rays, DepthBackground &background,
+                    PointFileWriter &writer, int frame_count,
+                    int worker_count, int slot_count, bool raw = false,
+                    const CaptureStages &stages = CaptureStages());
+    CapturePipeline(const CapturePipeline &) = delete;
+    ~CapturePipeline();
+    CapturePipeline &operator=(const CapturePipeline &) = delete;
+
+    /// Test whether the pipeline still needs more frames.
+    bool accepting() const { return m_accepted < m_frame_count; }
+
+    /// Submit a frame from the device.  The images are copied, so the
+    /// buffers can be reused after this returns.  Returns false if the
+    /// frame was dropped or is not needed.  If block is true, this
+    /// waits for a free slot instead of dropping the frame.  This must
+    /// always be called from the same thread.
+    bool submit(const unsigned short *depth, const unsigned char *color,
+                uint32_t timestamp, bool block = false);
+
+    /// Wait for all submitted frames to be written, and stop the
+    /// worker threads.
+    void finish();
+
+    /// Get the capture statistics.  Only valid after finish().
+    const CaptureStats &stats() const { return m_stats; }
+
+    /// Get the default number of worker threads for this machine.
+    static int default_worker_count();
+};
+
+#endif
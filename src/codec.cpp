@@ -0,0 +1,285 @@
+#include "codec.hpp"
+#include "convert.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+namespace {
+
+enum {
+    // Runs of pixels, with depth in millimeters.
+    MODE_GRID,
+    // Positions quantized to millimeters.
+    MODE_XYZ
+};
+
+inline unsigned zigzag(int v) {
+    return (static_cast<unsigned>(v) << 1) ^ static_cast<unsigned>(v >> 31);
+}
+
+inline int unzigzag(unsigned v) {
+    return static_cast<int>(v >> 1) ^ -static_cast<int>(v & 1);
+}
+
+inline unsigned char *put_varint(unsigned char *p, unsigned v) {
+    while (v >= 0x80) {
+        *p++ = static_cast<unsigned char>(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = static_cast<unsigned char>(v);
+    return p;
+}
+
+// Read a variable-length integer, or return null if it runs past the
+// end of the data.
+inline const unsigned char *get_varint(const unsigned char *p,
+                                       const unsigned char *end,
+                                       unsigned &v) {
+    unsigned r = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) {
+            return nullptr;
+        }
+        unsigned b = *p++;
+        r |= (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            v = r;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+inline int clamp_byte(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Divide by 256 and round, for values which may be negative.
+inline int descale(int v) {
+    return ((v + (1 << 7) + (1 << 20)) >> 8) - (1 << 12);
+}
+
+// Encode colors as a plane of Y followed by interleaved Cb and Cr for
+// each pair of points.
+unsigned char *encode_colors(const Point *points, std::size_t count,
+                             unsigned char *p) {
+    unsigned char *yp = p, *cp = p + count;
+    for (std::size_t i = 0; i < count; i += 2) {
+        int cb = 0, cr = 0, n = 0;
+        for (std::size_t j = i; j < i + 2 && j < count; j++, n++) {
+            unsigned c = points[j].color;
+            int r = c & 0xff, g = (c >> 8) & 0xff, b = (c >> 16) & 0xff;
+            yp[j] = static_cast<unsigned char>(
+                (77 * r + 150 * g + 29 * b + 128) >> 8);
+            cb += (-43 * r - 85 * g + 128 * b + 32896) >> 8;
+            cr += (128 * r - 107 * g - 21 * b + 32896) >> 8;
+        }
+        *cp++ = static_cast<unsigned char>((cb + n / 2) / n);
+        *cp++ = static_cast<unsigned char>((cr + n / 2) / n);
+    }
+    return cp;
+}
+
+const unsigned char *decode_colors(const unsigned char *p,
+                                   const unsigned char *end,
+                                   Point *out, std::size_t count) {
+    std::size_t size = count + (count + 1) / 2 * 2;
+    if (static_cast<std::size_t>(end - p) < size) {
+        return nullptr;
+    }
+    const unsigned char *yp = p, *cp = p + count;
+    for (std::size_t i = 0; i < count; i += 2) {
+        int cb = *cp++ - 128, cr = *cp++ - 128;
+        int dr = descale(359 * cr);
+        int dg = descale(-88 * cb - 183 * cr);
+        int db = descale(454 * cb);
+        for (std::size_t j = i; j < i + 2 && j < count; j++) {
+            int y = yp[j];
+            out[j].color =
+                static_cast<unsigned>(clamp_byte(y + dr)) |
+                (static_cast<unsigned>(clamp_byte(y + dg)) << 8) |
+                (static_cast<unsigned>(clamp_byte(y + db)) << 16);
+        }
+    }
+    return cp;
+}
+
+}
+
+// Find the pixel and depth of every point, or return false if any
+// point does not lie exactly on a pixel ray, or if the points are not
+// in pixel order.
+bool PointEncoder::find_pixels(const RayTable &rays, const Point *points,
+                               std::size_t count) {
+    m_pixel.resize(count);
+    m_depth.resize(count);
+    const float *rx = rays.x.data(), *ry = rays.y.data();
+    long n = static_cast<long>(rays.width) * rays.height;
+    // Rays vary linearly across rows and columns, so the pixel can be
+    // found from the first and last rays.
+    float du = (rx[rays.width - 1] - rx[0]) / (rays.width - 1);
+    float dv = (ry[n - 1] - ry[0]) / (rays.height - 1);
+    long last = -1;
+    for (std::size_t i = 0; i < count; i++) {
+        const Point &pt = points[i];
+        long d = std::lround(pt.v[2] * 1000.0f);
+        if (d <= 0 || d > 0xffff) {
+            return false;
+        }
+        float z = 0.001f * static_cast<float>(d);
+        if (z != pt.v[2]) {
+            return false;
+        }
+        long u = std::lround((pt.v[0] / z - rx[0]) / du);
+        long v = std::lround((pt.v[1] / z - ry[0]) / dv);
+        if (u < 0 || u >= rays.width || v < 0 || v >= rays.height) {
+            return false;
+        }
+        long k = v * rays.width + u;
+        if (k <= last || z * rx[k] != pt.v[0] || z * ry[k] != pt.v[1]) {
+            return false;
+        }
+        m_pixel[i] = static_cast<unsigned>(k);
+        m_depth[i] = static_cast<unsigned>(d);
+        last = k;
+    }
+    return true;
+}
+
+void PointEncoder::encode(const RayTable &rays, const Point *points,
+                          std::size_t count,
+                          std::vector<unsigned char> &out) {
+    // The output is written to a buffer with room for the largest
+    // encoding, and only the encoded bytes are copied out, so that
+    // the output is not filled to its largest size for every frame.
+    std::size_t capacity = 1 + count * 20 + 16;
+    if (m_buffer.size() < capacity) {
+        m_buffer.resize(capacity);
+    }
+    unsigned char *p = m_buffer.data();
+    if (rays.width > 1 && rays.height > 1 &&
+        find_pixels(rays, points, count)) {
+        const unsigned *pixel = m_pixel.data(), *depth = m_depth.data();
+        *p++ = MODE_GRID;
+        unsigned next = 0;
+        int last_depth = 0;
+        std::size_t i = 0;
+        while (i < count) {
+            std::size_t j = i + 1;
+            while (j < count && pixel[j] == pixel[j - 1] + 1) {
+                j++;
+            }
+            p = put_varint(p, pixel[i] - next);
+            p = put_varint(p, static_cast<unsigned>(j - i));
+            for (; i < j; i++) {
+                int d = static_cast<int>(depth[i]);
+                p = put_varint(p, zigzag(d - last_depth));
+                last_depth = d;
+            }
+            next = pixel[j - 1] + 1;
+        }
+    } else {
+        *p++ = MODE_XYZ;
+        int last[3] = {0, 0, 0};
+        for (std::size_t i = 0; i < count; i++) {
+            for (int k = 0; k < 3; k++) {
+                int q = static_cast<int>(
+                    std::lround(points[i].v[k] * 1000.0f));
+                p = put_varint(p, zigzag(q - last[k]));
+                last[k] = q;
+            }
+        }
+    }
+
+    p = encode_colors(points, count, p);
+    out.assign(m_buffer.data(), p);
+}
+
+bool decode_points(const RayTable &rays, const unsigned char *data,
+                   std::size_t size, Point *out, std::size_t count) {
+    const unsigned char *p = data, *end = data + size;
+    if (p == end) {
+        return false;
+    }
+    int mode = *p++;
+    unsigned v;
+    if (mode == MODE_GRID) {
+        const float *rx = rays.x.data(), *ry = rays.y.data();
+        unsigned n = static_cast<unsigned>(rays.width * rays.height);
+        unsigned next = 0;
+        int d = 0;
+        std::size_t i = 0;
+        while (i < count) {
+            unsigned skip, len;
+            if (!(p = get_varint(p, end, skip)) ||
+                !(p = get_varint(p, end, len))) {
+                return false;
+            }
+            unsigned k = next + skip;
+            if (len > count - i || k > n || len > n - k) {
+                return false;
+            }
+            for (unsigned j = 0; j < len; j++, k++, i++) {
+                if (!(p = get_varint(p, end, v))) {
+                    return false;
+                }
+                d += unzigzag(v);
+                float z = 0.001f * static_cast<float>(d);
+                out[i].v[0] = z * rx[k];
+                out[i].v[1] = z * ry[k];
+                out[i].v[2] = z;
+            }
+            next = k;
+        }
+    } else if (mode == MODE_XYZ) {
+        int q[3] = {0, 0, 0};
+        for (std::size_t i = 0; i < count; i++) {
+            for (int k = 0; k < 3; k++) {
+                if (!(p = get_varint(p, end, v))) {
+                    return false;
+                }
+                q[k] += unzigzag(v);
+                out[i].v[k] = 0.001f * static_cast<float>(q[k]);
+            }
+        }
+    } else {
+        return false;
+    }
+    return decode_colors(p, end, out, count) != nullptr;
+}
+
+void encode_depth(const unsigned short *depth, int width, int height,
+                  std::vector<unsigned char> &out) {
+    std::size_t pos = out.size();
+    out.resize(pos + static_cast<std::size_t>(width) * height * 3);
+    unsigned char *p = out.data() + pos;
+    for (int y = 0; y < height; y++) {
+        const unsigned short *row = depth + y * width;
+        int last = 0;
+        for (int x = 0; x < width; x++) {
+            p = put_varint(p, zigzag(row[x] - last));
+            last = row[x];
+        }
+    }
+    out.resize(p - out.data());
+}
+
+const unsigned char *decode_depth(const unsigned char *data,
+                                  const unsigned char *end,
+                                  unsigned short *depth,
+                                  int width, int height) {
+    const unsigned char *p = data;
+    for (int y = 0; y < height; y++) {
+        unsigned short *row = depth + y * width;
+        int last = 0;
+        for (int x = 0; x < width; x++) {
+            unsigned v;
+            if (!(p = get_varint(p, end, v))) {
+                return nullptr;
+            }
+            last += unzigzag(v);
+            row[x] = static_cast<unsigned short>(last);
+        }
+    }
+    return p;
+}
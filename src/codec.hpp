@@ -0,0 +1,56 @@
+#ifndef PCTRACK_CODEC_HPP
+#define PCTRACK_CODEC_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "point.hpp"
+
+struct RayTable;
+
+// Compressed frame encoding.  Points are stored in order, with
+// positions delta-coded as variable-length integers, and colors as
+// YCbCr with one chroma sample per pair of points.
+//
+// There are two position modes.  If every point lies exactly on a
+// pixel ray of the sensor, as it does in frames from pckinect, points
+// are stored as runs of consecutive pixels with depth in millimeters,
+// and positions are reconstructed exactly from the ray table.
+// Otherwise, positions are quantized to millimeters.
+
+/// Encoder for compressed frames.  This keeps scratch buffers, so
+/// repeated encoding does not allocate.
+class PointEncoder {
+private:
+    std::vector<unsigned> m_pixel, m_depth;
+    // Space for the largest encoding of the last frames, which is
+    // only filled when it grows.
+    std::vector<unsigned char> m_buffer;
+
+    bool find_pixels(const RayTable &rays, const Point *points,
+                     std::size_t count);
+
+public:
+    /// Encode points, replacing the contents of the output.
+    void encode(const RayTable &rays, const Point *points,
+                std::size_t count, std::vector<unsigned char> &out);
+};
+
+/// Decode points which were encoded with PointEncoder.  Returns
+/// false if the data is corrupt.
+bool decode_points(const RayTable &rays, const unsigned char *data,
+                   std::size_t size, Point *out, std::size_t count);
+
+/// Losslessly encode a depth image, appending to the output.  Each
+/// depth is stored as the difference from the pixel to its left.
+void encode_depth(const unsigned short *depth, int width, int height,
+                  std::vector<unsigned char> &out);
+
+/// Decode a depth image.  Returns a pointer past the end of the
+/// encoded image, or null if the data is corrupt.
+const unsigned char *decode_depth(const unsigned char *data,
+                                  const unsigned char *end,
+                                  unsigned short *depth,
+                                  int width, int height);
+
+#endif
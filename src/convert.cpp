@@ -0,0 +1,193 @@
+#include "convert.hpp"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+Intrinsics kinect_intrinsics(int width, int height) {
+    // This is the scale factor of 0.0021 per pixel per meter that
+    // pckinect used before it had a ray table.
+    Intrinsics intr;
+    intr.fx = 1.0f / 0.0021f;
+    intr.fy = 1.0f / 0.0021f;
+    intr.cx = static_cast<float>(width / 2);
+    intr.cy = static_cast<float>(height / 2);
+    return intr;
+}
+
+RayTable::RayTable(int width, int height, const Intrinsics &intr)
+    : width(width), height(height),
+      x(width * height), y(width * height) {
+    float sx = 1.0f / intr.fx, sy = 1.0f / intr.fy;
+    for (int py = 0; py < height; py++) {
+        for (int px = 0; px < width; px++) {
+            int i = py * width + px;
+            x[i] = (intr.cx - static_cast<float>(px)) * sx;
+            y[i] = (intr.cy - static_cast<float>(py)) * sy;
+        }
+    }
+}
+
+namespace {
+
+unsigned read_color(const unsigned char *p) {
+    union {
+        unsigned char uc[4];
+        unsigned ui;
+    } c;
+    c.uc[0] = p[0];
+    c.uc[1] = p[1];
+    c.uc[2] = p[2];
+    c.uc[3] = 0;
+    return c.ui;
+}
+
+// Convert pixels [i, n) one at a time.  Every pixel is written to the
+// output, but the output only advances past pixels in the mask, so
+// there is no branch on the mask.
+std::size_t convert_tail(const RayTable &rays,
+                         const unsigned short *depth,
+                         const unsigned char *color,
+                         const unsigned char *mask,
+                         Point *out, int i, int n, std::size_t count) {
+    const float *rx = rays.x.data(), *ry = rays.y.data();
+    for (; i < n; i++) {
+        float z = 0.001f * depth[i];
+        Point &p = out[count];
+        p.v[0] = z * rx[i];
+        p.v[1] = z * ry[i];
+        p.v[2] = z;
+        p.color = read_color(color + i * 3);
+        count += mask[i] != 0;
+    }
+    return count;
+}
+
+#if defined(__SSE2__)
+
+// Read packed RGB as RGB0.  This reads one byte past the pixel.
+inline int load_rgb(const unsigned char *p) {
+    unsigned c;
+    std::memcpy(&c, p, 4);
+    return static_cast<int>(c & 0xffffffu);
+}
+
+// Get a bit for each nonzero byte in the first four bytes of the mask.
+inline int load_mask4(const unsigned char *p) {
+    int m;
+    std::memcpy(&m, p, 4);
+    __m128i v = _mm_cmpeq_epi8(_mm_cvtsi32_si128(m), _mm_setzero_si128());
+    return ~_mm_movemask_epi8(v) & 0xf;
+}
+
+// Transpose four points from SoA to AoS, and store them, advancing
+// the output only for points in the mask.
+inline std::size_t store4(Point *out, std::size_t count,
+                          __m128 x, __m128 y, __m128 z, __m128 c,
+                          int keep) {
+    _MM_TRANSPOSE4_PS(x, y, z, c);
+    _mm_storeu_ps(reinterpret_cast<float *>(out + count), x);
+    count += keep & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(out + count), y);
+    count += (keep >> 1) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(out + count), z);
+    count += (keep >> 2) & 1;
+    _mm_storeu_ps(reinterpret_cast<float *>(out + count), c);
+    count += (keep >> 3) & 1;
+    return count;
+}
+
+#endif
+
+}
+
+std::size_t convert_points(const RayTable &rays,
+                           const unsigned short *depth,
+                           const unsigned char *color,
+                           const unsigned char *mask,
+                           Point *out) {
+    return convert_points(rays, depth, color, mask, out,
+                          0, rays.width * rays.height);
+}
+
+std::size_t convert_points(const RayTable &rays,
+                           const unsigned short *depth,
+                           const unsigned char *color,
+                           const unsigned char *mask,
+                           Point *out, int begin, int end) {
+    int n = end, i = begin;
+    std::size_t count = 0;
+
+    // The vector loops stop before the last group, because colors are
+    // read four bytes at a time.
+#if defined(__AVX2__)
+    {
+        const float *rx = rays.x.data(), *ry = rays.y.data();
+        const __m256 scale = _mm256_set1_ps(0.001f);
+        for (; i + 8 < n; i += 8) {
+            __m128i raw = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(depth + i));
+            __m256 z = _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw)), scale);
+            __m256 x = _mm256_mul_ps(z, _mm256_loadu_ps(rx + i));
+            __m256 y = _mm256_mul_ps(z, _mm256_loadu_ps(ry + i));
+            const unsigned char *cp = color + i * 3;
+            __m256 c = _mm256_castsi256_ps(_mm256_setr_epi32(
+                load_rgb(cp), load_rgb(cp + 3),
+                load_rgb(cp + 6), load_rgb(cp + 9),
+                load_rgb(cp + 12), load_rgb(cp + 15),
+                load_rgb(cp + 18), load_rgb(cp + 21)));
+            int keep = load_mask4(mask + i) |
+                (load_mask4(mask + i + 4) << 4);
+            count = store4(out, count,
+                           _mm256_castps256_ps128(x),
+                           _mm256_castps256_ps128(y),
+                           _mm256_castps256_ps128(z),
+                           _mm256_castps256_ps128(c),
+                           keep);
+            count = store4(out, count,
+                           _mm256_extractf128_ps(x, 1),
+                           _mm256_extractf128_ps(y, 1),
+                           _mm256_extractf128_ps(z, 1),
+                           _mm256_extractf128_ps(c, 1),
+                           keep >> 4);
+        }
+    }
+#elif defined(__SSE2__)
+    {
+        const float *rx = rays.x.data(), *ry = rays.y.data();
+        const __m128 scale = _mm_set1_ps(0.001f);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 < n; i += 4) {
+            __m128i raw = _mm_loadl_epi64(
+                reinterpret_cast<const __m128i *>(depth + i));
+            __m128 z = _mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero)), scale);
+            __m128 x = _mm_mul_ps(z, _mm_loadu_ps(rx + i));
+            __m128 y = _mm_mul_ps(z, _mm_loadu_ps(ry + i));
+            const unsigned char *cp = color + i * 3;
+            __m128 c = _mm_castsi128_ps(_mm_setr_epi32(
+                load_rgb(cp), load_rgb(cp + 3),
+                load_rgb(cp + 6), load_rgb(cp + 9)));
+            count = store4(out, count, x, y, z, c, load_mask4(mask + i));
+        }
+    }
+#endif
+
+    return convert_tail(rays, depth, color, mask, out, i, n, count);
+}
+
+std::size_t convert_points_scalar(const RayTable &rays,
+                                  const unsigned short *depth,
+                                  const unsigned char *color,
+                                  const unsigned char *mask,
+                                  Point *out) {
+    return convert_tail(rays, depth, color, mask, out,
+                        0, rays.width * rays.height, 0);
+}
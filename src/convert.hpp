@@ -0,0 +1,57 @@
+#ifndef PCTRACK_CONVERT_HPP
+#define PCTRACK_CONVERT_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "point.hpp"
+
+/// Pinhole camera intrinsics for a depth sensor, in pixels.
+struct Intrinsics {
+    float fx, fy;
+    float cx, cy;
+};
+
+/// Get the intrinsics which pckinect has always used for a registered
+/// Kinect depth image of the given size.
+Intrinsics kinect_intrinsics(int width, int height);
+
+/// Per-pixel ray directions for a depth image.  A pixel with depth z
+/// meters is at (x[i] * z, y[i] * z, z).  The X axis points left and
+/// the Y axis points up, as seen from the sensor.
+struct RayTable {
+    int width, height;
+    std::vector<float> x, y;
+
+    RayTable(int width, int height, const Intrinsics &intr);
+};
+
+/// Convert masked pixels of a depth image to points.  Depth is in
+/// millimeters, color is packed RGB, and pixels are converted where
+/// the mask is nonzero.  The output must have room for one point per
+/// pixel, even though usually far fewer are written.  Returns the
+/// number of points written.
+std::size_t convert_points(const RayTable &rays,
+                           const unsigned short *depth,
+                           const unsigned char *color,
+                           const unsigned char *mask,
+                           Point *out);
+
+/// Same as convert_points(), but only for pixels in the range
+/// [begin, end).  The first point is written to out[0], and the
+/// output must have room for end - begin points.  Disjoint ranges may
+/// be converted concurrently.
+std::size_t convert_points(const RayTable &rays,
+                           const unsigned short *depth,
+                           const unsigned char *color,
+                           const unsigned char *mask,
+                           Point *out, int begin, int end);
+
+/// Same as convert_points(), but never uses SIMD instructions.
+std::size_t convert_points_scalar(const RayTable &rays,
+                                  const unsigned short *depth,
+                                  const unsigned char *color,
+                                  const unsigned char *mask,
+                                  Point *out);
+
+#endif
@@ -0,0 +1,211 @@
+#include "depthfilter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+enum {
+    KEEP,
+    FLYING,
+    ISOLATED
+};
+
+// Directions for the flying pixel test.  Each is tested in both
+// senses.
+const int DIRECTIONS[4][2] = { {1, 0}, {0, 1}, {1, 1}, {1, -1} };
+
+// Radius of the window for the neighbor count.
+const int RADIUS = 2;
+
+// Test one pixel, treating pixels outside the image as holes.
+int test_pixel(const unsigned short *depth, int width, int height,
+               int x, int y, float scale, int min_neighbors) {
+    auto at = [=](int dx, int dy) {
+        int u = x + dx, v = y + dy;
+        if (u < 0 || u >= width || v < 0 || v >= height) {
+            return 0.0f;
+        }
+        return static_cast<float>(depth[v * width + u]);
+    };
+    float d = at(0, 0), t = scale * d * d;
+    for (const int *dir : DIRECTIONS) {
+        if (std::abs(d - at(dir[0], dir[1])) > t &&
+            std::abs(d - at(-dir[0], -dir[1])) > t) {
+            return FLYING;
+        }
+    }
+    // Holes never count as neighbors, since the threshold is always
+    // less than the depth.
+    int n = 0;
+    for (int dy = -RADIUS; dy <= RADIUS; dy++) {
+        for (int dx = -RADIUS; dx <= RADIUS; dx++) {
+            n += (dx || dy) && std::abs(d - at(dx, dy)) <= t;
+        }
+    }
+    return n < min_neighbors ? ISOLATED : KEEP;
+}
+
+#if defined(__SSE2__)
+
+inline __m128 load_depth4(const unsigned short *p) {
+    __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, _mm_setzero_si128()));
+}
+
+inline __m128 abs_diff(__m128 a, __m128 b) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(a, b));
+}
+
+#endif
+
+}
+
+DepthFilterConfig default_depth_filter_config() {
+    DepthFilterConfig cfg;
+    cfg.max_step = 10.0f;
+    cfg.min_neighbors = 8;
+    return cfg;
+}
+
+DepthFilterStats::DepthFilterStats() : input(0), flying(0), isolated(0) {}
+
+DepthFilterStats &DepthFilterStats::operator+=(
+    const DepthFilterStats &other) {
+    input += other.input;
+    flying += other.flying;
+    isolated += other.isolated;
+    return *this;
+}
+
+void print_depth_filter_stats(const DepthFilterStats &stats) {
+    double scale = stats.input ? 100.0 / stats.input : 0.0;
+    std::fprintf(stderr,
+                 "Filter: %lu pixels, removed %lu flying (%.1f%%), "
+                 "%lu isolated (%.1f%%).\n",
+                 stats.input, stats.flying, stats.flying * scale,
+                 stats.isolated, stats.isolated * scale);
+}
+
+DepthFilter::DepthFilter(int width, int height,
+                         const DepthFilterConfig &cfg)
+    : m_width(width), m_height(height), m_cfg(cfg),
+      m_step_scale(cfg.max_step * 1e-6f) {}
+
+DepthFilterStats DepthFilter::apply(const unsigned short *depth,
+                                    unsigned char *mask) const {
+    return apply(depth, mask, 0, m_width * m_height);
+}
+
+DepthFilterStats DepthFilter::apply(const unsigned short *depth,
+                                    unsigned char *mask,
+                                    int begin, int end) const {
+    return filter(depth, mask, begin, end, true);
+}
+
+DepthFilterStats DepthFilter::apply_scalar(const unsigned short *depth,
+                                           unsigned char *mask) const {
+    return filter(depth, mask, 0, m_width * m_height, false);
+}
+
+DepthFilterStats DepthFilter::filter(const unsigned short *depth,
+                                     unsigned char *mask, int begin,
+                                     int end, bool simd) const {
+#if !defined(__SSE2__)
+    (void) simd;
+#endif
+    DepthFilterStats stats;
+    int w = m_width, h = m_height;
+    for (int y = begin / w; y < end / w; y++) {
+        int x = 0;
+        const unsigned short *row = depth + y * w;
+        unsigned char *mrow = mask + y * w;
+
+#if defined(__SSE2__)
+        // Away from the edges of the image, test four pixels at a
+        // time, skipping groups with no foreground.
+        if (simd && y >= RADIUS && y < h - RADIUS) {
+            const __m128 scale = _mm_set1_ps(m_step_scale);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 min_neighbors =
+                _mm_set1_ps(static_cast<float>(m_cfg.min_neighbors));
+            for (; x < std::min(RADIUS, w); x++) {
+                if (mrow[x] && row[x]) {
+                    stats.input++;
+                    int r = test_pixel(depth, w, h, x, y, m_step_scale,
+                                       m_cfg.min_neighbors);
+                    stats.flying += r == FLYING;
+                    stats.isolated += r == ISOLATED;
+                    mrow[x] = r == KEEP ? mrow[x] : 0;
+                }
+            }
+            for (; x + 4 <= w - RADIUS; x += 4) {
+                int m;
+                std::memcpy(&m, mrow + x, 4);
+                if (!m) {
+                    continue;
+                }
+                const unsigned short *p = row + x;
+                __m128 d = load_depth4(p);
+                __m128 t = _mm_mul_ps(scale, _mm_mul_ps(d, d));
+
+                __m128 flying = zero;
+                for (const int *dir : DIRECTIONS) {
+                    int off = dir[1] * w + dir[0];
+                    flying = _mm_or_ps(flying, _mm_and_ps(
+                        _mm_cmpgt_ps(abs_diff(d, load_depth4(p + off)), t),
+                        _mm_cmpgt_ps(abs_diff(d, load_depth4(p - off)),
+                                     t)));
+                }
+
+                __m128 count = zero;
+                for (int dy = -RADIUS; dy <= RADIUS; dy++) {
+                    for (int dx = -RADIUS; dx <= RADIUS; dx++) {
+                        if (!dx && !dy) {
+                            continue;
+                        }
+                        __m128 a = load_depth4(p + dy * w + dx);
+                        count = _mm_add_ps(count, _mm_and_ps(
+                            _mm_cmple_ps(abs_diff(d, a), t), one));
+                    }
+                }
+                __m128 isolated = _mm_cmplt_ps(count, min_neighbors);
+
+                __m128i mv = _mm_cmpeq_epi8(_mm_cvtsi32_si128(m),
+                                            _mm_setzero_si128());
+                int fg = ~_mm_movemask_epi8(mv) & 0xf &
+                    _mm_movemask_ps(_mm_cmpneq_ps(d, zero));
+                int fly_bits = _mm_movemask_ps(flying) & fg;
+                int iso_bits = _mm_movemask_ps(isolated) & fg & ~fly_bits;
+                stats.input += __builtin_popcount(fg);
+                stats.flying += __builtin_popcount(fly_bits);
+                stats.isolated += __builtin_popcount(iso_bits);
+                for (int j = 0; j < 4; j++) {
+                    if ((fly_bits | iso_bits) & (1 << j)) {
+                        mrow[x + j] = 0;
+                    }
+                }
+            }
+        }
+#endif
+
+        for (; x < w; x++) {
+            if (mrow[x] && row[x]) {
+                stats.input++;
+                int r = test_pixel(depth, w, h, x, y, m_step_scale,
+                                   m_cfg.min_neighbors);
+                stats.flying += r == FLYING;
+                stats.isolated += r == ISOLATED;
+                mrow[x] = r == KEEP ? mrow[x] : 0;
+            }
+        }
+    }
+    return stats;
+}
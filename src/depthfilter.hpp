@@ -0,0 +1,66 @@
+#ifndef PCTRACK_DEPTHFILTER_HPP
+#define PCTRACK_DEPTHFILTER_HPP
+
+/// Parameters for the depth filter.
+struct DepthFilterConfig {
+    /// Largest difference in depth between neighboring pixels on the
+    /// same surface, in millimeters at 1 m.  The threshold grows with
+    /// the square of the depth, as in SegmentConfig.
+    float max_step;
+    /// Pixels with fewer neighbors on the same surface in the 5x5
+    /// window around them, out of 24, are removed.
+    int min_neighbors;
+};
+
+/// Get the default depth filter parameters.
+DepthFilterConfig default_depth_filter_config();
+
+/// Number of pixels removed by each rule of the depth filter.
+struct DepthFilterStats {
+    /// Number of foreground pixels tested.
+    unsigned long input;
+    /// Pixels which differ from both neighbors in some direction, which
+    /// are usually flying pixels between an object and the background.
+    unsigned long flying;
+    /// Pixels with too few neighbors on the same surface.
+    unsigned long isolated;
+
+    DepthFilterStats();
+    DepthFilterStats &operator+=(const DepthFilterStats &other);
+};
+
+/// Print depth filter statistics to stderr.
+void print_depth_filter_stats(const DepthFilterStats &stats);
+
+/// Removes flying pixels and isolated pixels from the foreground of a
+/// depth image.  The tests use only the depth image, so a frame can be
+/// filtered in bands concurrently, after or while it is keyed.
+class DepthFilter {
+private:
+    int m_width, m_height;
+    DepthFilterConfig m_cfg;
+    // Threshold per squared millimeter of depth.
+    float m_step_scale;
+
+    DepthFilterStats filter(const unsigned short *depth,
+                            unsigned char *mask, int begin, int end,
+                            bool simd) const;
+
+public:
+    DepthFilter(int width, int height, const DepthFilterConfig &cfg);
+
+    /// Clear the mask of foreground pixels which fail a test.
+    DepthFilterStats apply(const unsigned short *depth,
+                           unsigned char *mask) const;
+
+    /// Same as apply(), but only for pixels in the range [begin, end).
+    /// The range must start and end on row boundaries.
+    DepthFilterStats apply(const unsigned short *depth, unsigned char *mask,
+                           int begin, int end) const;
+
+    /// Same as apply(), but never uses SIMD instructions.
+    DepthFilterStats apply_scalar(const unsigned short *depth,
+                                  unsigned char *mask) const;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "depthkey.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Marks a pixel with no valid pixel in reach.  This is also the
+// largest depth, so depths equal to it are treated as holes, which is
+// what the brute-force search does.
+const unsigned short NONE = 0xffff;
+
+// Relax the (distance, depth) pair at pixel i against neighbor j.
+// The pair is ordered lexicographically, so among the nearest valid
+// pixels we keep the minimum depth.
+inline void relax(unsigned short *dist, unsigned short *val, int i, int j) {
+    unsigned dj = dist[j];
+    if (dj == NONE) {
+        return;
+    }
+    dj++;
+    if (dj < dist[i]) {
+        dist[i] = dj;
+        val[i] = val[j];
+    } else if (dj == dist[i] && val[j] < val[i]) {
+        val[i] = val[j];
+    }
+}
+
+}
+
+int fill_depth_key(const unsigned short *depth, unsigned short *key,
+                   int width, int height) {
+    const int n = width * height;
+
+    // The brute-force search is equivalent to taking, for each pixel,
+    // the chessboard distance D to the nearest valid pixel and the
+    // minimum depth M over all valid pixels at exactly that distance.
+    // Both are computed with a two-pass chamfer transform, which is
+    // exact for the chessboard metric, and which also finds every
+    // nearest valid pixel since any of them can be reached by a path
+    // which is monotonic within one of the two passes.
+    std::vector<unsigned short> dist(n), val(n);
+    for (int i = 0; i < n; i++) {
+        bool valid = depth[i] != 0 && depth[i] != NONE;
+        dist[i] = valid ? 0 : NONE;
+        val[i] = valid ? depth[i] : NONE;
+    }
+    unsigned short *dp = dist.data(), *vp = val.data();
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            if (!dp[i]) {
+                continue;
+            }
+            if (x > 0) {
+                relax(dp, vp, i, i - 1);
+            }
+            if (y > 0) {
+                int j = i - width;
+                if (x > 0) {
+                    relax(dp, vp, i, j - 1);
+                }
+                relax(dp, vp, i, j);
+                if (x < width - 1) {
+                    relax(dp, vp, i, j + 1);
+                }
+            }
+        }
+    }
+
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = width - 1; x >= 0; x--) {
+            int i = y * width + x;
+            if (!dp[i]) {
+                continue;
+            }
+            if (x < width - 1) {
+                relax(dp, vp, i, i + 1);
+            }
+            if (y < height - 1) {
+                int j = i + width;
+                if (x < width - 1) {
+                    relax(dp, vp, i, j + 1);
+                }
+                relax(dp, vp, i, j);
+                if (x > 0) {
+                    relax(dp, vp, i, j - 1);
+                }
+            }
+        }
+    }
+
+    // The search radius is at least 1, so valid pixels take the
+    // minimum over their 3x3 neighborhood.  This is computed with a
+    // separable min filter, treating holes as infinitely far away.
+    std::vector<unsigned short> row(width);
+    int unfilled = 0;
+    for (int y = 0; y < height; y++) {
+        int y0 = std::max(y - 1, 0);
+        int y1 = std::min(y + 2, height);
+        for (int x = 0; x < width; x++) {
+            unsigned short d = NONE;
+            for (int yy = y0; yy < y1; yy++) {
+                unsigned short dd = depth[yy * width + x];
+                if (dd && dd < d) {
+                    d = dd;
+                }
+            }
+            row[x] = d;
+        }
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            unsigned short d;
+            if (dp[i] == 0) {
+                d = row[x];
+                if (x > 0) {
+                    d = std::min(d, row[x - 1]);
+                }
+                if (x < width - 1) {
+                    d = std::min(d, row[x + 1]);
+                }
+            } else if (dp[i] <= DEPTH_KEY_MAX_RADIUS) {
+                d = vp[i];
+            } else {
+                d = 0;
+                unfilled++;
+            }
+            key[i] = d;
+        }
+    }
+    return unfilled;
+}
+
+int fill_depth_key_slow(const unsigned short *depth, unsigned short *key,
+                        int width, int height) {
+    int unfilled = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned short d = NONE;
+            for (int r = 1; r <= DEPTH_KEY_MAX_RADIUS; r++) {
+                int y0 = std::max(y - r, 0);
+                int y1 = std::min(y + r + 1, height);
+                int x0 = std::max(x - r, 0);
+                int x1 = std::min(x + r + 1, width);
+                for (int yy = y0; yy < y1; yy++) {
+                    for (int xx = x0; xx < x1; xx++) {
+                        unsigned short dd = depth[yy * width + xx];
+                        if (!dd) {
+                            continue;
+                        } else if (dd < d) {
+                            d = dd;
+                        }
+                    }
+                }
+                if (d != NONE) {
+                    break;
+                }
+            }
+            if (d == NONE) {
+                d = 0;
+                unfilled++;
+            }
+            key[y * width + x] = d;
+        }
+    }
+    return unfilled;
+}
@@ -0,0 +1,23 @@
+#ifndef PCTRACK_DEPTHKEY_HPP
+#define PCTRACK_DEPTHKEY_HPP
+
+/// Largest radius searched when filling a hole in the depth key.
+/// Pixels with no valid depth within this radius are left at zero.
+const int DEPTH_KEY_MAX_RADIUS = 63;
+
+/// Create a depth key from a depth image by filling holes.  Each
+/// output pixel is the minimum nonzero depth in the smallest square
+/// window (radius at least 1) around the pixel which contains any
+/// nonzero depth.  Depths of 0xffff are treated as holes, like zero.
+/// This runs in time linear in the number of pixels.
+/// Returns the number of pixels which could not be filled.
+int fill_depth_key(const unsigned short *depth, unsigned short *key,
+                   int width, int height);
+
+/// Same as fill_depth_key(), but uses a brute-force search which
+/// rescans the window at every radius.  This is very slow, and is
+/// only kept as a reference for checking fill_depth_key().
+int fill_depth_key_slow(const unsigned short *depth, unsigned short *key,
+                        int width, int height);
+
+#endif
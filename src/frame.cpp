@@ -0,0 +1,124 @@
+#include "frame.hpp"
+#include "background.hpp"
+#include "defs.hpp"
+
+PointFrame::PointFrame()
+    : index(0), timestamp(0), host_time(0), count(0) {}
+
+//////////////////////////////////////////////////////////////////////
+// Reader
+
+FrameReader::FrameReader() : m_next(0), m_raw(false) {}
+
+FrameReader::~FrameReader() {}
+
+void FrameReader::open(const std::string &path, int key_distance) {
+    close();
+    m_file.open(path);
+    m_header = m_file.header();
+    m_raw = m_file.frame_count() &&
+        m_file.frame_header(0).encoding == FRAME_DEPTH_RGB;
+    if (!m_raw) {
+        return;
+    }
+
+    if (key_distance > 0) {
+        m_header.key_distance = key_distance;
+    }
+    if (!m_header.key_distance) {
+        die("No key distance in file: %s", path.c_str());
+    }
+    int n = m_header.width * m_header.height;
+    m_key.assign(n, 0);
+    if (m_file.has_depth_key()) {
+        m_file.read_depth_key(m_key.data());
+    }
+    m_rays.reset(new RayTable(m_header.width, m_header.height,
+                              file_intrinsics(m_header)));
+    m_depth.resize(n);
+    m_color.resize(n * 3);
+    m_mask.resize(n);
+    reset_background();
+}
+
+void FrameReader::close() {
+    m_file.close();
+    m_next = 0;
+    m_raw = false;
+    m_rays.reset();
+    m_background.reset();
+}
+
+void FrameReader::reset_background() {
+    m_background.reset(new DepthBackground(
+        m_header.width, m_header.height,
+        default_background_config(m_header.key_distance)));
+    m_background->init(m_key.data());
+}
+
+void FrameReader::seek(std::size_t frame) {
+    m_next = frame;
+    if (m_raw) {
+        reset_background();
+    }
+}
+
+void FrameReader::skip(std::size_t frame) {
+    if (frame < m_next) {
+        die("Cannot skip backward to frame %zu.", frame);
+    }
+    m_next = frame;
+}
+
+bool FrameReader::next(PointFrame &frame) {
+    FrameHeader fh;
+    if (m_raw) {
+        if (!next_depth(&fh)) {
+            return false;
+        }
+        frame.reserve(m_depth.size());
+        frame.count = convert_points(
+            *m_rays, m_depth.data(), m_color.data(), m_mask.data(),
+            frame.points());
+    } else {
+        if (m_next >= m_file.frame_count()) {
+            return false;
+        }
+        fh = m_file.frame_header(m_next);
+        frame.reserve(fh.count);
+        frame.count = m_file.read_frame(m_next, frame.points(),
+                                        frame.buffer.size(), &fh);
+        m_next++;
+    }
+    frame.index = m_next - 1;
+    frame.timestamp = fh.timestamp;
+    frame.host_time = fh.host_time;
+    return true;
+}
+
+bool FrameReader::next_depth(FrameHeader *fhdr) {
+    if (!m_raw) {
+        die("Not a raw capture.");
+    }
+    if (m_next >= m_file.frame_count()) {
+        return false;
+    }
+    m_file.read_depth_frame(m_next, m_depth.data(), m_color.data(), fhdr);
+    m_background->apply(m_depth.data(), m_mask.data());
+    m_next++;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Writer
+
+void FrameWriter::open(const std::string &path,
+                       const PointFileHeader &header, uint32_t encoding) {
+    m_file.open(path, header);
+    m_file.set_encoding(encoding);
+}
+
+void FrameWriter::write(const PointFrame &frame) {
+    m_file.write_frame(frame.points(), frame.count, frame.timestamp,
+                       frame.host_time);
+}
@@ -0,0 +1,146 @@
+#ifndef PCTRACK_FRAME_HPP
+#define PCTRACK_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pcfile.hpp"
+#include "point.hpp"
+
+class DepthBackground;
+
+// Streaming access to captures, for tools which process every frame
+// in order.  A PointFrame is filled in place, so reading a capture
+// does not allocate once the frame's buffer is large enough.
+
+/// A frame of points from a capture.
+struct PointFrame {
+    /// Position of the frame in its file.
+    std::size_t index;
+    /// Device timestamp, in ticks of the file's timestamp clock.
+    uint64_t timestamp;
+    /// Time the frame arrived at the host, in microseconds since the
+    /// start of the capture.
+    uint64_t host_time;
+    /// Number of points in the frame.
+    std::size_t count;
+    /// Buffer for the points, with room for at least count points.
+    /// The buffer only grows, so it is not cleared between frames.
+    std::vector<Point> buffer;
+
+    PointFrame();
+
+    Point *points() { return buffer.data(); }
+    const Point *points() const { return buffer.data(); }
+
+    /// Make room for at least the given number of points.
+    void reserve(std::size_t capacity) {
+        if (buffer.size() < capacity) {
+            buffer.resize(capacity);
+        }
+    }
+};
+
+/// Reads the frames of a capture in order.  Raw depth frames are keyed
+/// with the adaptive background model, seeded from the depth key in the
+/// file, and converted to points.  Errors are fatal.
+class FrameReader {
+private:
+    PointFileReader m_file;
+    PointFileHeader m_header;
+    std::size_t m_next;
+    bool m_raw;
+    std::unique_ptr<RayTable> m_rays;
+    std::unique_ptr<DepthBackground> m_background;
+    std::vector<unsigned short> m_key, m_depth;
+    std::vector<unsigned char> m_color, m_mask;
+
+    void reset_background();
+
+public:
+    FrameReader();
+    FrameReader(const FrameReader &) = delete;
+    ~FrameReader();
+    FrameReader &operator=(const FrameReader &) = delete;
+
+    /// Open a file.  If the file has raw depth frames, they are keyed
+    /// at the given distance in millimeters, or at the distance in the
+    /// file if it is zero.
+    void open(const std::string &path, int key_distance = 0);
+    void close();
+
+    /// Get the file header.  For raw captures, the key distance is the
+    /// one used for keying.
+    const PointFileHeader &header() const { return m_header; }
+
+    /// Test whether the file has raw depth frames.
+    bool is_raw() const { return m_raw; }
+
+    std::size_t frame_count() const { return m_file.frame_count(); }
+
+    /// Get the index of the next frame to be read.
+    std::size_t position() const { return m_next; }
+
+    /// Move to a frame.  For raw captures, the background model starts
+    /// again from the depth key.
+    void seek(std::size_t frame);
+
+    /// Move forward to a frame, skipping the frames in between.  For
+    /// raw captures, the background model carries on as if the skipped
+    /// frames were not in the file.
+    void skip(std::size_t frame);
+
+    /// Read the next frame into a frame, reusing its buffer.  Returns
+    /// false if there are no more frames.
+    bool next(PointFrame &frame);
+
+    /// Read and key the next frame of a raw capture, without converting
+    /// it to points.  Returns false if there are no more frames.
+    bool next_depth(FrameHeader *fhdr = nullptr);
+
+    /// For raw captures, get the depth image, RGB image and foreground
+    /// mask of the last frame read.  Each has one value per pixel.
+    const unsigned short *depth() const { return m_depth.data(); }
+    const unsigned char *color() const { return m_color.data(); }
+    const unsigned char *mask() const { return m_mask.data(); }
+
+    /// Get the underlying file, for random access.
+    PointFileReader &file() { return m_file; }
+};
+
+/// Writes frames to a capture.  Errors are fatal.
+class FrameWriter {
+private:
+    PointFileWriter m_file;
+
+public:
+    FrameWriter() {}
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    /// Create a file with the given header and frame encoding.
+    void open(const std::string &path, const PointFileHeader &header,
+              uint32_t encoding = FRAME_RAW);
+
+    /// Write a frame.  Its index is ignored.
+    void write(const PointFrame &frame);
+
+    /// Write the depth key, which has one value per pixel.
+    void write_depth_key(const unsigned short *key) {
+        m_file.write_depth_key(key);
+    }
+
+    /// Write the index and close the file.
+    void close() { m_file.close(); }
+
+    std::size_t frame_count() const { return m_file.frame_count(); }
+    uint64_t size() const { return m_file.size(); }
+
+    /// Get the underlying file.
+    PointFileWriter &file() { return m_file; }
+};
+
+#endif
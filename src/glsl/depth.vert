@@ -0,0 +1,29 @@
+#version 330 core
+
+out vec3 v_color;
+
+uniform mat4 MVP;
+uniform usampler2D Depth;
+uniform usampler2D Mask;
+uniform sampler2D Color;
+// Sensor intrinsics: fx, fy, cx, cy.
+uniform vec4 Intrinsics;
+
+// Each vertex is one pixel of the depth image.  The mask comes from
+// the background model on the CPU, so pixels are keyed the same way
+// as in the other tools.
+void main() {
+    ivec2 size = textureSize(Depth, 0);
+    ivec2 pix = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+    int d = int(texelFetch(Depth, pix, 0).r);
+    uint m = texelFetch(Mask, pix, 0).r;
+    v_color = texelFetch(Color, pix, 0).rgb;
+    if (d == 0 || m == 0u) {
+        // Outside the clip volume, so the point is not drawn.
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+    float z = 0.001 * float(d);
+    vec2 xy = (Intrinsics.zw - vec2(pix)) / Intrinsics.xy * z;
+    gl_Position = MVP * vec4(xy, z, 1.0);
+}
@@ -0,0 +1,673 @@
+#include "octree.hpp"
+#include "defs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace {
+
+// Stride for touching pages of the mapped file.
+const uint64_t TOUCH_STRIDE = 4096;
+
+// Points read at once when streaming a temporary file.
+const std::size_t STREAM_CHUNK = 65536;
+
+// Split a range of points at a value on one axis.
+Point *split(Point *begin, Point *end, int axis, float value) {
+    return std::partition(begin, end, [axis, value](const Point &p) {
+        return p.v[axis] < value;
+    });
+}
+
+// Get the header for a tree over a number of points, without the
+// nodes, cube or frame count.
+OctreeHeader empty_header(uint64_t count) {
+    OctreeHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, OCTREE_MAGIC, sizeof(h.magic));
+    h.version = OCTREE_VERSION;
+    h.header_size = sizeof(h);
+    h.point_count = count;
+    return h;
+}
+
+// Get the edge length of the root cube for points within bounds.  The
+// cube is grown a little, so that no point is on its upper faces.
+float bounding_cube(const float *lo, const float *hi) {
+    float size = std::max(hi[0] - lo[0],
+                          std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    return size * 1.0001f + 1e-4f;
+}
+
+// Start sampling a new node.  Cells of the sampling grid hold the
+// stamp of the node which last used them, so that the grid is only
+// cleared when the stamp wraps.
+uint32_t next_stamp(std::vector<uint32_t> &cells, uint32_t stamp) {
+    if (++stamp == 0) {
+        std::fill(cells.begin(), cells.end(), 0);
+        stamp = 1;
+    }
+    return stamp;
+}
+
+// Mark the cell of the sampling grid which holds a point.  Returns
+// true if the point is the node's first in that cell.
+bool take_sample(std::vector<uint32_t> &cells, uint32_t stamp, int g,
+                 const float *min, float scale, const Point &p) {
+    int c[3];
+    for (int k = 0; k < 3; k++) {
+        c[k] = static_cast<int>((p.v[k] - min[k]) * scale);
+        c[k] = std::min(std::max(c[k], 0), g - 1);
+    }
+    uint32_t &cell = cells[(static_cast<std::size_t>(c[2]) * g +
+                            c[1]) * g + c[0]];
+    if (cell == stamp) {
+        return false;
+    }
+    cell = stamp;
+    return true;
+}
+
+void read_temp(std::FILE *fp, Point *points, std::size_t count) {
+    if (std::fread(points, sizeof(Point), count, fp) != count) {
+        die("Could not read temporary file.");
+    }
+}
+
+void write_temp(std::FILE *fp, const Point *points, std::size_t count) {
+    if (std::fwrite(points, sizeof(Point), count, fp) != count) {
+        die("Could not write temporary file.");
+    }
+}
+
+}
+
+OctreeConfig default_octree_config() {
+    OctreeConfig cfg;
+    cfg.leaf_size = 50000;
+    cfg.sample_grid = 128;
+    cfg.max_depth = 16;
+    return cfg;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Builder
+
+OctreeBuilder::OctreeBuilder(const OctreeConfig &cfg)
+    : m_cfg(cfg),
+      m_cells(static_cast<std::size_t>(cfg.sample_grid) * cfg.sample_grid *
+              cfg.sample_grid, 0),
+      m_stamp(0) {}
+
+OctreeHeader OctreeBuilder::build(Point *points, std::size_t count) {
+    OctreeHeader h = empty_header(count);
+    m_nodes.clear();
+    if (!count) {
+        return h;
+    }
+
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = hi[k] = points[0].v[k];
+    }
+    for (std::size_t i = 1; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], points[i].v[k]);
+            hi[k] = std::max(hi[k], points[i].v[k]);
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        h.min[k] = lo[k];
+    }
+    h.size = bounding_cube(lo, hi);
+    build_node(points, 0, count, h.min, h.size, 0);
+    h.node_count = m_nodes.size();
+    return h;
+}
+
+void OctreeBuilder::build_subtree(Point *points, std::size_t count,
+                                  const float *min, float size,
+                                  uint32_t level) {
+    m_nodes.clear();
+    if (count) {
+        build_node(points, 0, count, min, size, level);
+    }
+}
+
+uint32_t OctreeBuilder::build_node(Point *points, uint64_t begin,
+                                   uint64_t end, const float *min,
+                                   float size, uint32_t level) {
+    uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    OctreeNode node;
+    std::memset(&node, 0, sizeof(node));
+    for (int k = 0; k < 3; k++) {
+        node.min[k] = min[k];
+    }
+    node.size = size;
+    node.first = begin;
+    node.count = static_cast<uint32_t>(end - begin);
+    node.level = level;
+    m_nodes.push_back(node);
+    if (end - begin <= m_cfg.leaf_size ||
+        static_cast<int>(level) >= m_cfg.max_depth) {
+        return index;
+    }
+
+    // Move the first point in each cell of the sampling grid to the
+    // front of the range.  These are the node's points.
+    m_stamp = next_stamp(m_cells, m_stamp);
+    int g = m_cfg.sample_grid;
+    float scale = g / size;
+    uint64_t mid = begin;
+    for (uint64_t i = begin; i < end; i++) {
+        if (take_sample(m_cells, m_stamp, g, min, scale, points[i])) {
+            std::swap(points[i], points[mid]);
+            mid++;
+        }
+    }
+    m_nodes[index].count = static_cast<uint32_t>(mid - begin);
+    if (mid == end) {
+        return index;
+    }
+
+    // Sort the rest into octants, and build the children.
+    float half = size * 0.5f;
+    float center[3] = { min[0] + half, min[1] + half, min[2] + half };
+    Point *r[9];
+    r[0] = points + mid;
+    r[8] = points + end;
+    r[4] = split(r[0], r[8], 2, center[2]);
+    r[2] = split(r[0], r[4], 1, center[1]);
+    r[6] = split(r[4], r[8], 1, center[1]);
+    for (int i = 1; i < 8; i += 2) {
+        r[i] = split(r[i - 1], r[i + 1], 0, center[0]);
+    }
+    for (int octant = 0; octant < 8; octant++) {
+        if (r[octant] == r[octant + 1]) {
+            continue;
+        }
+        float child_min[3];
+        for (int k = 0; k < 3; k++) {
+            child_min[k] = min[k] + ((octant >> k) & 1 ? half : 0.0f);
+        }
+        uint32_t child = build_node(
+            points, r[octant] - points, r[octant + 1] - points, child_min,
+            half, level + 1);
+        m_nodes[index].child[octant] = child;
+    }
+    return index;
+}
+
+void write_octree(const std::string &path, OctreeHeader header,
+                  const Point *points, const std::vector<OctreeNode> &nodes,
+                  uint64_t frame_count) {
+    std::FILE *fp = std::fopen(path.c_str(), "wb");
+    if (!fp) {
+        die("Could not open file: %s", path.c_str());
+    }
+    header.node_count = nodes.size();
+    header.node_offset = sizeof(header) + header.point_count * sizeof(Point);
+    header.frame_count = frame_count;
+    if (std::fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        std::fwrite(points, sizeof(Point), header.point_count, fp) !=
+        header.point_count ||
+        std::fwrite(nodes.data(), sizeof(OctreeNode), nodes.size(), fp) !=
+        nodes.size()) {
+        die("Could not write file: %s", path.c_str());
+    }
+    if (std::fclose(fp)) {
+        die("Could not write file: %s", path.c_str());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// File builder
+
+OctreeFileBuilder::OctreeFileBuilder(const OctreeConfig &cfg,
+                                     std::size_t memory_points,
+                                     const std::string &temp_dir)
+    : m_cfg(cfg), m_builder(cfg),
+      m_memory_points(std::max<std::size_t>(memory_points, cfg.leaf_size)),
+      m_temp_dir(temp_dir), m_spill(nullptr), m_count(0), m_out(nullptr),
+      m_written(0),
+      m_cells(static_cast<std::size_t>(cfg.sample_grid) * cfg.sample_grid *
+              cfg.sample_grid, 0),
+      m_stamp(0) {
+    for (int k = 0; k < 3; k++) {
+        m_lo[k] = m_hi[k] = 0.0f;
+    }
+}
+
+OctreeFileBuilder::~OctreeFileBuilder() {
+    if (m_spill) {
+        std::fclose(m_spill);
+    }
+    if (m_out) {
+        std::fclose(m_out);
+    }
+}
+
+std::FILE *OctreeFileBuilder::temp_file() {
+    // The file is unlinked at once, so it goes away when closed, even
+    // if the program dies.
+    std::string name = m_temp_dir + "/pcoctree.XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        die("Could not create temporary file in: %s", m_temp_dir.c_str());
+    }
+    unlink(path.data());
+    std::FILE *fp = fdopen(fd, "w+b");
+    if (!fp) {
+        die("Could not create temporary file in: %s", m_temp_dir.c_str());
+    }
+    return fp;
+}
+
+void OctreeFileBuilder::add(const Point *points, std::size_t count) {
+    for (std::size_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            if (!m_count && !i) {
+                m_lo[k] = m_hi[k] = points[i].v[k];
+            }
+            m_lo[k] = std::min(m_lo[k], points[i].v[k]);
+            m_hi[k] = std::max(m_hi[k], points[i].v[k]);
+        }
+    }
+    m_count += count;
+    m_points.insert(m_points.end(), points, points + count);
+    if (m_points.size() > m_memory_points) {
+        if (!m_spill) {
+            m_spill = temp_file();
+        }
+        write_temp(m_spill, m_points.data(), m_points.size());
+        m_points.clear();
+    }
+}
+
+void OctreeFileBuilder::write(const std::string &path,
+                              uint64_t frame_count) {
+    m_out = std::fopen(path.c_str(), "wb");
+    if (!m_out) {
+        die("Could not open file: %s", path.c_str());
+    }
+    m_path = path;
+    m_written = 0;
+    m_nodes.clear();
+
+    // The header is written again once the nodes are known.
+    OctreeHeader h = empty_header(m_count);
+    if (std::fwrite(&h, sizeof(h), 1, m_out) != 1) {
+        die("Could not write file: %s", path.c_str());
+    }
+    if (m_count) {
+        for (int k = 0; k < 3; k++) {
+            h.min[k] = m_lo[k];
+        }
+        h.size = bounding_cube(m_lo, m_hi);
+        if (m_spill) {
+            write_temp(m_spill, m_points.data(), m_points.size());
+            m_points.clear();
+            std::FILE *spill = m_spill;
+            m_spill = nullptr;
+            build_bucket(spill, m_count, h.min, h.size, 0);
+        } else {
+            build_memory(m_points.data(), m_points.size(), h.min, h.size,
+                         0);
+        }
+    }
+    h.node_count = m_nodes.size();
+    h.node_offset = sizeof(h) + h.point_count * sizeof(Point);
+    h.frame_count = frame_count;
+    if (std::fwrite(m_nodes.data(), sizeof(OctreeNode), m_nodes.size(),
+                    m_out) != m_nodes.size() ||
+        std::fseek(m_out, 0, SEEK_SET) ||
+        std::fwrite(&h, sizeof(h), 1, m_out) != 1) {
+        die("Could not write file: %s", path.c_str());
+    }
+    int err = std::fclose(m_out);
+    m_out = nullptr;
+    if (err) {
+        die("Could not write file: %s", path.c_str());
+    }
+}
+
+void OctreeFileBuilder::write_points(const Point *points,
+                                     std::size_t count) {
+    if (std::fwrite(points, sizeof(Point), count, m_out) != count) {
+        die("Could not write file: %s", m_path.c_str());
+    }
+    m_written += count;
+}
+
+// Build the subtree over points in memory, after the nodes and points
+// written so far.
+uint32_t OctreeFileBuilder::build_memory(Point *points, std::size_t count,
+                                         const float *min, float size,
+                                         uint32_t level) {
+    m_builder.build_subtree(points, count, min, size, level);
+    uint32_t base = static_cast<uint32_t>(m_nodes.size());
+    for (OctreeNode n : m_builder.nodes()) {
+        n.first += m_written;
+        for (uint32_t &c : n.child) {
+            if (c != OCTREE_NO_CHILD) {
+                c += base;
+            }
+        }
+        m_nodes.push_back(n);
+    }
+    write_points(points, count);
+    return base;
+}
+
+// Build the subtree over the points in a temporary file, and close
+// the file as soon as its points are read, so that the temporary files
+// never hold more than every point once.  This takes the same sample
+// as OctreeBuilder, since the points are read in the order they were
+// added.
+uint32_t OctreeFileBuilder::build_bucket(std::FILE *fp, uint64_t count,
+                                         const float *min, float size,
+                                         uint32_t level) {
+    std::rewind(fp);
+    if (count <= m_memory_points) {
+        m_points.resize(count);
+        read_temp(fp, m_points.data(), count);
+        std::fclose(fp);
+        return build_memory(m_points.data(), count, min, size, level);
+    }
+
+    uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    OctreeNode node;
+    std::memset(&node, 0, sizeof(node));
+    for (int k = 0; k < 3; k++) {
+        node.min[k] = min[k];
+    }
+    node.size = size;
+    node.first = m_written;
+    node.level = level;
+    m_nodes.push_back(node);
+
+    // Stream the points once.  The node keeps the first point in each
+    // cell of the sampling grid, or every point at the maximum depth,
+    // and the rest go to a file for each octant.
+    bool leaf = static_cast<int>(level) >= m_cfg.max_depth;
+    m_stamp = next_stamp(m_cells, m_stamp);
+    int g = m_cfg.sample_grid;
+    float scale = g / size;
+    float half = size * 0.5f;
+    float center[3] = { min[0] + half, min[1] + half, min[2] + half };
+    std::FILE *child[8] = {};
+    uint64_t child_count[8] = {};
+    uint64_t first = m_written;
+    m_chunk.resize(STREAM_CHUNK);
+    for (uint64_t done = 0; done < count;) {
+        std::size_t n = static_cast<std::size_t>(
+            std::min<uint64_t>(STREAM_CHUNK, count - done));
+        read_temp(fp, m_chunk.data(), n);
+        for (std::size_t i = 0; i < n; i++) {
+            const Point &p = m_chunk[i];
+            if (leaf || take_sample(m_cells, m_stamp, g, min, scale, p)) {
+                write_points(&p, 1);
+                continue;
+            }
+            int octant = 0;
+            for (int k = 0; k < 3; k++) {
+                if (!(p.v[k] < center[k])) {
+                    octant |= 1 << k;
+                }
+            }
+            if (!child[octant]) {
+                child[octant] = temp_file();
+            }
+            write_temp(child[octant], &p, 1);
+            child_count[octant]++;
+        }
+        done += n;
+    }
+    std::fclose(fp);
+    m_nodes[index].count = static_cast<uint32_t>(m_written - first);
+
+    for (int octant = 0; octant < 8; octant++) {
+        if (!child[octant]) {
+            continue;
+        }
+        float child_min[3];
+        for (int k = 0; k < 3; k++) {
+            child_min[k] = min[k] + ((octant >> k) & 1 ? half : 0.0f);
+        }
+        uint32_t c = build_bucket(child[octant], child_count[octant],
+                                  child_min, half, level + 1);
+        m_nodes[index].child[octant] = c;
+    }
+    return index;
+}
+
+bool is_octree_file(const std::string &path) {
+    std::FILE *fp = std::fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    char magic[8];
+    bool match = std::fread(magic, sizeof(magic), 1, fp) == 1 &&
+        !std::memcmp(magic, OCTREE_MAGIC, sizeof(magic));
+    std::fclose(fp);
+    return match;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Reader
+
+OctreeReader::OctreeReader() : m_data(nullptr), m_size(0) {}
+
+OctreeReader::~OctreeReader() {
+    close();
+}
+
+void OctreeReader::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        die("Could not open file: %s", path.c_str());
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        die("Could not read file: %s", path.c_str());
+    }
+    m_size = st.st_size;
+    if (m_size < sizeof(m_header)) {
+        die("Not an octree file: %s", path.c_str());
+    }
+    void *p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        die("Could not map file: %s", path.c_str());
+    }
+    m_data = static_cast<const unsigned char *>(p);
+    ::close(fd);
+    m_path = path;
+
+    std::memcpy(&m_header, m_data, sizeof(m_header));
+    if (std::memcmp(m_header.magic, OCTREE_MAGIC, sizeof(OCTREE_MAGIC))) {
+        die("Not an octree file: %s", path.c_str());
+    }
+    if (m_header.version != OCTREE_VERSION ||
+        m_header.header_size != sizeof(m_header)) {
+        die("Unsupported octree version %u: %s",
+            m_header.version, path.c_str());
+    }
+    uint64_t points_end =
+        sizeof(m_header) + m_header.point_count * sizeof(Point);
+    if (m_header.node_offset < points_end ||
+        m_header.node_offset > m_size ||
+        (m_size - m_header.node_offset) / sizeof(OctreeNode) <
+        m_header.node_count) {
+        die("Corrupt octree: %s", path.c_str());
+    }
+    m_nodes.resize(m_header.node_count);
+    std::memcpy(m_nodes.data(), m_data + m_header.node_offset,
+                m_nodes.size() * sizeof(OctreeNode));
+    // Children always come after their parents, so a child which does
+    // not point forward would make a cycle.
+    for (std::size_t i = 0; i < m_nodes.size(); i++) {
+        const OctreeNode &n = m_nodes[i];
+        bool bad = n.first > m_header.point_count ||
+            n.count > m_header.point_count - n.first;
+        for (uint32_t c : n.child) {
+            bad |= c >= m_nodes.size() ||
+                (c != OCTREE_NO_CHILD && c <= i);
+        }
+        if (bad) {
+            die("Corrupt octree: %s", path.c_str());
+        }
+    }
+}
+
+void OctreeReader::close() {
+    if (m_data) {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+        m_data = nullptr;
+    }
+    m_size = 0;
+    m_nodes.clear();
+}
+
+const Point *OctreeReader::points(uint32_t node) const {
+    return reinterpret_cast<const Point *>(m_data + sizeof(m_header)) +
+        m_nodes[node].first;
+}
+
+void OctreeReader::prefetch(uint32_t node) const {
+    const OctreeNode &n = m_nodes[node];
+    if (!n.count) {
+        return;
+    }
+    const unsigned char *begin =
+        reinterpret_cast<const unsigned char *>(points(node));
+    uint64_t size = n.count * sizeof(Point);
+    // Touch every page, so that the node is read in by this thread and
+    // not by whoever uploads it.
+    volatile const unsigned char *p = begin;
+    unsigned sum = 0;
+    for (uint64_t i = 0; i < size; i += TOUCH_STRIDE) {
+        sum += p[i];
+    }
+    sum += p[size - 1];
+    (void) sum;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Selection
+
+void select_octree_nodes(const std::vector<OctreeNode> &nodes,
+                         const float *mvp, const float *eye,
+                         uint64_t point_budget,
+                         std::vector<uint32_t> &out) {
+    out.clear();
+    if (nodes.empty()) {
+        return;
+    }
+
+    // Frustum planes, from the rows of the matrix.  A point is inside
+    // if it is on the positive side of every plane.
+    float planes[6][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            float w = mvp[j * 4 + 3], v = mvp[j * 4 + i];
+            planes[i * 2][j] = w + v;
+            planes[i * 2 + 1][j] = w - v;
+        }
+    }
+    auto visible = [&planes](const OctreeNode &n) {
+        for (const float *p : planes) {
+            // Test the corner furthest along the plane's normal.
+            float d = p[3];
+            for (int k = 0; k < 3; k++) {
+                d += p[k] * (n.min[k] + (p[k] > 0.0f ? n.size : 0.0f));
+            }
+            if (d < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    };
+    // Nodes are taken largest on screen first.  The size on screen is
+    // taken as the edge length over the distance to the center, and
+    // nodes around the eye are always first.
+    auto weight = [eye](const OctreeNode &n) {
+        float d2 = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            float d = n.min[k] + n.size * 0.5f - eye[k];
+            d2 += d * d;
+        }
+        float d = std::sqrt(d2);
+        return d <= n.size ? HUGE_VALF : n.size / d;
+    };
+
+    typedef std::pair<float, uint32_t> Entry;
+    std::priority_queue<Entry> queue;
+    if (visible(nodes[0])) {
+        queue.push(Entry(weight(nodes[0]), 0));
+    }
+    uint64_t total = 0;
+    while (!queue.empty()) {
+        uint32_t i = queue.top().second;
+        queue.pop();
+        const OctreeNode &n = nodes[i];
+        if (total + n.count > point_budget) {
+            // Smaller nodes may still fit, but never this one's
+            // children, which would leave holes.
+            continue;
+        }
+        total += n.count;
+        out.push_back(i);
+        for (uint32_t c : n.child) {
+            if (c != OCTREE_NO_CHILD && visible(nodes[c])) {
+                queue.push(Entry(weight(nodes[c]), c));
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loader
+
+OctreeLoader::OctreeLoader(const OctreeReader &reader,
+                           std::size_t queue_size)
+    : m_reader(reader), m_requests(queue_size), m_ready(queue_size),
+      m_stop(false) {
+    m_thread = std::thread(&OctreeLoader::run, this);
+}
+
+OctreeLoader::~OctreeLoader() {
+    m_stop.store(true);
+    m_thread.join();
+}
+
+void OctreeLoader::run() {
+    while (!m_stop.load()) {
+        uint32_t node;
+        if (!m_requests.pop(node)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        m_reader.prefetch(node);
+        while (!m_ready.push(node)) {
+            if (m_stop.load()) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
@@ -0,0 +1,244 @@
+#ifndef PCTRACK_OCTREE_HPP
+#define PCTRACK_OCTREE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "point.hpp"
+#include "ring.hpp"
+
+// Level of detail octree file, for viewing many frames of a capture
+// together.  All values are little-endian.
+//
+// The file starts with an OctreeHeader, followed by the points and
+// then the nodes.  Each node holds a subsample of the points in its
+// cube which is roughly uniform at the node's scale, and its children
+// hold the rest.  Drawing a node and all of its ancestors shows every
+// point in the node's cube at the node's level of detail.  The points
+// of each node are contiguous, so a node is read with one copy.
+//
+// Nodes are stored depth-first, so the root is node 0.
+
+/// Magic number at the start of an octree file.
+const char OCTREE_MAGIC[8] = {'P', 'C', 'O', 'C', 'T', 'R', 'E', 'E'};
+
+const uint32_t OCTREE_VERSION = 1;
+
+/// Child index for a missing child.
+const uint32_t OCTREE_NO_CHILD = 0;
+
+struct OctreeHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t node_count;
+    uint64_t point_count;
+    /// Offset of the nodes.  The points start after the header.
+    uint64_t node_offset;
+    /// Number of frames accumulated into the tree.
+    uint64_t frame_count;
+    /// Cube containing all points, in meters.
+    float min[3];
+    float size;
+};
+
+struct OctreeNode {
+    /// Corner and edge length of the node's cube, in meters.
+    float min[3];
+    float size;
+    /// Index of the node's first point.
+    uint64_t first;
+    /// Number of points in the node.
+    uint32_t count;
+    /// Depth of the node, where the root is zero.
+    uint32_t level;
+    /// Children, by octant, or OCTREE_NO_CHILD.  Octant bit 0 is set
+    /// for the upper half in x, bit 1 in y, and bit 2 in z.
+    uint32_t child[8];
+};
+
+static_assert(sizeof(OctreeHeader) == 64, "bad octree header size");
+static_assert(sizeof(OctreeNode) == 64, "bad octree node size");
+
+/// Parameters for building an octree.
+struct OctreeConfig {
+    /// Nodes with at most this many points are leaves.
+    uint32_t leaf_size;
+    /// Each interior node keeps one point per cell of a grid with this
+    /// many cells along each edge.
+    int sample_grid;
+    /// Nodes at this depth are leaves, however many points they have.
+    int max_depth;
+};
+
+/// Get the default octree parameters.
+OctreeConfig default_octree_config();
+
+/// Builds an octree from points in memory.  The points are reordered
+/// in place, so that each node's points are contiguous.
+class OctreeBuilder {
+private:
+    OctreeConfig m_cfg;
+    std::vector<OctreeNode> m_nodes;
+    // Grid for sampling, with the stamp of the node which last used
+    // each cell, so that it is never cleared.
+    std::vector<uint32_t> m_cells;
+    uint32_t m_stamp;
+
+    uint32_t build_node(Point *points, uint64_t begin, uint64_t end,
+                        const float *min, float size, uint32_t level);
+
+public:
+    explicit OctreeBuilder(const OctreeConfig &cfg);
+
+    /// Build the tree over a set of points, replacing any earlier
+    /// tree.  Returns the header, without the node offset.
+    OctreeHeader build(Point *points, std::size_t count);
+
+    /// Build a subtree over a set of points in a given cube, whose
+    /// root is at the given depth, replacing any earlier tree.  Point
+    /// and node indexes are relative to the subtree.
+    void build_subtree(Point *points, std::size_t count, const float *min,
+                       float size, uint32_t level);
+
+    const std::vector<OctreeNode> &nodes() const { return m_nodes; }
+};
+
+/// Write an octree file.  Errors are fatal.
+void write_octree(const std::string &path, OctreeHeader header,
+                  const Point *points, const std::vector<OctreeNode> &nodes,
+                  uint64_t frame_count);
+
+/// Builds an octree file from more points than fit in memory.  Points
+/// are kept in memory until there are too many, and then spilled to a
+/// temporary file.  A node with too many points is built by streaming
+/// its points once, keeping its sample and writing the rest to a
+/// temporary file for each octant, and each octant is then built in
+/// turn.  Octants which fit in memory are built with OctreeBuilder.
+/// The result is the same as with OctreeBuilder if every point fits.
+/// Temporary files are removed when closed.  Errors are fatal.
+class OctreeFileBuilder {
+private:
+    OctreeConfig m_cfg;
+    OctreeBuilder m_builder;
+    std::size_t m_memory_points;
+    std::string m_temp_dir;
+    std::vector<Point> m_points, m_chunk;
+    std::FILE *m_spill;
+    uint64_t m_count;
+    float m_lo[3], m_hi[3];
+    std::FILE *m_out;
+    std::string m_path;
+    uint64_t m_written;
+    std::vector<OctreeNode> m_nodes;
+    std::vector<uint32_t> m_cells;
+    uint32_t m_stamp;
+
+    std::FILE *temp_file();
+    void write_points(const Point *points, std::size_t count);
+    uint32_t build_memory(Point *points, std::size_t count,
+                          const float *min, float size, uint32_t level);
+    uint32_t build_bucket(std::FILE *fp, uint64_t count, const float *min,
+                          float size, uint32_t level);
+
+public:
+    /// Create a builder which holds at most the given number of points
+    /// in memory, and makes its temporary files in the given
+    /// directory.
+    OctreeFileBuilder(const OctreeConfig &cfg, std::size_t memory_points,
+                      const std::string &temp_dir);
+    OctreeFileBuilder(const OctreeFileBuilder &) = delete;
+    ~OctreeFileBuilder();
+    OctreeFileBuilder &operator=(const OctreeFileBuilder &) = delete;
+
+    /// Add points to the tree.
+    void add(const Point *points, std::size_t count);
+
+    /// Build the tree over every point added and write it to a file.
+    void write(const std::string &path, uint64_t frame_count);
+
+    uint64_t point_count() const { return m_count; }
+    const std::vector<OctreeNode> &nodes() const { return m_nodes; }
+};
+
+/// Test whether a file is an octree file.
+bool is_octree_file(const std::string &path);
+
+/// Reader for octree files.  The file is memory-mapped, so nodes are
+/// only read from disk when their points are used.  Errors are fatal.
+class OctreeReader {
+private:
+    const unsigned char *m_data;
+    uint64_t m_size;
+    std::string m_path;
+    OctreeHeader m_header;
+    std::vector<OctreeNode> m_nodes;
+
+public:
+    OctreeReader();
+    OctreeReader(const OctreeReader &) = delete;
+    ~OctreeReader();
+    OctreeReader &operator=(const OctreeReader &) = delete;
+
+    void open(const std::string &path);
+    void close();
+
+    const OctreeHeader &header() const { return m_header; }
+    const std::vector<OctreeNode> &nodes() const { return m_nodes; }
+
+    /// Get the points of a node.  The pages may not be in memory yet.
+    const Point *points(uint32_t node) const;
+
+    /// Touch the pages of a node so they are read from disk.  This may
+    /// be called from another thread.
+    void prefetch(uint32_t node) const;
+};
+
+/// Choose the nodes to draw from a camera.  Nodes outside the view
+/// frustum are skipped, and the rest are taken in order of their size
+/// on screen, parents before children.  Nodes which would go over the
+/// point budget are skipped along with their subtrees.  The matrix is
+/// a column-major model-view-projection matrix, and the eye is the
+/// camera position.  The output is replaced, and is in order of
+/// priority.
+void select_octree_nodes(const std::vector<OctreeNode> &nodes,
+                         const float *mvp, const float *eye,
+                         uint64_t point_budget,
+                         std::vector<uint32_t> &out);
+
+/// Reads nodes on a background thread, by touching their pages, so
+/// that drawing never waits for the disk.
+class OctreeLoader {
+private:
+    const OctreeReader &m_reader;
+    SpscRing<uint32_t> m_requests;
+    SpscRing<uint32_t> m_ready;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+
+    void run();
+
+public:
+    /// Create a loader which has at most the given number of requests
+    /// in flight.
+    OctreeLoader(const OctreeReader &reader, std::size_t queue_size);
+    OctreeLoader(const OctreeLoader &) = delete;
+    ~OctreeLoader();
+    OctreeLoader &operator=(const OctreeLoader &) = delete;
+
+    /// Ask for a node to be read.  Returns false if too many requests
+    /// are in flight.
+    bool request(uint32_t node) { return m_requests.push(node); }
+
+    /// Get a node which has been read.  Returns false if none are
+    /// ready.
+    bool ready(uint32_t &node) { return m_ready.pop(node); }
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "activity.hpp"
+#include "defs.hpp"
+#include "frame.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Default sample rate of the signal, the Kinect's frame rate.
+const double DEFAULT_RATE = 30.0;
+
+}
+
+int main(int argc, char *argv[]) {
+    int key_distance = 0;
+    double rate = DEFAULT_RATE;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--key-distance" && i + 1 < argc) {
+            key_distance = std::stoi(argv[++i]);
+            if (key_distance <= 0 || key_distance > 1000) {
+                die("Key distance must be positive and no more than 1000.");
+            }
+        } else if (arg == "--rate" && i + 1 < argc) {
+            rate = std::stod(argv[++i]);
+            if (!(rate > 0.0)) {
+                die("Rate must be positive.");
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        die("Usage: pcactivity [--key-distance MM] [--rate HZ] IN OUT");
+    }
+
+    FrameReader reader;
+    reader.open(args[0], key_distance);
+    ActivityMeter meter(reader.header());
+    ActivityWriter writer;
+    writer.open(args[1], rate);
+    PointFrame frame;
+    std::size_t frame_count = 0;
+    double duration = 0.0;
+    while (reader.next(frame)) {
+        ActivitySample s = meter.measure(frame);
+        writer.add(s);
+        duration = s.time;
+        frame_count++;
+    }
+    writer.close();
+    std::fprintf(stderr, "Read %zu frames, %.1f s, wrote %zu samples.\n",
+                 frame_count, duration, writer.sample_count());
+    return 0;
+}
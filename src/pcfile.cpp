@@ -0,0 +1,464 @@
+#include "pcfile.hpp"
+#include "defs.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace {
+
+// Nominal frame rate, used to make up timestamps for legacy files.
+const uint64_t LEGACY_FRAME_RATE = 30;
+const int LEGACY_WIDTH = 640;
+const int LEGACY_HEIGHT = 480;
+
+// Size of the header in version 1 files.
+const uint32_t V1_HEADER_SIZE = 72;
+
+// Stride for touching pages of the mapped file.
+const uint64_t TOUCH_STRIDE = 4096;
+
+}
+
+PointFileHeader point_file_header(int width, int height,
+                                  const Intrinsics &intr,
+                                  uint64_t timestamp_rate) {
+    PointFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, POINT_FILE_MAGIC, sizeof(h.magic));
+    h.version = POINT_FILE_VERSION;
+    h.header_size = sizeof(h);
+    h.width = width;
+    h.height = height;
+    h.fx = intr.fx;
+    h.fy = intr.fy;
+    h.cx = intr.cx;
+    h.cy = intr.cy;
+    h.point_size = sizeof(Point);
+    h.point_format = POINT_FORMAT_XYZ_RGB0;
+    h.timestamp_rate = timestamp_rate;
+    return h;
+}
+
+Intrinsics file_intrinsics(const PointFileHeader &header) {
+    Intrinsics intr;
+    intr.fx = header.fx;
+    intr.fy = header.fy;
+    intr.cx = header.cx;
+    intr.cy = header.cy;
+    return intr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Writer
+
+PointFileWriter::PointFileWriter()
+    : m_fp(nullptr), m_offset(0), m_encoding(FRAME_RAW) {}
+
+PointFileWriter::~PointFileWriter() {
+    if (m_fp) {
+        close();
+    }
+}
+
+void PointFileWriter::write(const void *ptr, std::size_t size) {
+    if (std::fwrite(ptr, 1, size, m_fp) != size) {
+        die("Could not write file: %s", m_path.c_str());
+    }
+    m_offset += size;
+}
+
+void PointFileWriter::open(const std::string &path,
+                           const PointFileHeader &header) {
+    m_fp = std::fopen(path.c_str(), "wb");
+    if (!m_fp) {
+        die("Could not open file: %s", path.c_str());
+    }
+    m_path = path;
+    m_header = header;
+    m_header.version = POINT_FILE_VERSION;
+    m_header.header_size = sizeof(m_header);
+    m_header.frame_count = 0;
+    m_header.index_offset = 0;
+    m_header.key_offset = 0;
+    m_index.clear();
+    m_offset = 0;
+    write(&m_header, sizeof(m_header));
+}
+
+void PointFileWriter::set_encoding(uint32_t encoding) {
+    if (encoding != FRAME_RAW && encoding != FRAME_DELTA) {
+        die("Unknown frame encoding: %u", encoding);
+    }
+    m_encoding = encoding;
+    if (encoding == FRAME_DELTA && !m_rays) {
+        m_rays.reset(new RayTable(
+            m_header.width, m_header.height, file_intrinsics(m_header)));
+    }
+}
+
+void PointFileWriter::write_frame(const Point *points, std::size_t count,
+                                  uint64_t timestamp, uint64_t host_time) {
+    const void *payload = points;
+    FrameHeader fh;
+    fh.count = count;
+    fh.encoding = m_encoding;
+    fh.size = count * sizeof(Point);
+    fh.timestamp = timestamp;
+    fh.host_time = host_time;
+    if (m_encoding == FRAME_DELTA) {
+        m_encoder.encode(*m_rays, points, count, m_buffer);
+        payload = m_buffer.data();
+        fh.size = m_buffer.size();
+    }
+    m_index.push_back(IndexEntry{m_offset, timestamp});
+    write(&fh, sizeof(fh));
+    write(payload, fh.size);
+}
+
+void PointFileWriter::write_depth_frame(const unsigned short *depth,
+                                        const unsigned char *color,
+                                        uint64_t timestamp,
+                                        uint64_t host_time) {
+    std::size_t n = static_cast<std::size_t>(m_header.width) *
+        m_header.height;
+    m_buffer.clear();
+    encode_depth(depth, m_header.width, m_header.height, m_buffer);
+    FrameHeader fh;
+    fh.count = n;
+    fh.encoding = FRAME_DEPTH_RGB;
+    fh.size = m_buffer.size() + n * 3;
+    fh.timestamp = timestamp;
+    fh.host_time = host_time;
+    m_index.push_back(IndexEntry{m_offset, timestamp});
+    write(&fh, sizeof(fh));
+    write(m_buffer.data(), m_buffer.size());
+    write(color, n * 3);
+}
+
+void PointFileWriter::write_depth_key(const unsigned short *key) {
+    IndexHeader kh;
+    std::memcpy(kh.magic, POINT_KEY_MAGIC, sizeof(kh.magic));
+    kh.count = static_cast<uint64_t>(m_header.width) * m_header.height;
+    m_header.key_offset = m_offset;
+    write(&kh, sizeof(kh));
+    write(key, kh.count * sizeof(*key));
+}
+
+void PointFileWriter::close() {
+    IndexHeader ih;
+    std::memcpy(ih.magic, POINT_INDEX_MAGIC, sizeof(ih.magic));
+    ih.count = m_index.size();
+    m_header.frame_count = m_index.size();
+    m_header.index_offset = m_offset;
+    write(&ih, sizeof(ih));
+    write(m_index.data(), m_index.size() * sizeof(IndexEntry));
+    if (fseeko(m_fp, 0, SEEK_SET)) {
+        die("Could not write file: %s", m_path.c_str());
+    }
+    write(&m_header, sizeof(m_header));
+    if (std::fclose(m_fp)) {
+        die("Could not write file: %s", m_path.c_str());
+    }
+    m_fp = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Reader
+
+PointFileReader::PointFileReader()
+    : m_data(nullptr), m_size(0), m_pos(0), m_legacy(false) {}
+
+PointFileReader::~PointFileReader() {
+    close();
+}
+
+void PointFileReader::read(void *ptr, std::size_t size) {
+    if (size > m_size - m_pos) {
+        die("Could not read file: %s", m_path.c_str());
+    }
+    std::memcpy(ptr, m_data + m_pos, size);
+    m_pos += size;
+}
+
+void PointFileReader::seek(uint64_t offset) {
+    if (offset > m_size) {
+        die("Could not read file: %s", m_path.c_str());
+    }
+    m_pos = offset;
+}
+
+void PointFileReader::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        die("Could not open file: %s", path.c_str());
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        die("Could not read file: %s", path.c_str());
+    }
+    m_size = st.st_size;
+    if (m_size) {
+        void *p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            die("Could not map file: %s", path.c_str());
+        }
+        m_data = static_cast<const unsigned char *>(p);
+    }
+    ::close(fd);
+    m_pos = 0;
+    m_path = path;
+    m_index.clear();
+    m_rays.reset();
+
+    uint64_t end = m_size;
+    m_legacy = end < V1_HEADER_SIZE ||
+        std::memcmp(m_data, POINT_FILE_MAGIC, sizeof(POINT_FILE_MAGIC));
+    if (m_legacy) {
+        m_header = point_file_header(
+            LEGACY_WIDTH, LEGACY_HEIGHT,
+            kinect_intrinsics(LEGACY_WIDTH, LEGACY_HEIGHT),
+            KINECT_TIMESTAMP_RATE);
+        scan_legacy(end);
+        return;
+    }
+
+    // Older headers are shorter, and the missing fields are zero.
+    seek(0);
+    std::memset(&m_header, 0, sizeof(m_header));
+    read(&m_header, V1_HEADER_SIZE);
+    if (m_header.version < 1 || m_header.version > POINT_FILE_VERSION ||
+        m_header.header_size < V1_HEADER_SIZE) {
+        die("Unsupported file version %u: %s",
+            m_header.version, path.c_str());
+    }
+    if (m_header.version > 1) {
+        if (m_header.header_size < sizeof(m_header)) {
+            die("Corrupt header: %s", path.c_str());
+        }
+        read(reinterpret_cast<char *>(&m_header) + V1_HEADER_SIZE,
+             sizeof(m_header) - V1_HEADER_SIZE);
+    }
+    if (m_header.point_size != sizeof(Point) ||
+        m_header.point_format != POINT_FORMAT_XYZ_RGB0) {
+        die("Unsupported point format: %s", path.c_str());
+    }
+    if (m_header.index_offset) {
+        read_index();
+    } else {
+        std::fprintf(stderr, "Warning: rebuilding missing index: %s\n",
+                     path.c_str());
+        scan_frames(m_header.header_size, end);
+    }
+}
+
+void PointFileReader::close() {
+    if (m_data) {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+        m_data = nullptr;
+    }
+    m_size = 0;
+    m_pos = 0;
+}
+
+void PointFileReader::read_index() {
+    IndexHeader ih;
+    seek(m_header.index_offset);
+    read(&ih, sizeof(ih));
+    // The index runs to the end of the file, so the count is checked
+    // before allocating.
+    if (std::memcmp(ih.magic, POINT_INDEX_MAGIC, sizeof(ih.magic)) ||
+        ih.count > (m_size - m_pos) / sizeof(IndexEntry)) {
+        die("Corrupt index: %s", m_path.c_str());
+    }
+    m_index.resize(ih.count);
+    read(m_index.data(), m_index.size() * sizeof(IndexEntry));
+}
+
+void PointFileReader::scan_frames(uint64_t offset, uint64_t end) {
+    // Frames which are cut off at the end are ignored.  The depth key
+    // may appear between frames, and its magic number is never a
+    // valid frame header.
+    FrameHeader fh;
+    while (offset + sizeof(fh) <= end) {
+        seek(offset);
+        read(&fh, sizeof(fh));
+        if (!std::memcmp(&fh, POINT_INDEX_MAGIC, sizeof(POINT_INDEX_MAGIC))) {
+            break;
+        }
+        if (!std::memcmp(&fh, POINT_KEY_MAGIC, sizeof(POINT_KEY_MAGIC))) {
+            uint64_t size = sizeof(IndexHeader) +
+                static_cast<uint64_t>(m_header.width) * m_header.height *
+                sizeof(unsigned short);
+            if (size > end - offset) {
+                break;
+            }
+            m_header.key_offset = offset;
+            offset += size;
+            continue;
+        }
+        // Written this way so that a corrupt size cannot overflow.
+        if (fh.size > end - offset - sizeof(fh)) {
+            break;
+        }
+        m_index.push_back(IndexEntry{offset, fh.timestamp});
+        offset += sizeof(fh) + fh.size;
+    }
+    m_header.frame_count = m_index.size();
+}
+
+void PointFileReader::scan_legacy(uint64_t end) {
+    uint64_t offset = 0, tick = m_header.timestamp_rate / LEGACY_FRAME_RATE;
+    uint32_t count;
+    while (offset + sizeof(count) <= end) {
+        seek(offset);
+        read(&count, sizeof(count));
+        uint64_t size = static_cast<uint64_t>(count) * sizeof(Point);
+        if (offset + sizeof(count) + size > end) {
+            break;
+        }
+        m_index.push_back(IndexEntry{offset, m_index.size() * tick});
+        offset += sizeof(count) + size;
+    }
+    m_header.frame_count = m_index.size();
+}
+
+FrameHeader PointFileReader::frame_header(std::size_t frame) {
+    const IndexEntry &e = m_index.at(frame);
+    FrameHeader fh;
+    seek(e.offset);
+    if (m_legacy) {
+        uint32_t count;
+        read(&count, sizeof(count));
+        fh.count = count;
+        fh.encoding = FRAME_RAW;
+        fh.size = static_cast<uint64_t>(count) * sizeof(Point);
+        fh.timestamp = e.timestamp;
+        fh.host_time = frame * (1000000 / LEGACY_FRAME_RATE);
+    } else {
+        read(&fh, sizeof(fh));
+    }
+    return fh;
+}
+
+std::size_t PointFileReader::read_frame(std::size_t frame, Point *out,
+                                        std::size_t capacity,
+                                        FrameHeader *fhdr) {
+    FrameHeader fh = frame_header(frame);
+    if (fh.count > capacity) {
+        die("Corrupt frame %zu: %s", frame, m_path.c_str());
+    }
+    switch (fh.encoding) {
+    case FRAME_RAW:
+        if (fh.size != fh.count * sizeof(Point)) {
+            die("Corrupt frame %zu: %s", frame, m_path.c_str());
+        }
+        read(out, fh.size);
+        break;
+
+    case FRAME_DELTA:
+        // Decode straight from the mapping.
+        if (fh.size > m_size - m_pos ||
+            !decode_points(rays(), m_data + m_pos, fh.size,
+                           out, fh.count)) {
+            die("Corrupt frame %zu: %s", frame, m_path.c_str());
+        }
+        break;
+
+    case FRAME_DEPTH_RGB:
+        // Keying needs the background model, which follows the frames
+        // in order, so raw frames are read through FrameReader.
+        die("Raw depth frames must be keyed with FrameReader: %s",
+            m_path.c_str());
+        break;
+
+    default:
+        die("Unsupported frame encoding %u: %s",
+            fh.encoding, m_path.c_str());
+    }
+    if (fhdr) {
+        *fhdr = fh;
+    }
+    return fh.count;
+}
+
+void PointFileReader::read_frame(std::size_t frame,
+                                 std::vector<Point> &points,
+                                 FrameHeader *fhdr) {
+    FrameHeader fh = frame_header(frame);
+    points.resize(fh.count);
+    points.resize(read_frame(frame, points.data(), points.size(), fhdr));
+}
+
+void PointFileReader::prefetch(std::size_t frame) const {
+    if (frame >= m_index.size()) {
+        return;
+    }
+    uint64_t begin = m_index[frame].offset;
+    uint64_t end = frame + 1 < m_index.size() ?
+        m_index[frame + 1].offset : m_size;
+    if (end > m_size || begin > end) {
+        return;
+    }
+    // Touch every page, so that the frame is read in by this thread
+    // and not by whoever reads the frame.
+    volatile const unsigned char *p = m_data;
+    unsigned sum = 0;
+    for (uint64_t i = begin; i < end; i += TOUCH_STRIDE) {
+        sum += p[i];
+    }
+    sum += p[end - 1];
+    (void) sum;
+}
+
+const RayTable &PointFileReader::rays() {
+    if (!m_rays) {
+        m_rays.reset(new RayTable(
+            m_header.width, m_header.height, file_intrinsics(m_header)));
+    }
+    return *m_rays;
+}
+
+void PointFileReader::read_depth_key(unsigned short *key) {
+    if (!has_depth_key()) {
+        die("No depth key: %s", m_path.c_str());
+    }
+    IndexHeader kh;
+    seek(m_header.key_offset);
+    read(&kh, sizeof(kh));
+    if (std::memcmp(kh.magic, POINT_KEY_MAGIC, sizeof(kh.magic)) ||
+        kh.count != static_cast<uint64_t>(m_header.width) * m_header.height) {
+        die("Corrupt depth key: %s", m_path.c_str());
+    }
+    read(key, kh.count * sizeof(*key));
+}
+
+void PointFileReader::read_depth_frame(std::size_t frame,
+                                       unsigned short *depth,
+                                       unsigned char *color,
+                                       FrameHeader *fhdr) {
+    FrameHeader fh = frame_header(frame);
+    std::size_t n = static_cast<std::size_t>(m_header.width) *
+        m_header.height;
+    if (fh.encoding != FRAME_DEPTH_RGB) {
+        die("Frame %zu is not a depth frame: %s", frame, m_path.c_str());
+    }
+    if (fh.count != n || fh.size < n * 3 || fh.size > m_size - m_pos) {
+        die("Corrupt frame %zu: %s", frame, m_path.c_str());
+    }
+    const unsigned char *data = m_data + m_pos;
+    const unsigned char *end = data + fh.size - n * 3;
+    if (decode_depth(data, end, depth,
+                     m_header.width, m_header.height) != end) {
+        die("Corrupt frame %zu: %s", frame, m_path.c_str());
+    }
+    std::memcpy(color, end, n * 3);
+    if (fhdr) {
+        *fhdr = fh;
+    }
+}
@@ -0,0 +1,243 @@
+#ifndef PCTRACK_PCFILE_HPP
+#define PCTRACK_PCFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "convert.hpp"
+#include "point.hpp"
+
+// Point cloud file format, version 2.  All values are little-endian.
+//
+// The file starts with a PointFileHeader, followed by frames.  Each
+// frame is a FrameHeader followed by its payload.  After the last
+// frame is an index, which is an IndexHeader followed by one
+// IndexEntry per frame.  The header gives the offset of the index.
+//
+// Files may also contain a depth key, which is an IndexHeader with a
+// different magic number followed by a 16-bit depth per pixel.  The
+// header gives the offset of the key.
+//
+// Version 1 files have a shorter header with no depth key.
+//
+// If the index offset is zero, the file was not closed properly, and
+// readers recover the index by scanning the frames.
+//
+// Legacy files have no header, and consist of frames which are each a
+// 32-bit point count followed by the points.
+
+/// Magic number at the start of a point cloud file.
+const char POINT_FILE_MAGIC[8] = {'P', 'C', 'T', 'R', 'A', 'C', 'K', 0};
+/// Magic number at the start of the frame index.
+const char POINT_INDEX_MAGIC[8] = {'P', 'C', 'I', 'N', 'D', 'E', 'X', 0};
+/// Magic number at the start of the depth key.
+const char POINT_KEY_MAGIC[8] = {'P', 'C', 'D', 'K', 'E', 'Y', 0, 0};
+
+const uint32_t POINT_FILE_VERSION = 2;
+
+/// Point layout: three 32-bit floats in meters, then RGB0.
+const uint32_t POINT_FORMAT_XYZ_RGB0 = 0;
+
+/// Frame encoding: an array of Point structures.
+const uint32_t FRAME_RAW = 0;
+/// Frame encoding: compressed with PointEncoder.
+const uint32_t FRAME_DELTA = 1;
+/// Frame encoding: the registered depth image, compressed with
+/// encode_depth(), followed by the RGB image.  The point count is the
+/// number of pixels.
+const uint32_t FRAME_DEPTH_RGB = 2;
+
+/// Rate of the Kinect's device timestamp clock, in ticks per second.
+const uint64_t KINECT_TIMESTAMP_RATE = 60000000;
+
+struct PointFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    /// Size of the depth sensor, in pixels.
+    uint32_t width, height;
+    /// Intrinsics of the depth sensor.
+    float fx, fy, cx, cy;
+    /// Size and layout of each point.
+    uint32_t point_size;
+    uint32_t point_format;
+    /// Rate of the device timestamp clock, in ticks per second.
+    uint64_t timestamp_rate;
+    uint64_t frame_count;
+    /// Offset of the frame index, or zero if there is no index.
+    uint64_t index_offset;
+    /// Offset of the depth key, or zero if there is no key.
+    uint64_t key_offset;
+    /// Key distance used for the capture, in millimeters.
+    uint32_t key_distance;
+    uint32_t reserved;
+};
+
+struct FrameHeader {
+    /// Number of points in the frame.
+    uint32_t count;
+    /// How the payload is encoded.
+    uint32_t encoding;
+    /// Size of the payload, in bytes.
+    uint64_t size;
+    /// Device timestamp, in ticks of the device clock.
+    uint64_t timestamp;
+    /// Time the frame arrived at the host, in microseconds since the
+    /// start of the capture.
+    uint64_t host_time;
+};
+
+struct IndexHeader {
+    char magic[8];
+    uint64_t count;
+};
+
+struct IndexEntry {
+    /// Offset of the FrameHeader.
+    uint64_t offset;
+    /// Device timestamp of the frame.
+    uint64_t timestamp;
+};
+
+static_assert(sizeof(PointFileHeader) == 88, "bad header size");
+static_assert(sizeof(FrameHeader) == 32, "bad frame header size");
+static_assert(sizeof(IndexHeader) == 16, "bad index header size");
+static_assert(sizeof(IndexEntry) == 16, "bad index entry size");
+
+/// Create a header for a file captured with the given sensor.
+PointFileHeader point_file_header(int width, int height,
+                                  const Intrinsics &intr,
+                                  uint64_t timestamp_rate);
+
+/// Get the sensor intrinsics from a file header.
+Intrinsics file_intrinsics(const PointFileHeader &header);
+
+/// Writer for point cloud files.  Errors are fatal.
+class PointFileWriter {
+private:
+    std::FILE *m_fp;
+    std::string m_path;
+    PointFileHeader m_header;
+    std::vector<IndexEntry> m_index;
+    uint64_t m_offset;
+    uint32_t m_encoding;
+    std::unique_ptr<RayTable> m_rays;
+    PointEncoder m_encoder;
+    std::vector<unsigned char> m_buffer;
+
+    void write(const void *ptr, std::size_t size);
+
+public:
+    PointFileWriter();
+    PointFileWriter(const PointFileWriter &) = delete;
+    ~PointFileWriter();
+    PointFileWriter &operator=(const PointFileWriter &) = delete;
+
+    /// Create a file and write the header.
+    void open(const std::string &path, const PointFileHeader &header);
+
+    /// Set the encoding for frames written after this call.  This must
+    /// be called after open().  The default is FRAME_RAW.
+    void set_encoding(uint32_t encoding);
+
+    /// Write a frame of points.
+    void write_frame(const Point *points, std::size_t count,
+                     uint64_t timestamp, uint64_t host_time);
+
+    /// Write a frame as a registered depth image and RGB image.
+    void write_depth_frame(const unsigned short *depth,
+                           const unsigned char *color,
+                           uint64_t timestamp, uint64_t host_time);
+
+    /// Write the depth key.
+    void write_depth_key(const unsigned short *key);
+
+    /// Write the index and close the file.
+    void close();
+
+    /// Get the number of frames written so far.
+    std::size_t frame_count() const { return m_index.size(); }
+
+    /// Get the number of bytes written so far.
+    uint64_t size() const { return m_offset; }
+};
+
+/// Reader for point cloud files, including legacy files.  The file is
+/// memory-mapped, and any frame can be read in constant time.  Errors
+/// are fatal.
+class PointFileReader {
+private:
+    const unsigned char *m_data;
+    uint64_t m_size, m_pos;
+    std::string m_path;
+    PointFileHeader m_header;
+    std::vector<IndexEntry> m_index;
+    bool m_legacy;
+    std::unique_ptr<RayTable> m_rays;
+
+    const RayTable &rays();
+
+    void read(void *ptr, std::size_t size);
+    void seek(uint64_t offset);
+    void read_index();
+    void scan_frames(uint64_t offset, uint64_t end);
+    void scan_legacy(uint64_t end);
+
+public:
+    PointFileReader();
+    PointFileReader(const PointFileReader &) = delete;
+    ~PointFileReader();
+    PointFileReader &operator=(const PointFileReader &) = delete;
+
+    /// Open a file and read or rebuild its index.
+    void open(const std::string &path);
+    void close();
+
+    /// Get the file header.  For legacy and version 1 files, missing
+    /// fields are filled in with the values which pckinect used.
+    const PointFileHeader &header() const { return m_header; }
+
+    /// Test whether the file is a legacy file.
+    bool is_legacy() const { return m_legacy; }
+
+    /// Get the frame index.
+    const std::vector<IndexEntry> &index() const { return m_index; }
+    std::size_t frame_count() const { return m_index.size(); }
+
+    /// Read the header of a frame.
+    FrameHeader frame_header(std::size_t frame);
+
+    /// Touch the pages of a frame so they are read from disk.  This
+    /// may be called from another thread while frames are read.
+    void prefetch(std::size_t frame) const;
+
+    /// Read the points in a frame.  The output must have room for
+    /// capacity points, and frames with more points are an error.
+    /// Returns the number of points.  FRAME_DEPTH_RGB frames are an
+    /// error, since they must be keyed; use FrameReader for those.
+    std::size_t read_frame(std::size_t frame, Point *out,
+                           std::size_t capacity,
+                           FrameHeader *fhdr = nullptr);
+
+    /// Read the points in a frame into a vector.
+    void read_frame(std::size_t frame, std::vector<Point> &points,
+                    FrameHeader *fhdr = nullptr);
+
+    /// Test whether the file contains a depth key.
+    bool has_depth_key() const { return m_header.key_offset != 0; }
+
+    /// Read the depth key, which has one value per pixel.
+    void read_depth_key(unsigned short *key);
+
+    /// Read the depth and RGB images of a FRAME_DEPTH_RGB frame.  Each
+    /// has one value per pixel.
+    void read_depth_frame(std::size_t frame, unsigned short *depth,
+                          unsigned char *color, FrameHeader *fhdr = nullptr);
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "defs.hpp"
+#include "frame.hpp"
+#include "voxel.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    bool compress = false;
+    int key_distance = 0;
+    float voxel_size = 0.0f;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--key-distance" && i + 1 < argc) {
+            key_distance = std::stoi(argv[++i]);
+            if (key_distance <= 0 || key_distance > 1000) {
+                die("Key distance must be positive and no more than 1000.");
+            }
+        } else if (arg == "--voxel" && i + 1 < argc) {
+            voxel_size = std::stof(argv[++i]) * 0.001f;
+            if (!(voxel_size > 0.0f)) {
+                die("Voxel size must be positive.");
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        die("Usage: pcindex [--compress] [--key-distance MM] "
+            "[--voxel MM] IN OUT");
+    }
+
+    // Raw depth frames are keyed again, so that captures can be
+    // re-keyed with a different distance.
+    FrameReader reader;
+    reader.open(args[0], key_distance);
+    if (reader.file().is_legacy()) {
+        std::fputs("Converting legacy file.\n", stderr);
+    }
+    const PointFileHeader &header = reader.header();
+    if (reader.is_raw()) {
+        std::fprintf(stderr, "Keying depth frames at %u mm.\n",
+                     header.key_distance);
+    }
+
+    FrameWriter writer;
+    writer.open(args[1], header, compress ? FRAME_DELTA : FRAME_RAW);
+    if (reader.file().has_depth_key()) {
+        std::vector<unsigned short> key(header.width * header.height);
+        reader.file().read_depth_key(key.data());
+        writer.write_depth_key(key.data());
+    }
+    std::unique_ptr<VoxelGrid> voxel;
+    if (voxel_size > 0.0f) {
+        std::fprintf(stderr, "Downsampling to %g mm voxels.\n",
+                     voxel_size * 1000.0f);
+        voxel.reset(new VoxelGrid(voxel_size));
+    }
+    PointFrame frame;
+    uint64_t point_count = 0, input_count = 0;
+    double write_time = 0.0;
+    while (reader.next(frame)) {
+        input_count += frame.count;
+        if (voxel) {
+            frame.count = voxel->apply(frame.points(), frame.count,
+                                       frame.points());
+        }
+        Clock::time_point t0 = Clock::now();
+        writer.write(frame);
+        write_time += seconds(Clock::now() - t0);
+        point_count += frame.count;
+    }
+    uint64_t size = writer.size();
+    writer.close();
+    std::fprintf(stderr, "Wrote %zu frames, %llu points.\n",
+                 writer.frame_count(),
+                 static_cast<unsigned long long>(point_count));
+    if (voxel && input_count) {
+        std::fprintf(stderr, "Kept %.1f%% of %llu input points.\n",
+                     100.0 * point_count / input_count,
+                     static_cast<unsigned long long>(input_count));
+    }
+    if (!point_count) {
+        return 0;
+    }
+
+    // Read the output back, to report the size and speed of the
+    // encoding.
+    FrameReader check;
+    check.open(args[1]);
+    Clock::time_point t0 = Clock::now();
+    while (check.next(frame)) {
+    }
+    double read_time = seconds(Clock::now() - t0);
+    double raw = static_cast<double>(point_count) * sizeof(Point);
+    std::fprintf(stderr,
+                 "Size: %.1f bytes/point, %.2fx smaller than raw.\n",
+                 size / static_cast<double>(point_count), raw / size);
+    std::fprintf(stderr,
+                 "Write: %.1f Mpoint/s.  Read: %.1f Mpoint/s, "
+                 "%.1f frames/s.\n",
+                 point_count * 1e-6 / write_time,
+                 point_count * 1e-6 / read_time,
+                 check.frame_count() / read_time);
+    return 0;
+}
@@ -1,11 +1,26 @@
 #include "defs.hpp"
+#include "background.hpp"
+#include "capture.hpp"
+#include "convert.hpp"
+#include "depthfilter.hpp"
+#include "depthkey.hpp"
+#include "pcfile.hpp"
+#include "segment.hpp"
+#include "source.hpp"
+#include "track.hpp"
+#include "voxel.hpp"
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "libfreenect.h"
@@ -14,26 +29,7 @@
 const int WIDTH = 640;
 const int HEIGHT = 480;
 
-struct Point {
-    // Location in space, in meters.
-    float v[3];
-    // Color, RGB0.
-    unsigned color;
-};
-
-unsigned read_color(const unsigned char *p) {
-    union {
-        unsigned char uc[4];
-        unsigned ui;
-    } c;
-    c.uc[0] = p[0];
-    c.uc[1] = p[1];
-    c.uc[2] = p[2];
-    c.uc[3] = 0;
-    return c.ui;
-}
-
-const unsigned short *get_depth() {
+const unsigned short *get_depth(uint32_t *timestamp = nullptr) {
     void *p;
     uint32_t ts;
     int r;
@@ -42,6 +38,9 @@ const unsigned short *get_depth() {
     if (r < 0) {
         die("Could not get depth data.");
     }
+    if (timestamp) {
+        *timestamp = ts;
+    }
     return static_cast<const unsigned short *>(p);
 }
 
@@ -57,33 +56,384 @@ const unsigned char *get_color() {
     return static_cast<const unsigned char *>(p);
 }
 
+// Frames from a Kinect, using the sync API.
+class KinectSource : public FrameSource {
+public:
+    int width() const override { return WIDTH; }
+    int height() const override { return HEIGHT; }
+    bool live() const override { return true; }
+
+    bool next(const unsigned short *&depth, const unsigned char *&color,
+              uint32_t &timestamp) override {
+        depth = get_depth(&timestamp);
+        color = get_color();
+        return true;
+    }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Segments each frame into objects, and writes the objects, tracks
+// of the objects, or both.
+class ObjectLog : public FrameObserver {
+private:
+    Segmenter m_segmenter;
+    std::vector<Blob> m_blobs;
+    BlobWriter m_blob_writer;
+    bool m_write_blobs;
+    std::unique_ptr<Tracker> m_tracker;
+    TrackWriter m_track_writer;
+    unsigned m_frame_count;
+    unsigned long m_blob_count;
+
+public:
+    /// Create a log which writes to either or both files, which may be
+    /// null.
+    ObjectLog(const RayTable &rays, const char *blob_path,
+              const char *track_path);
+
+    void observe(const unsigned short *depth, const unsigned char *mask,
+                 uint64_t timestamp) override;
+
+    /// Close the files and print a summary.
+    void close();
+};
+
+ObjectLog::ObjectLog(const RayTable &rays, const char *blob_path,
+                     const char *track_path)
+    : m_segmenter(rays, default_segment_config()),
+      m_write_blobs(blob_path != nullptr),
+      m_frame_count(0), m_blob_count(0) {
+    if (blob_path) {
+        m_blob_writer.open(blob_path);
+    }
+    if (track_path) {
+        m_tracker.reset(new Tracker(default_tracker_config()));
+        m_track_writer.open(track_path);
+    }
+}
+
+void ObjectLog::observe(const unsigned short *depth,
+                        const unsigned char *mask, uint64_t timestamp) {
+    m_segmenter.segment(depth, mask, m_blobs);
+    if (m_write_blobs) {
+        m_blob_writer.write(timestamp, m_blobs);
+    }
+    if (m_tracker) {
+        m_tracker->update(m_blobs, static_cast<double>(timestamp) /
+                          KINECT_TIMESTAMP_RATE);
+        m_track_writer.write(timestamp, m_tracker->tracks());
+    }
+    m_frame_count++;
+    m_blob_count += m_blobs.size();
+}
+
+void ObjectLog::close() {
+    m_blob_writer.close();
+    m_track_writer.close();
+    double frames = m_frame_count ? m_frame_count : 1;
+    std::fprintf(stderr, "Objects: %.2f per frame.\n",
+                 m_blob_count / frames);
+    if (m_tracker) {
+        std::fprintf(stderr, "Tracks: %.2f per frame.\n",
+                     m_track_writer.count() / frames);
+    }
+}
+
+// Paces frames from sources which are not live.  A rate of zero means
+// as fast as possible.
+class Pacer {
+private:
+    Clock::duration m_period;
+    Clock::time_point m_next;
+
+public:
+    explicit Pacer(double rate)
+        : m_period(rate > 0.0 ?
+                   std::chrono::duration_cast<Clock::duration>(
+                       std::chrono::duration<double>(1.0 / rate)) :
+                   Clock::duration::zero()),
+          m_next(Clock::now()) {}
+
+    void wait() {
+        if (m_period == Clock::duration::zero()) {
+            return;
+        }
+        std::this_thread::sleep_until(m_next);
+        m_next += m_period;
+    }
+};
+
+// Capture frames one at a time on this thread.
+CaptureStats capture_serial(FrameSource &source, const RayTable &rays,
+                            DepthBackground &background,
+                            PointFileWriter &writer, int frame_count,
+                            bool raw, const CaptureStages &stages,
+                            double rate) {
+    CaptureStats stats;
+    Clock::time_point start = Clock::now();
+    int n = source.width() * source.height();
+    std::vector<Point> points(n);
+    std::vector<unsigned char> mask(n);
+    TimestampUnwrapper unwrap;
+    std::unique_ptr<VoxelGrid> voxel;
+    if (stages.voxel_size > 0.0f) {
+        voxel.reset(new VoxelGrid(stages.voxel_size));
+    }
+    Pacer pacer(source.live() ? 0.0 : rate);
+    for (int i = 0; i < frame_count; i++) {
+        pacer.wait();
+        Clock::time_point t0 = Clock::now();
+        uint32_t timestamp;
+        const unsigned short *depth;
+        const unsigned char *color;
+        if (!source.next(depth, color, timestamp)) {
+            break;
+        }
+
+        Clock::time_point t1 = Clock::now();
+        unsigned count = 0;
+        if (!raw) {
+            background.apply(depth, mask.data());
+            if (stages.filter) {
+                stats.filter += stages.filter->apply(depth, mask.data());
+            }
+            count = convert_points(
+                rays, depth, color, mask.data(), points.data());
+            if (voxel) {
+                count = voxel->apply(points.data(), count, points.data());
+            }
+        }
+
+        Clock::time_point t2 = Clock::now();
+        uint64_t device_time = unwrap(timestamp);
+        Clock::time_point t3 = t2;
+        if (stages.observer && !raw) {
+            stages.observer->observe(depth, mask.data(), device_time);
+            t3 = Clock::now();
+        }
+
+        uint64_t host_time =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                t0 - start).count();
+        if (raw) {
+            writer.write_depth_frame(depth, color, device_time, host_time);
+        } else {
+            writer.write_frame(points.data(), count, device_time, host_time);
+        }
+
+        Clock::time_point t4 = Clock::now();
+        stats.acquire_time += std::chrono::duration<double>(t1 - t0).count();
+        stats.convert_time += std::chrono::duration<double>(t2 - t1).count();
+        stats.observe_time += std::chrono::duration<double>(t3 - t2).count();
+        stats.write_time += std::chrono::duration<double>(t4 - t3).count();
+        stats.max_latency = std::max(
+            stats.max_latency, std::chrono::duration<double>(t4 - t0).count());
+        stats.frames++;
+    }
+    stats.wall_time =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    return stats;
+}
+
+// Capture frames from a source which is not live, feeding a pipeline.
+// When unpaced, frames wait for a free slot instead of being dropped,
+// so this measures the throughput of the pipeline.
+CaptureStats capture_source(FrameSource &source, const RayTable &rays,
+                            DepthBackground &background,
+                            PointFileWriter &writer, int frame_count,
+                            int worker_count, bool raw,
+                            const CaptureStages &stages, double rate) {
+    CapturePipeline pipeline(rays, background, writer, frame_count,
+                             worker_count, 8, raw, stages);
+    Pacer pacer(rate);
+    while (pipeline.accepting()) {
+        pacer.wait();
+        uint32_t timestamp;
+        const unsigned short *depth;
+        const unsigned char *color;
+        if (!source.next(depth, color, timestamp)) {
+            break;
+        }
+        pipeline.submit(depth, color, timestamp, rate <= 0.0);
+    }
+    pipeline.finish();
+    return pipeline.stats();
+}
+
+struct AsyncState {
+    CapturePipeline *pipeline;
+    std::vector<unsigned char> color;
+    bool have_color;
+};
+
+void async_depth(freenect_device *dev, void *depth, uint32_t timestamp) {
+    AsyncState &s = *static_cast<AsyncState *>(freenect_get_user(dev));
+    if (s.have_color) {
+        s.pipeline->submit(
+            static_cast<const unsigned short *>(depth),
+            s.color.data(), timestamp);
+    }
+}
+
+void async_video(freenect_device *dev, void *video, uint32_t timestamp) {
+    (void) timestamp;
+    AsyncState &s = *static_cast<AsyncState *>(freenect_get_user(dev));
+    std::memcpy(s.color.data(), video, s.color.size());
+    s.have_color = true;
+}
+
+// Capture frames with the async API, feeding a pipeline which keys,
+// converts and writes frames on other threads.
+CaptureStats capture_async(const RayTable &rays,
+                           DepthBackground &background,
+                           PointFileWriter &writer, int frame_count,
+                           int worker_count, bool raw,
+                           const CaptureStages &stages) {
+    // The sync API keeps the device open on its own thread.
+    freenect_sync_stop();
+
+    freenect_context *ctx;
+    freenect_device *dev;
+    if (freenect_init(&ctx, nullptr) < 0) {
+        die("Could not initialize libfreenect.");
+    }
+    freenect_select_subdevices(ctx, FREENECT_DEVICE_CAMERA);
+    if (freenect_open_device(ctx, &dev, 0) < 0) {
+        die("Could not open device.");
+    }
+
+    CapturePipeline pipeline(rays, background, writer, frame_count,
+                             worker_count, 8, raw, stages);
+    AsyncState state;
+    state.pipeline = &pipeline;
+    state.color.resize(WIDTH * HEIGHT * 3);
+    state.have_color = false;
+
+    freenect_set_user(dev, &state);
+    freenect_set_depth_callback(dev, async_depth);
+    freenect_set_video_callback(dev, async_video);
+    freenect_set_depth_mode(dev, freenect_find_depth_mode(
+        FREENECT_RESOLUTION_MEDIUM, FREENECT_DEPTH_REGISTERED));
+    freenect_set_video_mode(dev, freenect_find_video_mode(
+        FREENECT_RESOLUTION_MEDIUM, FREENECT_VIDEO_RGB));
+    if (freenect_start_depth(dev) < 0 || freenect_start_video(dev) < 0) {
+        die("Could not start streams.");
+    }
+    while (pipeline.accepting()) {
+        if (freenect_process_events(ctx) < 0) {
+            die("Could not process device events.");
+        }
+    }
+    freenect_stop_depth(dev);
+    freenect_stop_video(dev);
+    freenect_close_device(dev);
+    freenect_shutdown(ctx);
+
+    pipeline.finish();
+    return pipeline.stats();
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        die("Usage: pckinect FILE FRAME_COUNT KEY_DISTANCE_MM");
+    bool serial = false, compress = false, raw = false, synthetic = false;
+    bool filter = false;
+    const char *replay = nullptr, *blob_path = nullptr;
+    const char *track_path = nullptr;
+    double rate = 30.0;
+    float voxel_size = 0.0f;
+    int worker_count = CapturePipeline::default_worker_count();
+    SyntheticConfig synth = default_synthetic_config(WIDTH, HEIGHT);
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--serial") {
+            serial = true;
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--raw") {
+            raw = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            worker_count = std::stoi(argv[++i]);
+            if (worker_count < 1) {
+                die("Thread count must be positive.");
+            }
+        } else if (arg == "--voxel" && i + 1 < argc) {
+            voxel_size = std::stof(argv[++i]) * 0.001f;
+            if (!(voxel_size > 0.0f)) {
+                die("Voxel size must be positive.");
+            }
+        } else if (arg == "--filter") {
+            filter = true;
+        } else if (arg == "--blobs" && i + 1 < argc) {
+            blob_path = argv[++i];
+        } else if (arg == "--tracks" && i + 1 < argc) {
+            track_path = argv[++i];
+        } else if (arg == "--synthetic") {
+            synthetic = true;
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (arg == "--rate" && i + 1 < argc) {
+            rate = std::stod(argv[++i]);
+        } else if (arg == "--objects" && i + 1 < argc) {
+            synth.object_count = std::stoi(argv[++i]);
+        } else if (arg == "--holes" && i + 1 < argc) {
+            synth.hole_rate = std::stof(argv[++i]);
+        } else if (arg == "--noise" && i + 1 < argc) {
+            synth.noise = std::stof(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            synth.seed = std::stoul(argv[++i]);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 3 || (synthetic && replay) ||
+        (raw && (filter || voxel_size > 0.0f || blob_path ||
+                 track_path))) {
+        die("Usage: pckinect [--serial] [--threads N] "
+            "[--compress | --raw] [--filter] [--voxel MM] "
+            "[--blobs CSV_FILE] "
+            "[--tracks CSV_FILE] "
+            "[--synthetic [OPTIONS] | --replay RAW_FILE] [--rate FPS] "
+            "FILE FRAME_COUNT KEY_DISTANCE_MM");
     }
 
-    int frame_count = std::stoi(argv[2]);
+    int frame_count = std::stoi(args[1]);
     if (frame_count < 1) {
         die("Frame count is negative.");
     }
-    int key_distance = std::stoi(argv[3]);
+    int key_distance = std::stoi(args[2]);
     if (key_distance <= 0 || key_distance > 1000) {
         die("Key distance must be positive and no more than 1000.");
     }
 
+    std::unique_ptr<FrameSource> source;
+    if (synthetic) {
+        synth.frame_rate = rate > 0.0 ? rate : synth.frame_rate;
+        source.reset(new SyntheticSource(synth));
+    } else if (replay) {
+        source.reset(new ReplaySource(replay, true));
+    } else {
+        source.reset(new KinectSource);
+    }
+    int width = source->width(), height = source->height();
+
     std::fputs("Creating depth key.\n", stderr);
-    std::vector<unsigned short> depth_key(WIDTH * HEIGHT);
+    std::vector<unsigned short> depth_key(width * height);
     {
         const unsigned short *depth;
+        const unsigned char *color;
+        uint32_t timestamp;
         while (true) {
-            depth = get_depth();
+            if (!source->next(depth, color, timestamp)) {
+                die("No frames for the depth key.");
+            }
 
             // Fill holes by erosion.  Erosion is always at least 1.
             int holes = 0;
-            for (int i = 0; i < WIDTH * HEIGHT; i++) {
+            for (int i = 0; i < width * height; i++) {
                 holes += depth[i] == 0;
             }
-            double frac = (double) holes * (1.0 / (WIDTH * HEIGHT));
+            double frac = (double) holes * (1.0 / (width * height));
             std::fprintf(stderr, "    Filling %d pixels (%.1f%%).\n",
                          holes, frac * 100.0);
             if (frac > 0.25) {
@@ -93,85 +443,62 @@ int main(int argc, char *argv[]) {
             }
         }
 
-        int unfilled = 0;
-        for (int y = 0; y < HEIGHT; y++) {
-            for (int x = 0; x < WIDTH; x++) {
-                unsigned short d = 0xffff;
-                for (int r = 1; r < 64; r++) {
-                    int y0 = std::max(y - r, 0);
-                    int y1 = std::min(y + r + 1, HEIGHT);
-                    int x0 = std::max(x - r, 0);
-                    int x1 = std::min(x + r + 1, WIDTH);
-                    for (int yy = y0; yy < y1; yy++) {
-                        for (int xx = x0; xx < x1; xx++) {
-                            unsigned short dd = depth[yy * WIDTH + xx];
-                            if (!dd) {
-                                continue;
-                            } else if (dd < d) {
-                                d = dd;
-                            }
-                        }
-                    }
-                    if (d != 0xffff) {
-                        break;
-                    }
-                }
-                if (d == 0xffff) {
-                    d = 0;
-                    unfilled++;
-                }
-                depth_key[y * WIDTH + x] = d;
-            }
-        }
+        int unfilled = fill_depth_key(
+            depth, depth_key.data(), width, height);
         std::fprintf(stderr, "   Could not fill %d pixels.\n", unfilled);
     }
 
-    std::fputs("Sleeping 2 seconds.\n", stderr);
-    sleep(2);
+    // The key only seeds the background model, which then adapts to
+    // drift and to objects which are moved into or out of the scene.
+    DepthBackground background(
+        width, height, default_background_config(key_distance));
+    background.init(depth_key.data());
 
-    std::fprintf(stderr, "Writing data to %s.\n", argv[1]);
-    FILE *fp = std::fopen(argv[1], "wb");
-    if (!fp) {
-        die("Could not open file.");
+    if (source->live()) {
+        std::fputs("Sleeping 2 seconds.\n", stderr);
+        sleep(2);
     }
 
-    std::vector<Point> points;
-    for (int i = 0; i < frame_count; i++) {
-        const unsigned short *depth = get_depth();
-        const unsigned char *color = get_color();
-
-        // Convert data to points.
-        points.clear();
-        for (int y = 0; y < HEIGHT; y++) {
-            for (int x = 0; x < WIDTH; x++) {
-                int d = depth[y*WIDTH+x];
-                int dk = depth_key[y*WIDTH+x];
-                unsigned c = read_color(color + (y * WIDTH + x) * 3);
-                if (!d || d >= dk - key_distance) {
-                    continue;
-                }
-                float z = 0.001f * d;
-                float scaleFactor = 0.0021f;
-                points.push_back(Point{
-                    { static_cast<float>(WIDTH  / 2 - x) * (z * scaleFactor),
-                      static_cast<float>(HEIGHT / 2 - y) * (z * scaleFactor),
-                      z },
-                    c
-                });
-            }
-        }
+    std::fprintf(stderr, "Writing data to %s.\n", args[0]);
+    Intrinsics intr = kinect_intrinsics(width, height);
+    PointFileHeader header = point_file_header(
+        width, height, intr, KINECT_TIMESTAMP_RATE);
+    header.key_distance = key_distance;
+    PointFileWriter writer;
+    writer.open(args[0], header);
+    writer.write_depth_key(depth_key.data());
+    if (compress) {
+        writer.set_encoding(FRAME_DELTA);
+    }
 
-        {
-            unsigned n = points.size();
-            std::size_t r;
-            r = std::fwrite(&n, sizeof(n), 1, fp);
-            if (r != 1) {
-                die("Could not write data.");
-            }
-            r = std::fwrite(points.data(), sizeof(Point), n, fp);
-            if (r != n) {
-                die("Could not write data.");
-            }
-        }
+    RayTable rays(width, height, intr);
+    std::unique_ptr<ObjectLog> objects;
+    if (blob_path || track_path) {
+        objects.reset(new ObjectLog(rays, blob_path, track_path));
+    }
+    DepthFilter depth_filter(width, height, default_depth_filter_config());
+    CaptureStages stages;
+    stages.filter = filter ? &depth_filter : nullptr;
+    stages.voxel_size = voxel_size;
+    stages.observer = objects.get();
+    CaptureStats stats;
+    if (serial) {
+        stats = capture_serial(
+            *source, rays, background, writer, frame_count, raw, stages,
+            rate);
+    } else if (source->live()) {
+        stats = capture_async(
+            rays, background, writer, frame_count, worker_count, raw,
+            stages);
+    } else {
+        stats = capture_source(
+            *source, rays, background, writer, frame_count, worker_count,
+            raw, stages, rate);
+    }
+    writer.close();
+    if (objects) {
+        objects->close();
     }
+    print_capture_stats(stats);
+    return 0;
 }
@@ -0,0 +1,176 @@
+#include "defs.hpp"
+#include "frame.hpp"
+#include "segment.hpp"
+#include "track.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+// Reads the depth image and foreground mask of each frame of a
+// capture.  Raw depth frames are keyed by the FrameReader, and frames
+// of points are projected back into the image, keeping the nearest
+// point in each pixel.
+class MaskReader {
+private:
+    FrameReader &m_reader;
+    Intrinsics m_intr;
+    int m_width, m_height;
+    PointFrame m_frame;
+    std::vector<unsigned short> m_depth;
+    std::vector<unsigned char> m_mask;
+
+public:
+    MaskReader(FrameReader &reader);
+
+    /// Read the next frame.  Returns false if there are no more frames.
+    bool next(uint64_t *timestamp);
+
+    const unsigned short *depth() const {
+        return m_reader.is_raw() ? m_reader.depth() : m_depth.data();
+    }
+    const unsigned char *mask() const {
+        return m_reader.is_raw() ? m_reader.mask() : m_mask.data();
+    }
+};
+
+MaskReader::MaskReader(FrameReader &reader)
+    : m_reader(reader), m_intr(file_intrinsics(reader.header())),
+      m_width(reader.header().width), m_height(reader.header().height) {
+    if (!reader.is_raw()) {
+        m_depth.resize(m_width * m_height);
+        m_mask.resize(m_width * m_height);
+    }
+}
+
+bool MaskReader::next(uint64_t *timestamp) {
+    if (m_reader.is_raw()) {
+        FrameHeader fh;
+        if (!m_reader.next_depth(&fh)) {
+            return false;
+        }
+        *timestamp = fh.timestamp;
+        return true;
+    }
+
+    if (!m_reader.next(m_frame)) {
+        return false;
+    }
+    *timestamp = m_frame.timestamp;
+    std::fill(m_depth.begin(), m_depth.end(), 0);
+    std::fill(m_mask.begin(), m_mask.end(), 0);
+    for (std::size_t i = 0; i < m_frame.count; i++) {
+        const Point &p = m_frame.points()[i];
+        float z = p.v[2];
+        if (!(z > 0.0f)) {
+            continue;
+        }
+        long x = std::lround(m_intr.cx - p.v[0] / z * m_intr.fx);
+        long y = std::lround(m_intr.cy - p.v[1] / z * m_intr.fy);
+        long d = std::lround(z * 1000.0f);
+        if (x < 0 || x >= m_width || y < 0 || y >= m_height ||
+            d > 0xffff) {
+            continue;
+        }
+        long k = y * m_width + x;
+        if (!m_mask[k] || d < m_depth[k]) {
+            m_depth[k] = static_cast<unsigned short>(d);
+            m_mask[k] = 0xff;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    int key_distance = 0;
+    const char *blob_path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--key-distance" && i + 1 < argc) {
+            key_distance = std::stoi(argv[++i]);
+            if (key_distance <= 0 || key_distance > 1000) {
+                die("Key distance must be positive and no more than 1000.");
+            }
+        } else if (arg == "--blobs" && i + 1 < argc) {
+            blob_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        die("Usage: pcobjects [--key-distance MM] [--blobs CSV_FILE] "
+            "IN TRACKS_CSV_FILE");
+    }
+
+    FrameReader reader;
+    reader.open(args[0], key_distance);
+    const PointFileHeader &header = reader.header();
+    if (reader.is_raw()) {
+        std::fprintf(stderr, "Keying depth frames at %d mm.\n",
+                     header.key_distance);
+    }
+
+    MaskReader frames(reader);
+    RayTable rays(header.width, header.height, file_intrinsics(header));
+    Segmenter segmenter(rays, default_segment_config());
+    Tracker tracker(default_tracker_config());
+    BlobWriter blob_writer;
+    if (blob_path) {
+        blob_writer.open(blob_path);
+    }
+    TrackWriter track_writer;
+    track_writer.open(args[1]);
+
+    std::vector<Blob> blobs;
+    double read_time = 0.0, segment_time = 0.0, track_time = 0.0;
+    uint64_t blob_count = 0;
+    double rate = header.timestamp_rate ?
+        static_cast<double>(header.timestamp_rate) : KINECT_TIMESTAMP_RATE;
+    std::size_t n = reader.frame_count();
+    for (;;) {
+        Clock::time_point t0 = Clock::now();
+        uint64_t timestamp;
+        if (!frames.next(&timestamp)) {
+            break;
+        }
+        Clock::time_point t1 = Clock::now();
+        segmenter.segment(frames.depth(), frames.mask(), blobs);
+        Clock::time_point t2 = Clock::now();
+        tracker.update(blobs, timestamp / rate);
+        Clock::time_point t3 = Clock::now();
+        if (blob_path) {
+            blob_writer.write(timestamp, blobs);
+        }
+        track_writer.write(timestamp, tracker.tracks());
+        read_time += seconds(t1 - t0);
+        segment_time += seconds(t2 - t1);
+        track_time += seconds(t3 - t2);
+        blob_count += blobs.size();
+    }
+    blob_writer.close();
+    track_writer.close();
+
+    double frame_scale = n ? 1.0 / n : 0.0;
+    std::fprintf(stderr, "Frames: %zu, %.2f objects and %.2f tracks "
+                 "per frame.\n", n, blob_count * frame_scale,
+                 track_writer.count() * frame_scale);
+    std::fprintf(stderr, "Time per frame: read %.2f ms, segment %.2f ms, "
+                 "track %.3f ms.\n", read_time * frame_scale * 1e3,
+                 segment_time * frame_scale * 1e3,
+                 track_time * frame_scale * 1e3);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "defs.hpp"
+#include "frame.hpp"
+#include "octree.hpp"
+#include "voxel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Default limit on the points held in memory while building, in MB.
+const int DEFAULT_MEMORY = 1024;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+// Get the directory of a path, for temporary files.
+std::string dir_name(const std::string &path) {
+    std::size_t pos = path.find_last_of('/');
+    if (pos == std::string::npos) {
+        return ".";
+    }
+    return pos ? path.substr(0, pos) : "/";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    int key_distance = 0, step = 1, memory = DEFAULT_MEMORY;
+    float voxel_size = 0.0f;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--key-distance" && i + 1 < argc) {
+            key_distance = std::stoi(argv[++i]);
+            if (key_distance <= 0 || key_distance > 1000) {
+                die("Key distance must be positive and no more than 1000.");
+            }
+        } else if (arg == "--voxel" && i + 1 < argc) {
+            voxel_size = std::stof(argv[++i]) * 0.001f;
+            if (!(voxel_size > 0.0f)) {
+                die("Voxel size must be positive.");
+            }
+        } else if (arg == "--memory" && i + 1 < argc) {
+            memory = std::stoi(argv[++i]);
+            if (memory < 1) {
+                die("Memory must be positive.");
+            }
+        } else if (arg == "--step" && i + 1 < argc) {
+            step = std::stoi(argv[++i]);
+            if (step < 1) {
+                die("Step must be positive.");
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        die("Usage: pcoctree [--key-distance MM] [--voxel MM] [--step N] "
+            "[--memory MB] IN OUT");
+    }
+
+    // Points beyond the memory limit are spilled to temporary files
+    // next to the output, and the tree is built from those.
+    Clock::time_point t0 = Clock::now();
+    FrameReader reader;
+    reader.open(args[0], key_distance);
+    std::unique_ptr<VoxelGrid> voxel;
+    if (voxel_size > 0.0f) {
+        voxel.reset(new VoxelGrid(voxel_size));
+    }
+    std::size_t memory_points =
+        (static_cast<std::size_t>(memory) << 20) / sizeof(Point);
+    OctreeFileBuilder builder(default_octree_config(), memory_points,
+                              dir_name(args[1]));
+    PointFrame frame;
+    uint64_t frame_count = 0, input_count = 0;
+    // Skipped frames are still read, so that the background model of
+    // raw captures sees every frame.
+    while (reader.next(frame)) {
+        if (frame.index % step) {
+            continue;
+        }
+        input_count += frame.count;
+        if (voxel) {
+            frame.count = voxel->apply(frame.points(), frame.count,
+                                       frame.points());
+        }
+        builder.add(frame.points(), frame.count);
+        frame_count++;
+    }
+    Clock::time_point t1 = Clock::now();
+    std::fprintf(stderr, "Read %llu frames, kept %llu of %llu points.\n",
+                 static_cast<unsigned long long>(frame_count),
+                 static_cast<unsigned long long>(builder.point_count()),
+                 static_cast<unsigned long long>(input_count));
+
+    builder.write(args[1], frame_count);
+    Clock::time_point t2 = Clock::now();
+
+    uint32_t depth = 0, root_count = 0;
+    for (const OctreeNode &n : builder.nodes()) {
+        depth = std::max(depth, n.level);
+    }
+    if (!builder.nodes().empty()) {
+        root_count = builder.nodes()[0].count;
+    }
+    std::fprintf(stderr,
+                 "Built %zu nodes, depth %u, %u points in the root.\n",
+                 builder.nodes().size(), depth, root_count);
+    std::fprintf(stderr, "Time: read %.2f s, build and write %.2f s.\n",
+                 seconds(t1 - t0), seconds(t2 - t1));
+    return 0;
+}
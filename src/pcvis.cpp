@@ -1,10 +1,19 @@
 #include "defs.hpp"
+#include "frame.hpp"
+#include "octree.hpp"
+#include "pcfile.hpp"
+#include "playback.hpp"
 #include "sggl/3_3.h"
 
-#include <cassert>
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstdio>
-#include <fstream>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "SDL.h"
 #define GLM_FORCE_RADIANS 1
@@ -17,17 +26,66 @@ namespace {
 
 const int WIDTH = 1280;
 const int HEIGHT = 720;
+// Number of buffers in the upload ring.
+const int UPLOAD_BUFFER_COUNT = 3;
+// Number of frames to read ahead of playback.
+const std::size_t PREFETCH_FRAMES = 8;
+// Longest time to wait for the GPU to release a buffer, in ns.
+const GLuint64 FENCE_TIMEOUT = 1000000000;
+// Playback speeds, selected with the up and down keys.
+const double SPEEDS[] = {0.1, 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.0};
+// Number of frames drawn by --bench by default.
+const int BENCH_FRAMES = 300;
+// Number of frames drawn by --bench before timing starts.
+const int BENCH_WARMUP = 10;
+// Number of timer queries in flight.  Results are read back this many
+// frames later, so reading them does not wait for the GPU.
+const int TIMER_QUERY_COUNT = 4;
+// Number of frames per swing of the camera in --bench.
+const int BENCH_CAMERA_PERIOD = 240;
+// Default number of octree points to draw, changed with the up and
+// down keys.
+const uint64_t OCTREE_BUDGET = 2000000;
+// Most octree points to upload in one frame, so that moving the
+// camera does not stall drawing.
+const uint64_t OCTREE_UPLOAD_POINTS = 1000000;
+// Octree nodes stay on the GPU until there are this many times the
+// budget, and then the least recently drawn are freed.
+const uint64_t OCTREE_CACHE_FACTOR = 4;
+// Number of octree nodes which may be read from disk at once.
+const std::size_t OCTREE_QUEUE_SIZE = 64;
 SDL_Window *g_window;
 SDL_GLContext g_context;
 
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+struct UploadBuffer {
+    GLuint buffer;
+    // Vertex array for drawing points from the buffer.
+    GLuint array;
+    // Fence after the last command which used the buffer, or zero.
+    GLsync fence;
+};
+
 __attribute__((noreturn))
 void die_sdl(const char *what) {
     die("%s: %s", what, SDL_GetError());
 }
 
-void sdl_init() {
+void sdl_init(bool hidden) {
     unsigned flags;
 
+    // A hidden window still needs a display, unless SDL draws
+    // offscreen with EGL, so use that on machines without one.
+    if (hidden && !std::getenv("SDL_VIDEODRIVER") &&
+        !std::getenv("DISPLAY") && !std::getenv("WAYLAND_DISPLAY")) {
+        setenv("SDL_VIDEODRIVER", "offscreen", 0);
+    }
+
     flags = SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_EVENTS;
     if (SDL_Init(flags)) {
         die_sdl("Could not initialize LibSDL");
@@ -36,6 +94,9 @@ void sdl_init() {
     flags = (SDL_WINDOW_OPENGL |
              SDL_WINDOW_ALLOW_HIGHDPI |
              SDL_WINDOW_RESIZABLE);
+    if (hidden) {
+        flags |= SDL_WINDOW_HIDDEN;
+    }
     g_window = SDL_CreateWindow(
         "PCTrack",
         SDL_WINDOWPOS_UNDEFINED,
@@ -62,13 +123,83 @@ void sdl_init() {
     }
 }
 
-bool sdl_handle_events() {
+void show_status(const PlaybackClock &clock) {
+    char title[128];
+    std::snprintf(title, sizeof(title),
+                  "PCTrack - frame %zu/%zu, %.2f/%.2f s, %gx%s",
+                  clock.frame() + 1, clock.frame_count(), clock.position(),
+                  clock.duration(), clock.speed(),
+                  clock.paused() ? ", paused" : "");
+    SDL_SetWindowTitle(g_window, title);
+}
+
+// Change the speed to the next step up or down.
+void change_speed(PlaybackClock &clock, int direction) {
+    int n = sizeof(SPEEDS) / sizeof(*SPEEDS), i = 0;
+    while (i < n - 1 && SPEEDS[i] < clock.speed()) {
+        i++;
+    }
+    i = std::min(std::max(i + direction, 0), n - 1);
+    clock.set_speed(SPEEDS[i]);
+}
+
+// Handle playback keys:
+//
+//   Space          pause or resume
+//   Comma, period  step back or forward one frame
+//   Left, right    seek back or forward one second, or ten with shift
+//   Up, down       play faster or slower
+//   1              play at normal speed
+//   Home, end      seek to the start or end
+void handle_key(PlaybackClock &clock, const SDL_Keysym &key) {
+    double seek = key.mod & KMOD_SHIFT ? 10.0 : 1.0;
+    switch (key.sym) {
+    case SDLK_SPACE:
+        clock.set_paused(!clock.paused());
+        break;
+    case SDLK_COMMA:
+        clock.step(-1);
+        break;
+    case SDLK_PERIOD:
+        clock.step(1);
+        break;
+    case SDLK_LEFT:
+        clock.seek(clock.position() - seek);
+        break;
+    case SDLK_RIGHT:
+        clock.seek(clock.position() + seek);
+        break;
+    case SDLK_UP:
+        change_speed(clock, 1);
+        break;
+    case SDLK_DOWN:
+        change_speed(clock, -1);
+        break;
+    case SDLK_1:
+        clock.set_speed(1.0);
+        break;
+    case SDLK_HOME:
+        clock.seek(0.0);
+        break;
+    case SDLK_END:
+        clock.seek(clock.duration());
+        break;
+    default:
+        return;
+    }
+    show_status(clock);
+}
+
+bool sdl_handle_events(PlaybackClock &clock) {
     SDL_PumpEvents();
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
         switch (e.type) {
         case SDL_QUIT:
             return false;
+        case SDL_KEYDOWN:
+            handle_key(clock, e.key.keysym);
+            break;
         default:
             break;
         }
@@ -76,6 +207,223 @@ bool sdl_handle_events() {
     return true;
 }
 
+// Get the view transform.  The camera swings from side to side as
+// the angle changes.
+glm::mat4 camera_view(float angle) {
+    return glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f)) *
+        glm::rotate(glm::mat4(1.0f),
+                    0.5f * std::sin(angle) + std::atan(1.0f) * 4.0f,
+                    glm::vec3(0.0f, 1.0f, 0.0f)) *
+        glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f));
+}
+
+// Get the camera transform, projection and view.
+glm::mat4 camera_matrix(int width, int height, float angle) {
+    float aspect = (float) width / (float) height;
+    float fovy = std::atan(1.0f); // 45 degrees
+    return glm::perspective(fovy, aspect, 0.1f, 30.0f) * camera_view(angle);
+}
+
+// Print the mean, percentiles and maximum of a set of times, in
+// seconds.  The times are sorted.
+void print_times(const char *title, std::vector<double> &times) {
+    if (times.empty()) {
+        std::printf("%-14s %9s\n", title, "n/a");
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (double t : times) {
+        sum += t;
+    }
+    auto at = [&times](double fraction) {
+        std::size_t i = static_cast<std::size_t>(fraction * times.size());
+        return times[std::min(i, times.size() - 1)] * 1000.0;
+    };
+    std::printf("%-14s %9.3f %9.3f %9.3f %9.3f %9.3f\n", title,
+                sum / times.size() * 1000.0, at(0.5), at(0.9), at(0.99),
+                times.back() * 1000.0);
+}
+
+void init_texture(GLuint texture, GLenum internal_format,
+                  int width, int height, GLenum format, GLenum type,
+                  const void *data) {
+    using namespace gl_3_3;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+                 format, type, data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Wait until the GPU has passed a fence, and delete it.  A buffer
+// must not be invalidated while the GPU may still read it, so this
+// keeps waiting after a timeout, with a warning.
+void wait_fence(GLsync fence) {
+    using namespace gl_3_3;
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+        GLenum result = glClientWaitSync(fence, flags, FENCE_TIMEOUT);
+        if (result == GL_ALREADY_SIGNALED ||
+            result == GL_CONDITION_SATISFIED) {
+            break;
+        }
+        if (result == GL_WAIT_FAILED) {
+            die("Waiting for a fence failed.");
+        }
+        std::fputs("Warning: still waiting for the GPU\n", stderr);
+        flags = 0;
+    }
+    glDeleteSync(fence);
+}
+
+// Offscreen framebuffer for --bench, with color and depth.
+class Framebuffer {
+private:
+    GLuint m_framebuffer;
+    GLuint m_renderbuffers[2];
+
+public:
+    Framebuffer(int width, int height);
+    Framebuffer(const Framebuffer &) = delete;
+    ~Framebuffer();
+    Framebuffer &operator=(const Framebuffer &) = delete;
+
+    void bind() {
+        using namespace gl_3_3;
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    }
+};
+
+Framebuffer::Framebuffer(int width, int height) {
+    using namespace gl_3_3;
+    glGenRenderbuffers(2, m_renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+    glRenderbufferStorage(
+        GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, m_renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, m_renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+        GL_FRAMEBUFFER_COMPLETE) {
+        die("Could not create framebuffer.");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+Framebuffer::~Framebuffer() {
+    using namespace gl_3_3;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &m_framebuffer);
+    glDeleteRenderbuffers(2, m_renderbuffers);
+}
+
+// Times draws on the GPU with a ring of timer queries.  Results are
+// read back when their query is reused, so the CPU does not wait for
+// the GPU.  Only frames after the warmup are recorded.
+class GpuTimer {
+private:
+    GLuint m_queries[TIMER_QUERY_COUNT];
+    int m_frames[TIMER_QUERY_COUNT];
+    bool m_enabled;
+    int m_current;
+
+    void read(int i);
+
+public:
+    /// Times of the recorded frames, in seconds.
+    std::vector<double> times;
+
+    GpuTimer();
+    GpuTimer(const GpuTimer &) = delete;
+    ~GpuTimer();
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin(int frame);
+    void end();
+
+    /// Read all results still in flight.
+    void finish();
+};
+
+GpuTimer::GpuTimer() : m_enabled(false), m_current(0) {
+    using namespace gl_3_3;
+    GLint bits = 0;
+    glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+    m_enabled = bits > 0;
+    if (m_enabled) {
+        glGenQueries(TIMER_QUERY_COUNT, m_queries);
+    } else {
+        std::fputs("No timer queries, GPU times not available.\n", stderr);
+    }
+    for (int &f : m_frames) {
+        f = -1;
+    }
+}
+
+GpuTimer::~GpuTimer() {
+    using namespace gl_3_3;
+    if (m_enabled) {
+        glDeleteQueries(TIMER_QUERY_COUNT, m_queries);
+    }
+}
+
+void GpuTimer::read(int i) {
+    using namespace gl_3_3;
+    if (m_frames[i] >= BENCH_WARMUP) {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(m_queries[i], GL_QUERY_RESULT, &ns);
+        times.push_back(ns * 1e-9);
+    }
+    m_frames[i] = -1;
+}
+
+void GpuTimer::begin(int frame) {
+    using namespace gl_3_3;
+    if (!m_enabled) {
+        return;
+    }
+    m_current = frame % TIMER_QUERY_COUNT;
+    read(m_current);
+    m_frames[m_current] = frame;
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_current]);
+}
+
+void GpuTimer::end() {
+    using namespace gl_3_3;
+    if (m_enabled) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+}
+
+void GpuTimer::finish() {
+    if (!m_enabled) {
+        return;
+    }
+    // Oldest first.
+    for (int i = 1; i <= TIMER_QUERY_COUNT; i++) {
+        read((m_current + i) % TIMER_QUERY_COUNT);
+    }
+}
+
+void print_bench_header(const char *path, int frames) {
+    using namespace gl_3_3;
+    std::printf("%s: %d frames at %dx%d, %s\n", path, frames,
+                WIDTH, HEIGHT, reinterpret_cast<const char *>(
+                    glGetString(GL_RENDERER)));
+    std::printf("%-14s %9s %9s %9s %9s %9s\n", "time (ms)",
+                "mean", "p50", "p90", "p99", "max");
+}
+
 }
 
 struct Points {
@@ -97,99 +445,535 @@ const ShaderField Points::FIELDS[] = {
 };
 #undef F
 
+// Points reprojected on the GPU from raw depth frames.
+struct DepthPoints {
+    GLint u_mvp, u_depth, u_mask, u_color, u_intrinsics;
+
+    static const ShaderField FIELDS[];
+};
+
+#define F(x) offsetof(DepthPoints, x)
+const ShaderField DepthPoints::FIELDS[] = {
+    { 0, 0 },
+
+    { "MVP", F(u_mvp) },
+    { "Depth", F(u_depth) },
+    { "Mask", F(u_mask) },
+    { "Color", F(u_color) },
+    { "Intrinsics", F(u_intrinsics) },
+    { 0, 0 }
+};
+#undef F
+
+namespace {
+
+// Make a vertex array for drawing points from a buffer.
+GLuint make_point_array(const Points &prog, GLuint buffer) {
+    using namespace gl_3_3;
+    GLuint array;
+    glGenVertexArrays(1, &array);
+    glBindVertexArray(array);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (prog.a_pos >= 0) {
+        glEnableVertexAttribArray(prog.a_pos);
+        glVertexAttribPointer(
+            prog.a_pos, 3, GL_FLOAT, GL_FALSE, sizeof(Point),
+            reinterpret_cast<const void *>(offsetof(Point, v)));
+    }
+    if (prog.a_color >= 0) {
+        glEnableVertexAttribArray(prog.a_color);
+        glVertexAttribPointer(
+            prog.a_color, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Point),
+            reinterpret_cast<const void *>(offsetof(Point, color)));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    return array;
+}
+
+// An octree node's copy on the GPU.
+struct NodeBuffer {
+    enum State {
+        // Not requested.
+        NONE,
+        // Requested from the loader.
+        REQUESTED,
+        // Read from disk, but not uploaded.
+        READY,
+        // Uploaded, with a buffer and vertex array.
+        RESIDENT
+    };
+    State state;
+    GLuint buffer;
+    GLuint array;
+    // Frame which last selected the node.
+    int last_used;
+
+    NodeBuffer() : state(NONE), buffer(0), array(0), last_used(-1) { }
+};
+
+void show_octree_status(std::size_t nodes, uint64_t points,
+                        uint64_t budget) {
+    char title[128];
+    std::snprintf(title, sizeof(title),
+                  "PCTrack - %zu nodes, %llu points, budget %llu",
+                  nodes, static_cast<unsigned long long>(points),
+                  static_cast<unsigned long long>(budget));
+    SDL_SetWindowTitle(g_window, title);
+}
+
+// Handle octree keys:
+//
+//   Up, down       double or halve the point budget
+bool octree_handle_events(uint64_t &budget) {
+    SDL_PumpEvents();
+    SDL_Event e;
+    while (SDL_PollEvent(&e)) {
+        switch (e.type) {
+        case SDL_QUIT:
+            return false;
+        case SDL_KEYDOWN:
+            if (e.key.keysym.sym == SDLK_UP) {
+                budget *= 2;
+            } else if (e.key.keysym.sym == SDLK_DOWN) {
+                budget = std::max<uint64_t>(budget / 2, 1000);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+// View an octree file.  Each frame, the nodes to draw are chosen from
+// the camera, and nodes which are not on the GPU are read on the
+// loader thread and uploaded once they are in memory.  Until then,
+// their ancestors are drawn in their place.
+void view_octree(const char *path, bool bench, int bench_frames,
+                 uint64_t budget) {
+    using namespace gl_3_3;
+    OctreeReader reader;
+    reader.open(path);
+    const std::vector<OctreeNode> &nodes = reader.nodes();
+    if (nodes.empty()) {
+        die("No points in file: %s", path);
+    }
+
+    ProgramObj<Points> prog_points;
+    if (!prog_points.load("points", "points")) {
+        die("Could not load shader program.");
+    }
+
+    std::vector<NodeBuffer> buffers(nodes.size());
+    OctreeLoader loader(reader, OCTREE_QUEUE_SIZE);
+    std::vector<uint32_t> selected, evict;
+    uint64_t resident = 0;
+
+    std::unique_ptr<Framebuffer> framebuffer;
+    std::unique_ptr<GpuTimer> timer;
+    std::vector<double> bench_select, bench_upload, bench_frame;
+    uint64_t bench_points = 0;
+    if (bench) {
+        framebuffer.reset(new Framebuffer(WIDTH, HEIGHT));
+        framebuffer->bind();
+        timer.reset(new GpuTimer);
+    }
+    int rendered = 0;
+    Clock::time_point bench_start = Clock::now();
+    Clock::time_point last_swap = Clock::now();
+    FrameTimeHistogram frame_times, upload_times;
+
+    while (bench ? rendered < bench_frames : octree_handle_events(budget)) {
+        int width = WIDTH, height = HEIGHT;
+        if (!bench) {
+            SDL_GL_GetDrawableSize(g_window, &width, &height);
+        }
+        if (bench && rendered == BENCH_WARMUP) {
+            bench_start = Clock::now();
+        }
+        bool timed = bench && rendered >= BENCH_WARMUP;
+
+        float angle = bench ?
+            rendered * (8.0f * std::atan(1.0f) / BENCH_CAMERA_PERIOD) :
+            (float) SDL_GetTicks() * 0.001f;
+        glm::mat4 mvp = camera_matrix(width, height, angle);
+        glm::vec4 eye = glm::inverse(camera_view(angle))[3];
+
+        Clock::time_point t0 = Clock::now();
+        select_octree_nodes(nodes, glm::value_ptr(mvp),
+                            glm::value_ptr(eye), budget, selected);
+        Clock::time_point t1 = Clock::now();
+
+        // Nodes are uploaded in order of priority, so coarse nodes near
+        // the camera appear first.
+        uint32_t index;
+        while (loader.ready(index)) {
+            if (buffers[index].state == NodeBuffer::REQUESTED) {
+                buffers[index].state = NodeBuffer::READY;
+            }
+        }
+        uint64_t uploaded = 0;
+        for (uint32_t i : selected) {
+            NodeBuffer &b = buffers[i];
+            b.last_used = rendered;
+            if (b.state == NodeBuffer::NONE) {
+                if (loader.request(i)) {
+                    b.state = NodeBuffer::REQUESTED;
+                }
+            } else if (b.state == NodeBuffer::READY &&
+                       uploaded < OCTREE_UPLOAD_POINTS) {
+                glGenBuffers(1, &b.buffer);
+                glBindBuffer(GL_ARRAY_BUFFER, b.buffer);
+                glBufferData(GL_ARRAY_BUFFER, nodes[i].count * sizeof(Point),
+                             reader.points(i), GL_STATIC_DRAW);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                b.array = make_point_array(*prog_points, b.buffer);
+                b.state = NodeBuffer::RESIDENT;
+                resident += nodes[i].count;
+                uploaded += nodes[i].count;
+            }
+        }
+
+        // Free the least recently used nodes once the cache is full.
+        // Nodes selected this frame are kept.
+        if (resident > budget * OCTREE_CACHE_FACTOR) {
+            evict.clear();
+            for (std::size_t i = 0; i < buffers.size(); i++) {
+                if (buffers[i].state == NodeBuffer::RESIDENT &&
+                    buffers[i].last_used != rendered) {
+                    evict.push_back(i);
+                }
+            }
+            std::sort(evict.begin(), evict.end(),
+                      [&buffers](uint32_t a, uint32_t b) {
+                          return buffers[a].last_used < buffers[b].last_used;
+                      });
+            for (uint32_t i : evict) {
+                if (resident <= budget * OCTREE_CACHE_FACTOR) {
+                    break;
+                }
+                NodeBuffer &b = buffers[i];
+                glDeleteVertexArrays(1, &b.array);
+                glDeleteBuffers(1, &b.buffer);
+                b.array = 0;
+                b.buffer = 0;
+                b.state = NodeBuffer::NONE;
+                resident -= nodes[i].count;
+            }
+        }
+        Clock::time_point t2 = Clock::now();
+        if (uploaded) {
+            upload_times.add(seconds(t2 - t1));
+        }
+
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_TEST);
+        glPointSize(3.0f);
+        const auto &prog = prog_points;
+        glUseProgram(prog.prog());
+        glUniformMatrix4fv(prog->u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+        if (timer) {
+            timer->begin(rendered);
+        }
+        std::size_t drawn_nodes = 0;
+        uint64_t drawn_points = 0;
+        for (uint32_t i : selected) {
+            const NodeBuffer &b = buffers[i];
+            if (b.state == NodeBuffer::RESIDENT) {
+                glBindVertexArray(b.array);
+                glDrawArrays(GL_POINTS, 0, nodes[i].count);
+                drawn_nodes++;
+                drawn_points += nodes[i].count;
+            }
+        }
+        if (timer) {
+            timer->end();
+        }
+        glBindVertexArray(0);
+
+        {
+            GLenum err;
+            while ((err = glGetError())) {
+                std::fprintf(stderr, "OpenGL error: 0x%04x\n", err);
+            }
+        }
+
+        if (!bench) {
+            show_octree_status(drawn_nodes, drawn_points, budget);
+            SDL_GL_SwapWindow(g_window);
+        } else {
+            glFinish();
+        }
+        Clock::time_point swap = Clock::now();
+        frame_times.add(seconds(swap - last_swap));
+        if (timed) {
+            bench_select.push_back(seconds(t1 - t0));
+            bench_upload.push_back(seconds(t2 - t1));
+            bench_frame.push_back(seconds(swap - last_swap));
+            bench_points += drawn_points;
+        }
+        last_swap = swap;
+        rendered++;
+    }
+
+    if (bench) {
+        glFinish();
+        double wall = seconds(Clock::now() - bench_start);
+        timer->finish();
+        int timed = std::max(rendered - BENCH_WARMUP, 0);
+        print_bench_header(path, timed);
+        print_times("select (CPU)", bench_select);
+        print_times("upload (CPU)", bench_upload);
+        print_times("draw (GPU)", timer->times);
+        print_times("frame", bench_frame);
+        if (timed && wall > 0.0) {
+            std::printf("%.1f frames/s, %.0f points/frame\n",
+                        timed / wall, (double) bench_points / timed);
+        }
+    }
+
+    for (NodeBuffer &b : buffers) {
+        if (b.state == NodeBuffer::RESIDENT) {
+            glDeleteVertexArrays(1, &b.array);
+            glDeleteBuffers(1, &b.buffer);
+        }
+    }
+    if (!bench) {
+        upload_times.print("Upload time");
+        frame_times.print("Frame time");
+    }
+}
+
+}
 
 int main(int argc, char *argv[]) {
     using namespace gl_3_3;
-    if (argc < 2) {
-        die("Usage: pcvis FILE");
+    bool sync = false, bench = false;
+    int bench_frames = BENCH_FRAMES;
+    uint64_t budget = OCTREE_BUDGET;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--sync") {
+            sync = true;
+        } else if (arg == "--bench") {
+            bench = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            bench_frames = std::stoi(argv[++i]);
+            if (bench_frames < 1) {
+                die("Frame count must be positive.");
+            }
+        } else if (arg == "--budget" && i + 1 < argc) {
+            long long n = std::stoll(argv[++i]);
+            if (n < 1) {
+                die("Point budget must be positive.");
+            }
+            budget = n;
+        } else {
+            args.push_back(argv[i]);
+        }
     }
-    if (argc >= 3) {
-        Shader::set_search_path(argv[2]);
+    if (args.empty() || args.size() > 2) {
+        die("Usage: pcvis [--sync] [--budget N] [--bench [--frames N]] "
+            "FILE [SHADER_DIR]");
+    }
+    if (args.size() >= 2) {
+        Shader::set_search_path(args[1]);
     }
 
-    sdl_init();
+    sdl_init(bench);
     if (sggl_init()) {
         die("Could not load OpenGL functions");
     }
 
-    {
-        std::ifstream fp;
-        fp.open(argv[1]);
-        if (!fp.good()) {
-            die("Could not open file: %s", argv[1]);
+    if (is_octree_file(args[0])) {
+        view_octree(args[0], bench, bench_frames, budget);
+    } else {
+        PointFileReader fp;
+        fp.open(args[0]);
+        if (!fp.frame_count()) {
+            die("No frames in file: %s", args[0]);
+        }
+        const PointFileHeader &header = fp.header();
+        std::size_t capacity = header.width * header.height;
+
+        // Raw depth frames are keyed by a FrameReader, the same way as
+        // in the other tools, and the depth, foreground mask and RGB
+        // images are uploaded as textures and reprojected in the vertex
+        // shader, with one vertex per pixel.
+        bool depth_mode = fp.frame_header(0).encoding == FRAME_DEPTH_RGB;
+        FrameReader keyer;
+        GLuint textures[3];
+        glGenTextures(3, textures);
+        if (depth_mode) {
+            keyer.open(args[0]);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            init_texture(textures[0], GL_R16UI, header.width, header.height,
+                         GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+            init_texture(textures[1], GL_R8UI, header.width, header.height,
+                         GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+            init_texture(textures[2], GL_RGB8, header.width, header.height,
+                         GL_RGB, GL_UNSIGNED_BYTE, nullptr);
         }
 
-        GLuint buffer;
-        glGenBuffers(1, &buffer);
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, 640 * 480 * 16, nullptr,
-                     GL_STREAM_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // Frames are uploaded through a ring of buffers.  Each buffer
+        // is mapped without synchronization after waiting on the fence
+        // from its last use, so the driver never stalls on a buffer
+        // which the GPU is still reading.  Raw depth frames use the
+        // buffers as pixel unpack buffers for the textures.
+        int ring_size = sync ? 1 : UPLOAD_BUFFER_COUNT;
+        GLenum target = depth_mode ? GL_PIXEL_UNPACK_BUFFER : GL_ARRAY_BUFFER;
+        std::size_t buffer_size = depth_mode ?
+            capacity * (sizeof(unsigned short) + 4) : capacity * sizeof(Point);
+        std::vector<UploadBuffer> ring(ring_size);
+        for (UploadBuffer &b : ring) {
+            glGenBuffers(1, &b.buffer);
+            glBindBuffer(target, b.buffer);
+            glBufferData(target, buffer_size, nullptr, GL_STREAM_DRAW);
+            glBindBuffer(target, 0);
+            b.fence = 0;
+        }
 
         ProgramObj<Points> prog_points;
-        GLuint arr;
-        if (!prog_points.load("points", "points")) {
+        ProgramObj<DepthPoints> prog_depth;
+        GLuint depth_arr;
+        if (!prog_points.load("points", "points") ||
+            (depth_mode && !prog_depth.load("depth", "points"))) {
             die("Could not load shader program.");
         }
-        glGenVertexArrays(1, &arr);
+        glGenVertexArrays(1, &depth_arr);
 
-        {
-            const auto &prog = *prog_points;
-            glBindVertexArray(arr);
-            glBindBuffer(GL_ARRAY_BUFFER, buffer);
-            if (prog.a_pos >= 0) {
-                glEnableVertexAttribArray(prog.a_pos);
-                glVertexAttribPointer(
-                    prog.a_pos, 3, GL_FLOAT, GL_FALSE, 16,
-                    reinterpret_cast<const void *>(0));
-            }
-            if (prog.a_color >= 0) {
-                glEnableVertexAttribArray(prog.a_color);
-                glVertexAttribPointer(
-                    prog.a_color, 3, GL_UNSIGNED_BYTE, GL_TRUE, 16,
-                    reinterpret_cast<const void *>(12));
-            }
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glBindVertexArray(0);
+        for (UploadBuffer &b : ring) {
+            b.array = make_point_array(*prog_points, b.buffer);
         }
 
+        std::unique_ptr<FramePrefetcher> prefetcher;
+        if (!sync) {
+            prefetcher.reset(new FramePrefetcher(fp, PREFETCH_FRAMES));
+        }
+        FrameTimeHistogram frame_times, upload_times;
+        Clock::time_point last_swap = Clock::now();
+
+        // In benchmark mode, frames are drawn offscreen in file order,
+        // as fast as possible, with a camera which moves with the frame
+        // count rather than the clock.  The draw is timed on the GPU
+        // with timer queries, if the driver has them.
+        std::unique_ptr<Framebuffer> framebuffer;
+        std::unique_ptr<GpuTimer> timer;
+        std::vector<double> bench_upload, bench_frame;
+        if (bench) {
+            framebuffer.reset(new Framebuffer(WIDTH, HEIGHT));
+            framebuffer->bind();
+            timer.reset(new GpuTimer);
+        }
+        int rendered = 0;
+        Clock::time_point bench_start = Clock::now();
+
+        // Playback follows the device timestamps.  Only the frame at
+        // the current position is decoded, so frames in between are
+        // skipped when playing fast.
+        PlaybackClock clock(fp.index(), header.timestamp_rate);
+        show_status(clock);
+        Clock::time_point last_tick = Clock::now();
+
         int point_count = 0;
-        double frame_time = 0.0;
-        while (sdl_handle_events()) {
-            int width, height;
-            SDL_GL_GetDrawableSize(g_window, &width, &height);
+        int current = 0, next = 0;
+        bool loaded = false;
+        std::size_t shown = 0;
+        while (bench ? rendered < bench_frames : sdl_handle_events(clock)) {
+            int width = WIDTH, height = HEIGHT;
+            if (!bench) {
+                SDL_GL_GetDrawableSize(g_window, &width, &height);
+            }
 
-            double new_time = SDL_GetTicks() * 0.001;
-            if (point_count == 0 || new_time - frame_time >= 1.0 / 30.0) {
-                int count = 0;
-                fp.read(reinterpret_cast<char *>(&count), sizeof(count));
-                if (fp.eof()) {
-                    fp.clear();
-                    fp.seekg(0, fp.beg);
-                    fp.read(reinterpret_cast<char *>(&count), sizeof(count));
+            Clock::time_point tick = Clock::now();
+            clock.advance(seconds(tick - last_tick));
+            last_tick = tick;
+            if (bench && rendered == BENCH_WARMUP) {
+                bench_start = tick;
+            }
+            std::size_t frame = bench ?
+                rendered % fp.frame_count() : clock.frame();
+            if (!loaded || frame != shown) {
+                Clock::time_point t0 = Clock::now();
+                UploadBuffer &b = ring[next];
+                if (b.fence) {
+                    wait_fence(b.fence);
+                    b.fence = 0;
+                }
+                GLbitfield access =
+                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+                if (!sync) {
+                    access |= GL_MAP_UNSYNCHRONIZED_BIT;
+                }
+                glBindBuffer(target, b.buffer);
+                void *ptr = glMapBufferRange(target, 0, buffer_size, access);
+                if (!ptr) {
+                    die("Could not map buffer.");
                 }
-                if (fp.good() && count > 0) {
-                    assert(count <= 640 * 480);
-                    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-                    if (true) {
-                        void *ptr = glMapBuffer(
-                            GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-                        assert(ptr != nullptr);
-                        fp.read(static_cast<char *>(ptr), count * 16);
-                        if (!fp.good()) {
-                            die("Could not read data.");
-                        }
-                        glUnmapBuffer(GL_ARRAY_BUFFER);
+                if (depth_mode) {
+                    // The background model follows the frames shown.
+                    // Going back starts it again from the depth key.
+                    if (frame < keyer.position()) {
+                        keyer.seek(frame);
                     } else {
-                        std::vector<char> data(count * 16);
-                        fp.read(data.data(), count * 16);
-                        glBufferSubData(GL_ARRAY_BUFFER,
-                                        0, count * 16, data.data());
+                        keyer.skip(frame);
                     }
-                    glBindBuffer(GL_ARRAY_BUFFER, 0);
-                    point_count = count;
+                    keyer.next_depth();
+                    std::size_t depth_bytes =
+                        capacity * sizeof(unsigned short);
+                    unsigned char *dp = static_cast<unsigned char *>(ptr);
+                    std::memcpy(dp, keyer.depth(), depth_bytes);
+                    std::memcpy(dp + depth_bytes, keyer.mask(), capacity);
+                    std::memcpy(dp + depth_bytes + capacity, keyer.color(),
+                                capacity * 3);
+                    glUnmapBuffer(target);
+                    glBindTexture(GL_TEXTURE_2D, textures[0]);
+                    glTexSubImage2D(
+                        GL_TEXTURE_2D, 0, 0, 0, header.width, header.height,
+                        GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+                    glBindTexture(GL_TEXTURE_2D, textures[1]);
+                    glTexSubImage2D(
+                        GL_TEXTURE_2D, 0, 0, 0, header.width, header.height,
+                        GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void *>(depth_bytes));
+                    glBindTexture(GL_TEXTURE_2D, textures[2]);
+                    glTexSubImage2D(
+                        GL_TEXTURE_2D, 0, 0, 0, header.width, header.height,
+                        GL_RGB, GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void *>(
+                            depth_bytes + capacity));
+                    glBindTexture(GL_TEXTURE_2D, 0);
+                    point_count = capacity;
+                } else {
+                    point_count = fp.read_frame(
+                        frame, static_cast<Point *>(ptr), capacity);
+                    glUnmapBuffer(target);
+                }
+                glBindBuffer(target, 0);
+                current = next;
+                next = (next + 1) % ring_size;
+                if (prefetcher) {
+                    // Read ahead at the rate playback is advancing.
+                    std::size_t n = fp.frame_count();
+                    std::size_t stride = (frame + n - shown) % n;
+                    if (!loaded || stride > n / 2) {
+                        stride = 1;
+                    }
+                    prefetcher->set_frame((frame + stride) % n, stride);
+                }
+                shown = frame;
+                loaded = true;
+                if (!bench) {
+                    show_status(clock);
+                }
+                upload_times.add(seconds(Clock::now() - t0));
+                if (bench && rendered >= BENCH_WARMUP) {
+                    bench_upload.push_back(seconds(Clock::now() - t0));
                 }
-                frame_time = new_time;
             }
 
             glViewport(0, 0, width, height);
@@ -197,29 +981,50 @@ int main(int argc, char *argv[]) {
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
             {
-                const auto &prog = prog_points;
-                glUseProgram(prog.prog());
-                glBindVertexArray(arr);
-                glEnable(GL_DEPTH_TEST);
+                float angle = bench ?
+                    rendered * (8.0f * std::atan(1.0f) / BENCH_CAMERA_PERIOD) :
+                    (float) SDL_GetTicks() * 0.001f;
+                glm::mat4 mvp = camera_matrix(width, height, angle);
 
-                float aspect = (float) width / (float) height;
-                float fovy = std::atan(1.0f); // 45 degrees
-                glm::mat4 mvp =
-                    glm::perspective(fovy, aspect, 0.1f, 30.0f) *
-                    glm::translate(glm::mat4(1.0f),
-                                   glm::vec3(0.0f, 0.0f, -3.0f)) *
-                    glm::rotate(
-                        glm::mat4(1.0f),
-                        0.5f * std::sin((float) SDL_GetTicks() * 0.001f) +
-                        std::atan(1.0f) * 4.0f,
-                        glm::vec3(0.0f, 1.0f, 0.0f)) *
-                    glm::translate(glm::mat4(1.0f),
-                                   glm::vec3(0.0f, 0.0f, -2.0f));
-                glUniformMatrix4fv(
-                    prog->u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+                if (depth_mode) {
+                    const auto &prog = prog_depth;
+                    glUseProgram(prog.prog());
+                    glBindVertexArray(depth_arr);
+                    glUniformMatrix4fv(
+                        prog->u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+                    for (int i = 0; i < 3; i++) {
+                        glActiveTexture(GL_TEXTURE0 + i);
+                        glBindTexture(GL_TEXTURE_2D, textures[i]);
+                    }
+                    glActiveTexture(GL_TEXTURE0);
+                    glUniform1i(prog->u_depth, 0);
+                    glUniform1i(prog->u_mask, 1);
+                    glUniform1i(prog->u_color, 2);
+                    glUniform4f(prog->u_intrinsics,
+                                header.fx, header.fy, header.cx, header.cy);
+                } else {
+                    const auto &prog = prog_points;
+                    glUseProgram(prog.prog());
+                    glBindVertexArray(ring[current].array);
+                    glUniformMatrix4fv(
+                        prog->u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+                }
 
+                glEnable(GL_DEPTH_TEST);
                 glPointSize(3.0f);
+                if (timer) {
+                    timer->begin(rendered);
+                }
                 glDrawArrays(GL_POINTS, 0, point_count);
+                if (timer) {
+                    timer->end();
+                }
+
+                UploadBuffer &b = ring[current];
+                if (b.fence) {
+                    glDeleteSync(b.fence);
+                }
+                b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
             }
 
             {
@@ -229,7 +1034,44 @@ int main(int argc, char *argv[]) {
                 }
             }
 
-            SDL_GL_SwapWindow(g_window);
+            // Without a swap, nothing waits for the GPU, so the frame
+            // time would only cover queueing the commands.
+            if (!bench) {
+                SDL_GL_SwapWindow(g_window);
+            } else {
+                glFinish();
+            }
+            Clock::time_point swap = Clock::now();
+            frame_times.add(seconds(swap - last_swap));
+            if (bench && rendered >= BENCH_WARMUP) {
+                bench_frame.push_back(seconds(swap - last_swap));
+            }
+            last_swap = swap;
+            rendered++;
+        }
+
+        if (bench) {
+            glFinish();
+            double wall = seconds(Clock::now() - bench_start);
+            timer->finish();
+            int timed = std::max(rendered - BENCH_WARMUP, 0);
+            print_bench_header(args[0], timed);
+            print_times("upload (CPU)", bench_upload);
+            print_times("draw (GPU)", timer->times);
+            print_times("frame", bench_frame);
+            if (timed && wall > 0.0) {
+                std::printf("%.1f frames/s\n", timed / wall);
+            }
+        }
+
+        for (UploadBuffer &b : ring) {
+            if (b.fence) {
+                glDeleteSync(b.fence);
+            }
+        }
+        if (!bench) {
+            upload_times.print("Upload time");
+            frame_times.print("Frame time");
         }
     }
 
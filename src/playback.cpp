@@ -0,0 +1,175 @@
+#include "playback.hpp"
+#include "pcfile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+const double PlaybackClock::MIN_SPEED = 0.1;
+const double PlaybackClock::MAX_SPEED = 16.0;
+
+PlaybackClock::PlaybackClock(const std::vector<IndexEntry> &index,
+                             uint64_t timestamp_rate)
+    : m_duration(0.0), m_position(0.0), m_speed(1.0), m_paused(false) {
+    // Timestamps which go backwards are treated as repeats of the
+    // previous timestamp.  This includes timestamps before the first
+    // frame's, so the difference must not wrap around.
+    double scale = 1.0 / static_cast<double>(timestamp_rate);
+    double last = 0.0;
+    m_times.reserve(index.size());
+    for (const IndexEntry &e : index) {
+        uint64_t ts = std::max(e.timestamp, index[0].timestamp);
+        double t = static_cast<double>(ts - index[0].timestamp);
+        last = std::max(last, t * scale);
+        m_times.push_back(last);
+    }
+    // Show the last frame for one average frame period.
+    if (m_times.size() > 1) {
+        m_duration = last + last / (m_times.size() - 1);
+    }
+}
+
+void PlaybackClock::advance(double time) {
+    if (m_paused || m_duration <= 0.0) {
+        return;
+    }
+    m_position = std::fmod(m_position + time * m_speed, m_duration);
+}
+
+std::size_t PlaybackClock::frame() const {
+    if (m_times.empty()) {
+        return 0;
+    }
+    std::size_t i = std::upper_bound(
+        m_times.begin(), m_times.end(), m_position) - m_times.begin();
+    return i ? i - 1 : 0;
+}
+
+void PlaybackClock::seek(double position) {
+    if (m_duration <= 0.0) {
+        return;
+    }
+    // Seeking to the end shows the last frame.
+    m_position = std::min(std::max(position, 0.0),
+                          m_times.empty() ? 0.0 : m_times.back());
+}
+
+void PlaybackClock::seek_frame(std::size_t frame) {
+    if (frame < m_times.size()) {
+        m_position = m_times[frame];
+    }
+}
+
+void PlaybackClock::step(int count) {
+    m_paused = true;
+    long n = static_cast<long>(m_times.size());
+    if (!n) {
+        return;
+    }
+    long frame = static_cast<long>(this->frame()) + count;
+    seek_frame(static_cast<std::size_t>(((frame % n) + n) % n));
+}
+
+void PlaybackClock::set_speed(double speed) {
+    m_speed = std::min(std::max(speed, MIN_SPEED), MAX_SPEED);
+}
+
+FramePrefetcher::FramePrefetcher(const PointFileReader &reader,
+                                 std::size_t depth)
+    : m_reader(reader), m_depth(depth), m_frame(0), m_stride(1),
+      m_stop(false) {
+    m_thread = std::thread(&FramePrefetcher::run, this);
+}
+
+FramePrefetcher::~FramePrefetcher() {
+    m_stop.store(true);
+    m_thread.join();
+}
+
+void FramePrefetcher::run() {
+    std::size_t n = m_reader.frame_count();
+    if (!n) {
+        return;
+    }
+    std::size_t depth = std::min(m_depth, n);
+    // Frames base + i * stride for i in [0, done) have been touched,
+    // modulo n.
+    std::size_t base = 0, stride = 1, done = 0;
+    while (!m_stop.load()) {
+        std::size_t new_stride = m_stride.load();
+        std::size_t frame = m_frame.load();
+        if (new_stride != stride) {
+            done = 0;
+            stride = new_stride;
+        }
+        if (frame != base) {
+            std::size_t ahead = (frame + n - base) % n;
+            done = ahead % stride == 0 && ahead / stride < done ?
+                done - ahead / stride : 0;
+            base = frame;
+        }
+        if (done < depth) {
+            m_reader.prefetch((base + done * stride) % n);
+            done++;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+FrameTimeHistogram::FrameTimeHistogram(double max_time, int bin_count)
+    : m_bins(bin_count), m_bin_width(max_time / bin_count),
+      m_count(0), m_sum(0.0), m_max(0.0) {}
+
+void FrameTimeHistogram::add(double time) {
+    std::size_t bin = static_cast<std::size_t>(
+        std::max(time, 0.0) / m_bin_width);
+    m_bins[std::min(bin, m_bins.size() - 1)]++;
+    m_count++;
+    m_sum += time;
+    m_max = std::max(m_max, time);
+}
+
+double FrameTimeHistogram::percentile(double fraction) const {
+    if (!m_count) {
+        return 0.0;
+    }
+    // Use the upper edge of the bin containing the percentile.
+    double target = fraction * m_count;
+    unsigned total = 0;
+    for (std::size_t i = 0; i < m_bins.size(); i++) {
+        total += m_bins[i];
+        if (total >= target && m_bins[i]) {
+            return std::min((i + 1) * m_bin_width, m_max);
+        }
+    }
+    return m_max;
+}
+
+void FrameTimeHistogram::print(const char *title) const {
+    std::fprintf(stderr, "%s: %u frames\n", title, m_count);
+    if (!m_count) {
+        return;
+    }
+    const int BAR_WIDTH = 50;
+    unsigned peak = *std::max_element(m_bins.begin(), m_bins.end());
+    for (std::size_t i = 0; i < m_bins.size(); i++) {
+        if (!m_bins[i]) {
+            continue;
+        }
+        int len = static_cast<int>(
+            (static_cast<double>(m_bins[i]) * BAR_WIDTH + peak - 1) / peak);
+        std::fprintf(stderr, "  %5.1f ms%s %7u %.*s\n",
+                     i * m_bin_width * 1000.0,
+                     i + 1 == m_bins.size() ? "+" : " ",
+                     m_bins[i], len,
+                     "##################################################");
+    }
+    std::fprintf(stderr,
+                 "  mean %.2f ms, p50 %.2f ms, p95 %.2f ms, "
+                 "p99 %.2f ms, max %.2f ms\n",
+                 m_sum / m_count * 1000.0, percentile(0.5) * 1000.0,
+                 percentile(0.95) * 1000.0, percentile(0.99) * 1000.0,
+                 m_max * 1000.0);
+}
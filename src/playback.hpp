@@ -0,0 +1,117 @@
+#ifndef PCTRACK_PLAYBACK_HPP
+#define PCTRACK_PLAYBACK_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+class PointFileReader;
+struct IndexEntry;
+
+/// Maps wall time to a position in a capture, using the recorded
+/// device timestamps.  Positions are in seconds from the first frame.
+/// Playback loops at the end of the capture.
+class PlaybackClock {
+private:
+    std::vector<double> m_times;
+    double m_duration;
+    double m_position;
+    double m_speed;
+    bool m_paused;
+
+public:
+    /// Playback speed limits.
+    static const double MIN_SPEED, MAX_SPEED;
+
+    PlaybackClock(const std::vector<IndexEntry> &index,
+                  uint64_t timestamp_rate);
+
+    /// Advance by an amount of wall time, in seconds.
+    void advance(double time);
+
+    /// Get the frame which is shown at the current position.
+    std::size_t frame() const;
+
+    /// Get the number of frames.
+    std::size_t frame_count() const { return m_times.size(); }
+
+    /// Seek to a position, in seconds.  Positions past either end are
+    /// clamped.
+    void seek(double position);
+
+    /// Seek to the start of a frame.
+    void seek_frame(std::size_t frame);
+
+    /// Pause, and move forward or backward by a number of frames.
+    void step(int count);
+
+    /// Set the playback speed, which is clamped to the limits.
+    void set_speed(double speed);
+
+    double speed() const { return m_speed; }
+    double position() const { return m_position; }
+    double duration() const { return m_duration; }
+    bool paused() const { return m_paused; }
+    void set_paused(bool paused) { m_paused = paused; }
+};
+
+/// Reads ahead of playback on a background thread, by touching the
+/// mapped pages of the frames after the current one.  This keeps disk
+/// reads off the render thread.
+class FramePrefetcher {
+private:
+    const PointFileReader &m_reader;
+    std::size_t m_depth;
+    std::atomic<std::size_t> m_frame;
+    std::atomic<std::size_t> m_stride;
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+
+    void run();
+
+public:
+    /// Create a prefetcher which keeps the given number of frames
+    /// ahead of playback in memory.
+    FramePrefetcher(const PointFileReader &reader, std::size_t depth);
+    FramePrefetcher(const FramePrefetcher &) = delete;
+    ~FramePrefetcher();
+    FramePrefetcher &operator=(const FramePrefetcher &) = delete;
+
+    /// Set the frame which is about to be shown, and the number of
+    /// frames which playback advances between frames which are shown.
+    void set_frame(std::size_t frame, std::size_t stride = 1) {
+        m_stride.store(stride < 1 ? 1 : stride);
+        m_frame.store(frame);
+    }
+};
+
+/// Histogram of frame times, with fixed-width bins.  Times past the
+/// last bin are counted in the last bin.
+class FrameTimeHistogram {
+private:
+    std::vector<unsigned> m_bins;
+    double m_bin_width;
+    unsigned m_count;
+    double m_sum, m_max;
+
+public:
+    /// Create a histogram with bins covering [0, max_time) seconds.
+    explicit FrameTimeHistogram(double max_time = 0.05, int bin_count = 50);
+
+    /// Add a time, in seconds.
+    void add(double time);
+
+    /// Get the number of times added.
+    unsigned count() const { return m_count; }
+
+    /// Get an approximate percentile, in seconds.  The fraction is
+    /// from 0 to 1.
+    double percentile(double fraction) const;
+
+    /// Print the histogram and summary statistics to stderr.
+    void print(const char *title) const;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef PCTRACK_POINT_HPP
+#define PCTRACK_POINT_HPP
+
+/// A point in a point cloud.  This is the layout used on disk and in
+/// OpenGL vertex buffers.
+struct Point {
+    // Location in space, in meters.
+    float v[3];
+    // Color, RGB0.
+    unsigned color;
+};
+
+static_assert(sizeof(Point) == 16, "Point must be 16 bytes");
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef PCTRACK_RING_HPP
+#define PCTRACK_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/// Bounded lock-free queue with a single producer and a single
+/// consumer.  The capacity is rounded up to a power of two.
+template<class T>
+class SpscRing {
+private:
+    std::vector<T> m_data;
+    std::size_t m_mask;
+    // Keep the producer and consumer indexes on separate cache lines.
+    char m_pad0[64];
+    std::atomic<std::size_t> m_head;
+    char m_pad1[64];
+    std::atomic<std::size_t> m_tail;
+    char m_pad2[64];
+
+public:
+    explicit SpscRing(std::size_t capacity);
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    /// Add an item to the queue.  Returns false if the queue is full.
+    /// Only call this from the producer thread.
+    bool push(const T &item);
+
+    /// Remove an item from the queue.  Returns false if the queue is
+    /// empty.  Only call this from the consumer thread.
+    bool pop(T &item);
+
+    /// Get the number of items in the queue.  This is only a snapshot
+    /// if called while other threads use the queue.
+    std::size_t size() const;
+
+    std::size_t capacity() const { return m_data.size(); }
+};
+
+template<class T>
+SpscRing<T>::SpscRing(std::size_t capacity) : m_head(0), m_tail(0) {
+    std::size_t n = 1;
+    while (n < capacity) {
+        n *= 2;
+    }
+    m_data.resize(n);
+    m_mask = n - 1;
+}
+
+template<class T>
+bool SpscRing<T>::push(const T &item) {
+    std::size_t tail = m_tail.load(std::memory_order_relaxed);
+    std::size_t head = m_head.load(std::memory_order_acquire);
+    if (tail - head >= m_data.size()) {
+        return false;
+    }
+    m_data[tail & m_mask] = item;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T>
+bool SpscRing<T>::pop(T &item) {
+    std::size_t head = m_head.load(std::memory_order_relaxed);
+    std::size_t tail = m_tail.load(std::memory_order_acquire);
+    if (head == tail) {
+        return false;
+    }
+    item = m_data[head & m_mask];
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T>
+std::size_t SpscRing<T>::size() const {
+    return m_tail.load(std::memory_order_acquire) -
+        m_head.load(std::memory_order_acquire);
+}
+
+#endif
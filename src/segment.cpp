@@ -0,0 +1,221 @@
+#include "segment.hpp"
+#include "convert.hpp"
+#include "defs.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+SegmentConfig default_segment_config() {
+    SegmentConfig cfg;
+    cfg.max_step = 10.0f;
+    cfg.min_pixels = 100;
+    return cfg;
+}
+
+Segmenter::Segmenter(const RayTable &rays, const SegmentConfig &cfg)
+    : m_rays(rays), m_cfg(cfg),
+      m_label(static_cast<std::size_t>(rays.width) * rays.height),
+      m_step_scale(cfg.max_step * 1e-6) {}
+
+uint32_t Segmenter::find(uint32_t label) {
+    // Path halving.
+    while (m_parent[label] != label) {
+        m_parent[label] = m_parent[m_parent[label]];
+        label = m_parent[label];
+    }
+    return label;
+}
+
+// Join two components, keeping the lower label as the root so that
+// the result does not depend on the order of joins.
+uint32_t Segmenter::join(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+        return a;
+    }
+    if (b < a) {
+        std::swap(a, b);
+    }
+    m_parent[b] = a;
+    Moments &ma = m_moments[a];
+    const Moments &mb = m_moments[b];
+    ma.n += mb.n;
+    for (int i = 0; i < 3; i++) {
+        ma.s[i] += mb.s[i];
+        ma.min[i] = std::min(ma.min[i], mb.min[i]);
+        ma.max[i] = std::max(ma.max[i], mb.max[i]);
+    }
+    for (int i = 0; i < 6; i++) {
+        ma.ss[i] += mb.ss[i];
+    }
+    ma.x0 = std::min(ma.x0, mb.x0);
+    ma.y0 = std::min(ma.y0, mb.y0);
+    ma.x1 = std::max(ma.x1, mb.x1);
+    ma.y1 = std::max(ma.y1, mb.y1);
+    return a;
+}
+
+void Segmenter::segment(const unsigned short *depth,
+                        const unsigned char *mask,
+                        std::vector<Blob> &blobs) {
+    int w = m_rays.width, h = m_rays.height;
+    const float *rx = m_rays.x.data(), *ry = m_rays.y.data();
+    uint32_t *label = m_label.data();
+    // Label zero is the background.
+    m_parent.assign(1, 0);
+    m_moments.resize(1);
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int k = y * w + x;
+            int d = depth[k];
+            if (!mask[k] || !d) {
+                label[k] = 0;
+                continue;
+            }
+
+            // Join with the pixels to the left and above.
+            int step = static_cast<int>(m_step_scale * d * d);
+            uint32_t l = 0;
+            if (x > 0 && label[k - 1] &&
+                std::abs(d - depth[k - 1]) <= step) {
+                l = find(label[k - 1]);
+            }
+            if (y > 0 && label[k - w] &&
+                std::abs(d - depth[k - w]) <= step) {
+                l = l ? join(l, label[k - w]) : find(label[k - w]);
+            }
+            if (!l) {
+                l = static_cast<uint32_t>(m_parent.size());
+                m_parent.push_back(l);
+                m_moments.emplace_back();
+                Moments &m = m_moments.back();
+                m.n = 0.0;
+                std::fill(m.s, m.s + 3, 0.0);
+                std::fill(m.ss, m.ss + 6, 0.0);
+                std::fill(m.min, m.min + 3, 1e30f);
+                std::fill(m.max, m.max + 3, -1e30f);
+                m.x0 = m.x1 = x;
+                m.y0 = m.y1 = y;
+            }
+            label[k] = l;
+
+            float z = 0.001f * static_cast<float>(d);
+            float p[3] = { z * rx[k], z * ry[k], z };
+            Moments &m = m_moments[l];
+            m.n += 1.0;
+            for (int i = 0; i < 3; i++) {
+                m.s[i] += p[i];
+                m.min[i] = std::min(m.min[i], p[i]);
+                m.max[i] = std::max(m.max[i], p[i]);
+            }
+            m.ss[0] += p[0] * p[0];
+            m.ss[1] += p[0] * p[1];
+            m.ss[2] += p[0] * p[2];
+            m.ss[3] += p[1] * p[1];
+            m.ss[4] += p[1] * p[2];
+            m.ss[5] += p[2] * p[2];
+            m.x0 = std::min(m.x0, x);
+            m.x1 = std::max(m.x1, x);
+            m.y1 = y;
+        }
+    }
+
+    // Order the components by decreasing size.
+    m_roots.clear();
+    m_blob.assign(m_parent.size(), -1);
+    for (uint32_t l = 1; l < m_parent.size(); l++) {
+        if (m_parent[l] == l && m_moments[l].n >= m_cfg.min_pixels) {
+            m_roots.push_back(l);
+        }
+    }
+    std::stable_sort(m_roots.begin(), m_roots.end(),
+                     [this](uint32_t a, uint32_t b) {
+                         return m_moments[a].n > m_moments[b].n;
+                     });
+
+    static const int ROW[6] = { 0, 0, 0, 1, 1, 2 };
+    static const int COL[6] = { 0, 1, 2, 1, 2, 2 };
+    blobs.resize(m_roots.size());
+    for (std::size_t j = 0; j < m_roots.size(); j++) {
+        const Moments &m = m_moments[m_roots[j]];
+        Blob &b = blobs[j];
+        m_blob[m_roots[j]] = static_cast<int>(j);
+        b.pixel_count = static_cast<unsigned>(m.n);
+        double mean[3];
+        for (int i = 0; i < 3; i++) {
+            mean[i] = m.s[i] / m.n;
+            b.centroid[i] = static_cast<float>(mean[i]);
+            b.min[i] = m.min[i];
+            b.max[i] = m.max[i];
+        }
+        for (int i = 0; i < 6; i++) {
+            b.covariance[i] = static_cast<float>(
+                m.ss[i] / m.n - mean[ROW[i]] * mean[COL[i]]);
+        }
+        b.x0 = m.x0;
+        b.y0 = m.y0;
+        b.x1 = m.x1;
+        b.y1 = m.y1;
+    }
+}
+
+void Segmenter::labels(std::vector<int> &out) {
+    out.resize(m_label.size());
+    for (std::size_t k = 0; k < m_label.size(); k++) {
+        out[k] = m_label[k] ? m_blob[find(m_label[k])] : -1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// BlobWriter
+
+BlobWriter::BlobWriter() : m_fp(nullptr) {}
+
+BlobWriter::~BlobWriter() {
+    if (m_fp) {
+        std::fclose(m_fp);
+    }
+}
+
+void BlobWriter::open(const std::string &path) {
+    m_fp = std::fopen(path.c_str(), "w");
+    if (!m_fp) {
+        die("Could not open file: %s", path.c_str());
+    }
+    m_path = path;
+    std::fputs("timestamp,blob,pixels,x,y,z,min_x,min_y,min_z,"
+               "max_x,max_y,max_z,cov_xx,cov_xy,cov_xz,cov_yy,cov_yz,"
+               "cov_zz,x0,y0,x1,y1\n", m_fp);
+}
+
+void BlobWriter::write(uint64_t timestamp, const std::vector<Blob> &blobs) {
+    for (std::size_t i = 0; i < blobs.size(); i++) {
+        const Blob &b = blobs[i];
+        std::fprintf(m_fp, "%llu,%zu,%u",
+                     static_cast<unsigned long long>(timestamp), i,
+                     b.pixel_count);
+        for (float v : b.centroid) {
+            std::fprintf(m_fp, ",%.4f", v);
+        }
+        for (float v : b.min) {
+            std::fprintf(m_fp, ",%.4f", v);
+        }
+        for (float v : b.max) {
+            std::fprintf(m_fp, ",%.4f", v);
+        }
+        for (float v : b.covariance) {
+            std::fprintf(m_fp, ",%.4g", v);
+        }
+        std::fprintf(m_fp, ",%d,%d,%d,%d\n", b.x0, b.y0, b.x1, b.y1);
+    }
+}
+
+void BlobWriter::close() {
+    if (m_fp && std::fclose(m_fp)) {
+        m_fp = nullptr;
+        die("Could not write file: %s", m_path.c_str());
+    }
+    m_fp = nullptr;
+}
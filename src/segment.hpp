@@ -0,0 +1,104 @@
+#ifndef PCTRACK_SEGMENT_HPP
+#define PCTRACK_SEGMENT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct RayTable;
+
+/// A connected group of foreground pixels.  Positions are in meters,
+/// in the same coordinates as points from convert_points().
+struct Blob {
+    /// Number of pixels in the blob.
+    unsigned pixel_count;
+    /// Mean position of the pixels.
+    float centroid[3];
+    /// Bounding box of the pixel positions.
+    float min[3], max[3];
+    /// Covariance of the pixel positions, as xx, xy, xz, yy, yz, zz.
+    float covariance[6];
+    /// Bounding box in the image, inclusive, in pixels.
+    int x0, y0, x1, y1;
+};
+
+/// Parameters for segmentation.
+struct SegmentConfig {
+    /// Largest difference in depth between neighboring pixels in the
+    /// same object, in millimeters at 1 m.  The threshold grows with
+    /// the square of the depth, as the sensor's depth resolution does.
+    float max_step;
+    /// Blobs with fewer pixels are discarded.
+    unsigned min_pixels;
+};
+
+/// Get the default segmentation parameters.
+SegmentConfig default_segment_config();
+
+/// Splits the foreground of a depth image into objects.  Neighboring
+/// foreground pixels are joined if their depths are close, using
+/// union-find over the image in a single pass, with the moments of
+/// each component merged as components are joined.  Scratch buffers
+/// are kept between frames.
+class Segmenter {
+private:
+    struct Moments {
+        double n;
+        double s[3];
+        double ss[6];
+        float min[3], max[3];
+        int x0, y0, x1, y1;
+    };
+
+    const RayTable &m_rays;
+    SegmentConfig m_cfg;
+    std::vector<uint32_t> m_label;
+    std::vector<uint32_t> m_parent;
+    std::vector<Moments> m_moments;
+    std::vector<uint32_t> m_roots;
+    std::vector<int> m_blob;
+    // Squared depth threshold factor, per millimeter of depth.
+    double m_step_scale;
+
+    uint32_t find(uint32_t label);
+    uint32_t join(uint32_t a, uint32_t b);
+
+public:
+    Segmenter(const RayTable &rays, const SegmentConfig &cfg);
+
+    /// Segment the pixels where the mask is nonzero, replacing the
+    /// contents of blobs.  Blobs are sorted by decreasing size.
+    void segment(const unsigned short *depth, const unsigned char *mask,
+                 std::vector<Blob> &blobs);
+
+    /// Get the blob label of every pixel from the last call to
+    /// segment(), as an index into its blobs, or -1 for pixels which
+    /// are not in a blob.
+    void labels(std::vector<int> &out);
+};
+
+/// Writes objects to a CSV file, one row per object per frame.  Errors
+/// are fatal.
+class BlobWriter {
+private:
+    std::FILE *m_fp;
+    std::string m_path;
+
+public:
+    BlobWriter();
+    BlobWriter(const BlobWriter &) = delete;
+    ~BlobWriter();
+    BlobWriter &operator=(const BlobWriter &) = delete;
+
+    /// Create a file and write the column names.
+    void open(const std::string &path);
+
+    /// Write the objects for a frame.  The timestamp is in ticks of
+    /// the device clock.
+    void write(uint64_t timestamp, const std::vector<Blob> &blobs);
+
+    void close();
+};
+
+#endif
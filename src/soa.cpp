@@ -0,0 +1,363 @@
+#include "soa.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// Sums are accumulated in floats over blocks of this many points, and
+// the block sums in doubles, so that large frames keep their
+// precision.
+const std::size_t SUM_BLOCK = 1024;
+
+PointBounds empty_bounds() {
+    PointBounds b;
+    b.count = 0;
+    for (int k = 0; k < 3; k++) {
+        b.centroid[k] = 0.0f;
+        b.min[k] = std::numeric_limits<float>::infinity();
+        b.max[k] = -std::numeric_limits<float>::infinity();
+    }
+    return b;
+}
+
+// Sum, minimum and maximum of one coordinate array.
+void reduce_axis(const float *v, std::size_t count, double &sum,
+                 float &lo, float &hi) {
+    std::size_t i = 0;
+    sum = 0.0;
+#if defined(__SSE2__)
+    __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+    while (i + 4 <= count) {
+        std::size_t end = std::min(count & ~std::size_t(3), i + SUM_BLOCK);
+        __m128 s = _mm_setzero_ps();
+        for (; i < end; i += 4) {
+            __m128 x = _mm_loadu_ps(v + i);
+            s = _mm_add_ps(s, x);
+            vlo = _mm_min_ps(vlo, x);
+            vhi = _mm_max_ps(vhi, x);
+        }
+        float ps[4];
+        _mm_storeu_ps(ps, s);
+        sum += static_cast<double>(ps[0]) + ps[1] + ps[2] + ps[3];
+    }
+    float plo[4], phi[4];
+    _mm_storeu_ps(plo, vlo);
+    _mm_storeu_ps(phi, vhi);
+    for (int j = 0; j < 4; j++) {
+        lo = std::min(lo, plo[j]);
+        hi = std::max(hi, phi[j]);
+    }
+#endif
+    for (; i < count; i++) {
+        sum += v[i];
+        lo = std::min(lo, v[i]);
+        hi = std::max(hi, v[i]);
+    }
+}
+
+}
+
+PointFrameSoA::PointFrameSoA()
+    : index(0), timestamp(0), host_time(0), count(0) {}
+
+void PointFrameSoA::reserve(std::size_t capacity) {
+    if (x.size() < capacity) {
+        x.resize(capacity);
+        y.resize(capacity);
+        z.resize(capacity);
+        color.resize(capacity);
+    }
+}
+
+void to_soa(const PointFrame &in, PointFrameSoA &out) {
+    std::size_t n = in.count, i = 0;
+    out.reserve(n);
+    out.index = in.index;
+    out.timestamp = in.timestamp;
+    out.host_time = in.host_time;
+    out.count = n;
+    const Point *p = in.points();
+    float *x = out.x.data(), *y = out.y.data(), *z = out.z.data();
+    unsigned *color = out.color.data();
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128 r0 = _mm_loadu_ps(p[i].v), r1 = _mm_loadu_ps(p[i + 1].v);
+        __m128 r2 = _mm_loadu_ps(p[i + 2].v), r3 = _mm_loadu_ps(p[i + 3].v);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(x + i, r0);
+        _mm_storeu_ps(y + i, r1);
+        _mm_storeu_ps(z + i, r2);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(color + i),
+                         _mm_castps_si128(r3));
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] = p[i].v[0];
+        y[i] = p[i].v[1];
+        z[i] = p[i].v[2];
+        color[i] = p[i].color;
+    }
+}
+
+void to_aos(const PointFrameSoA &in, PointFrame &out) {
+    std::size_t n = in.count, i = 0;
+    out.reserve(n);
+    out.index = in.index;
+    out.timestamp = in.timestamp;
+    out.host_time = in.host_time;
+    out.count = n;
+    Point *p = out.points();
+    const float *x = in.x.data(), *y = in.y.data(), *z = in.z.data();
+    const unsigned *color = in.color.data();
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128 r0 = _mm_loadu_ps(x + i), r1 = _mm_loadu_ps(y + i);
+        __m128 r2 = _mm_loadu_ps(z + i);
+        __m128 r3 = _mm_castsi128_ps(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(color + i)));
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(p[i].v, r0);
+        _mm_storeu_ps(p[i + 1].v, r1);
+        _mm_storeu_ps(p[i + 2].v, r2);
+        _mm_storeu_ps(p[i + 3].v, r3);
+    }
+#endif
+    for (; i < n; i++) {
+        p[i].v[0] = x[i];
+        p[i].v[1] = y[i];
+        p[i].v[2] = z[i];
+        p[i].color = color[i];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Bounds
+
+PointBounds point_bounds(const Point *points, std::size_t count) {
+    PointBounds b = empty_bounds();
+    if (!count) {
+        return b;
+    }
+    b.count = count;
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // Each point is one register.  The color lane is ignored.
+    __m128 lo = _mm_set1_ps(b.min[0]), hi = _mm_set1_ps(b.max[0]);
+    while (i < count) {
+        std::size_t end = std::min(count, i + SUM_BLOCK);
+        __m128 s = _mm_setzero_ps();
+        for (; i < end; i++) {
+            __m128 p = _mm_loadu_ps(points[i].v);
+            s = _mm_add_ps(s, p);
+            lo = _mm_min_ps(lo, p);
+            hi = _mm_max_ps(hi, p);
+        }
+        float ps[4];
+        _mm_storeu_ps(ps, s);
+        for (int k = 0; k < 3; k++) {
+            sum[k] += ps[k];
+        }
+    }
+    float plo[4], phi[4];
+    _mm_storeu_ps(plo, lo);
+    _mm_storeu_ps(phi, hi);
+    for (int k = 0; k < 3; k++) {
+        b.min[k] = plo[k];
+        b.max[k] = phi[k];
+    }
+#endif
+    for (; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            float v = points[i].v[k];
+            sum[k] += v;
+            b.min[k] = std::min(b.min[k], v);
+            b.max[k] = std::max(b.max[k], v);
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        b.centroid[k] = static_cast<float>(sum[k] / count);
+    }
+    return b;
+}
+
+PointBounds point_bounds(const PointFrameSoA &frame) {
+    PointBounds b = empty_bounds();
+    if (!frame.count) {
+        return b;
+    }
+    b.count = frame.count;
+    const float *v[3] = { frame.x.data(), frame.y.data(), frame.z.data() };
+    for (int k = 0; k < 3; k++) {
+        double sum;
+        reduce_axis(v[k], frame.count, sum, b.min[k], b.max[k]);
+        b.centroid[k] = static_cast<float>(sum / frame.count);
+    }
+    return b;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Transform
+
+RigidTransform identity_transform() {
+    RigidTransform xf;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            xf.r[i][j] = i == j ? 1.0f : 0.0f;
+        }
+        xf.t[i] = 0.0f;
+    }
+    return xf;
+}
+
+void transform_points(const RigidTransform &xf, Point *points,
+                      std::size_t count) {
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // Each point is one register, and the result is a sum of the
+    // columns of the rotation, scaled by the coordinates.
+    const __m128 c0 = _mm_setr_ps(xf.r[0][0], xf.r[1][0], xf.r[2][0], 0.0f);
+    const __m128 c1 = _mm_setr_ps(xf.r[0][1], xf.r[1][1], xf.r[2][1], 0.0f);
+    const __m128 c2 = _mm_setr_ps(xf.r[0][2], xf.r[1][2], xf.r[2][2], 0.0f);
+    const __m128 t = _mm_setr_ps(xf.t[0], xf.t[1], xf.t[2], 0.0f);
+    const __m128 keep = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+    for (; i < count; i++) {
+        __m128 p = _mm_loadu_ps(points[i].v);
+        __m128 q = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(c0, _mm_shuffle_ps(p, p, 0x00)),
+                _mm_mul_ps(c1, _mm_shuffle_ps(p, p, 0x55))),
+            _mm_add_ps(
+                _mm_mul_ps(c2, _mm_shuffle_ps(p, p, 0xaa)), t));
+        q = _mm_or_ps(_mm_and_ps(keep, p), _mm_andnot_ps(keep, q));
+        _mm_storeu_ps(points[i].v, q);
+    }
+#endif
+    for (; i < count; i++) {
+        float *v = points[i].v;
+        float x = v[0], y = v[1], z = v[2];
+        for (int k = 0; k < 3; k++) {
+            v[k] = xf.r[k][0] * x + xf.r[k][1] * y + xf.r[k][2] * z +
+                xf.t[k];
+        }
+    }
+}
+
+void transform_points(const RigidTransform &xf, PointFrameSoA &frame) {
+    float *x = frame.x.data(), *y = frame.y.data(), *z = frame.z.data();
+    std::size_t i = 0, n = frame.count;
+#if defined(__SSE2__)
+    __m128 r[3][3], t[3];
+    for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < 3; j++) {
+            r[k][j] = _mm_set1_ps(xf.r[k][j]);
+        }
+        t[k] = _mm_set1_ps(xf.t[k]);
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+        __m128 pz = _mm_loadu_ps(z + i);
+        __m128 q[3];
+        for (int k = 0; k < 3; k++) {
+            q[k] = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(r[k][0], px), _mm_mul_ps(r[k][1], py)),
+                _mm_add_ps(_mm_mul_ps(r[k][2], pz), t[k]));
+        }
+        _mm_storeu_ps(x + i, q[0]);
+        _mm_storeu_ps(y + i, q[1]);
+        _mm_storeu_ps(z + i, q[2]);
+    }
+#endif
+    for (; i < n; i++) {
+        float px = x[i], py = y[i], pz = z[i];
+        x[i] = xf.r[0][0] * px + xf.r[0][1] * py + xf.r[0][2] * pz +
+            xf.t[0];
+        y[i] = xf.r[1][0] * px + xf.r[1][1] * py + xf.r[1][2] * pz +
+            xf.t[1];
+        z[i] = xf.r[2][0] * px + xf.r[2][1] * py + xf.r[2][2] * pz +
+            xf.t[2];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Crop
+
+std::size_t crop_points(const CropBox &box, Point *points,
+                        std::size_t count) {
+    // Every point is copied to the output, but the output only
+    // advances past points in the box, so there is no branch on the
+    // test.
+    std::size_t i = 0, out = 0;
+#if defined(__SSE2__)
+    const __m128 lo = _mm_setr_ps(box.min[0], box.min[1], box.min[2], 0.0f);
+    const __m128 hi = _mm_setr_ps(box.max[0], box.max[1], box.max[2], 0.0f);
+    for (; i < count; i++) {
+        __m128 p = _mm_loadu_ps(points[i].v);
+        int inside = _mm_movemask_ps(
+            _mm_and_ps(_mm_cmpge_ps(p, lo), _mm_cmple_ps(p, hi)));
+        _mm_storeu_ps(points[out].v, p);
+        out += (inside & 7) == 7;
+    }
+#endif
+    for (; i < count; i++) {
+        const float *v = points[i].v;
+        bool inside = true;
+        for (int k = 0; k < 3; k++) {
+            inside &= v[k] >= box.min[k] && v[k] <= box.max[k];
+        }
+        points[out] = points[i];
+        out += inside;
+    }
+    return out;
+}
+
+void crop_points(const CropBox &box, PointFrameSoA &frame) {
+    float *x = frame.x.data(), *y = frame.y.data(), *z = frame.z.data();
+    unsigned *color = frame.color.data();
+    std::size_t i = 0, out = 0, n = frame.count;
+#if defined(__SSE2__)
+    const __m128 lo[3] = { _mm_set1_ps(box.min[0]), _mm_set1_ps(box.min[1]),
+                           _mm_set1_ps(box.min[2]) };
+    const __m128 hi[3] = { _mm_set1_ps(box.max[0]), _mm_set1_ps(box.max[1]),
+                           _mm_set1_ps(box.max[2]) };
+    for (; i + 4 <= n; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+        __m128 pz = _mm_loadu_ps(z + i);
+        __m128 m = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(px, lo[0]), _mm_cmple_ps(px, hi[0])),
+            _mm_and_ps(_mm_cmpge_ps(py, lo[1]), _mm_cmple_ps(py, hi[1])));
+        m = _mm_and_ps(m, _mm_and_ps(_mm_cmpge_ps(pz, lo[2]),
+                                     _mm_cmple_ps(pz, hi[2])));
+        int bits = _mm_movemask_ps(m);
+        if (bits == 0xf && out == i) {
+            // Nothing removed yet, so the points are already in place.
+            out += 4;
+            continue;
+        }
+        for (int j = 0; j < 4; j++) {
+            x[out] = x[i + j];
+            y[out] = y[i + j];
+            z[out] = z[i + j];
+            color[out] = color[i + j];
+            out += (bits >> j) & 1;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        bool inside = x[i] >= box.min[0] && x[i] <= box.max[0] &&
+            y[i] >= box.min[1] && y[i] <= box.max[1] &&
+            z[i] >= box.min[2] && z[i] <= box.max[2];
+        x[out] = x[i];
+        y[out] = y[i];
+        z[out] = z[i];
+        color[out] = color[i];
+        out += inside;
+    }
+    frame.count = out;
+}
@@ -0,0 +1,86 @@
+#ifndef PCTRACK_SOA_HPP
+#define PCTRACK_SOA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame.hpp"
+#include "point.hpp"
+
+// Structure-of-arrays frames, and kernels over frames in either
+// layout.  Point keeps the coordinates of each point together, which
+// is what OpenGL and the file format want.  Kernels which apply the
+// same operation to many points vectorize better with each coordinate
+// in its own array, since four points then fill one SIMD register
+// without shuffling.  Conversion between the layouts is a 4x4
+// transpose per four points.
+
+/// A frame with a separate array for each coordinate and the colors.
+struct PointFrameSoA {
+    /// Position of the frame in its file.
+    std::size_t index;
+    /// Device timestamp, in ticks of the file's timestamp clock.
+    uint64_t timestamp;
+    /// Time the frame arrived at the host, in microseconds since the
+    /// start of the capture.
+    uint64_t host_time;
+    /// Number of points in the frame.
+    std::size_t count;
+    /// Coordinates in meters, with room for at least count points.
+    /// As with PointFrame, the arrays only grow.
+    std::vector<float> x, y, z;
+    /// Colors, RGB0.
+    std::vector<unsigned> color;
+
+    PointFrameSoA();
+
+    /// Make room for at least the given number of points.
+    void reserve(std::size_t capacity);
+};
+
+/// Convert a frame to structure-of-arrays layout.
+void to_soa(const PointFrame &in, PointFrameSoA &out);
+
+/// Convert a frame back to an array of points.
+void to_aos(const PointFrameSoA &in, PointFrame &out);
+
+/// Centroid and bounding box of a set of points.
+struct PointBounds {
+    std::size_t count;
+    /// Mean position.  Zero if there are no points.
+    float centroid[3];
+    /// Bounding box.  If there are no points, min is greater than max.
+    float min[3], max[3];
+};
+
+/// Compute the centroid and bounds of a set of points.
+PointBounds point_bounds(const Point *points, std::size_t count);
+PointBounds point_bounds(const PointFrameSoA &frame);
+
+/// A rotation followed by a translation, p' = r p + t.
+struct RigidTransform {
+    float r[3][3];
+    float t[3];
+};
+
+/// Get the identity transform.
+RigidTransform identity_transform();
+
+/// Transform points in place.  Colors are unchanged.
+void transform_points(const RigidTransform &xf, Point *points,
+                      std::size_t count);
+void transform_points(const RigidTransform &xf, PointFrameSoA &frame);
+
+/// An axis-aligned box, in meters.  Points on the faces are inside.
+struct CropBox {
+    float min[3], max[3];
+};
+
+/// Remove points outside a box, in place, keeping the order of the
+/// rest.  Returns the number of points kept.
+std::size_t crop_points(const CropBox &box, Point *points,
+                        std::size_t count);
+void crop_points(const CropBox &box, PointFrameSoA &frame);
+
+#endif
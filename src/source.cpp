@@ -0,0 +1,263 @@
+#include "source.hpp"
+#include "defs.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Size of the room for synthetic frames, in meters.  The camera is
+// at the origin, looking along +Z.
+const float FLOOR_Y = -1.0f;
+const float WALL_Z = 3.5f;
+const float SIDE_X = 2.0f;
+
+// Bounds on the centers of moving objects.
+const float OBJECT_MIN[3] = {-1.2f, -0.6f, 1.2f};
+const float OBJECT_MAX[3] = {1.2f, 0.6f, 3.0f};
+
+// Number of entries in the table of normal random numbers.
+const int GAUSS_BITS = 12;
+
+void put_color(unsigned char *p, unsigned color) {
+    p[0] = color & 0xff;
+    p[1] = (color >> 8) & 0xff;
+    p[2] = (color >> 16) & 0xff;
+}
+
+unsigned shade(unsigned color, float f) {
+    unsigned r = 0;
+    for (int i = 0; i < 24; i += 8) {
+        float c = static_cast<float>((color >> i) & 0xff) * f;
+        r |= static_cast<unsigned>(std::min(c, 255.0f)) << i;
+    }
+    return r;
+}
+
+}
+
+FrameSource::~FrameSource() {}
+
+//////////////////////////////////////////////////////////////////////
+// Replay
+
+ReplaySource::ReplaySource(const std::string &path, bool loop)
+    : m_frame(0), m_loop(loop) {
+    m_reader.open(path);
+    if (!m_reader.frame_count() ||
+        m_reader.frame_header(0).encoding != FRAME_DEPTH_RGB) {
+        die("Not a raw depth capture: %s", path.c_str());
+    }
+    std::size_t n = static_cast<std::size_t>(width()) * height();
+    m_depth.resize(n);
+    m_color.resize(n * 3);
+}
+
+bool ReplaySource::next(const unsigned short *&depth,
+                        const unsigned char *&color,
+                        uint32_t &timestamp) {
+    if (m_frame == m_reader.frame_count()) {
+        if (!m_loop) {
+            return false;
+        }
+        m_frame = 0;
+    }
+    FrameHeader fh;
+    m_reader.read_depth_frame(
+        m_frame++, m_depth.data(), m_color.data(), &fh);
+    depth = m_depth.data();
+    color = m_color.data();
+    // Devices give 32-bit timestamps.
+    timestamp = static_cast<uint32_t>(fh.timestamp);
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Synthetic
+
+SyntheticConfig default_synthetic_config(int width, int height) {
+    SyntheticConfig cfg;
+    cfg.width = width;
+    cfg.height = height;
+    cfg.object_count = 3;
+    cfg.speed = 0.8f;
+    cfg.hole_rate = 0.02f;
+    cfg.noise = 1.5f;
+    cfg.empty_frames = 1;
+    cfg.frame_rate = 30.0;
+    cfg.seed = 1;
+    return cfg;
+}
+
+SyntheticSource::SyntheticSource(const SyntheticConfig &cfg)
+    : m_cfg(cfg), m_intr(kinect_intrinsics(cfg.width, cfg.height)),
+      m_rays(cfg.width, cfg.height, m_intr), m_frame(0),
+      m_rng(cfg.seed * 0x9e3779b97f4a7c15ull + 1) {
+    int n = cfg.width * cfg.height;
+    m_depth.resize(n);
+    m_color.resize(n * 3);
+
+    // The room is a floor, a back wall and two side walls.
+    m_background.resize(n);
+    for (int i = 0; i < n; i++) {
+        float rx = m_rays.x[i], ry = m_rays.y[i];
+        float z = WALL_Z;
+        if (ry < 0.0f) {
+            z = std::min(z, FLOOR_Y / ry);
+        }
+        if (rx != 0.0f) {
+            z = std::min(z, SIDE_X / std::fabs(rx));
+        }
+        m_background[i] = static_cast<unsigned short>(
+            std::lround(z * 1000.0f));
+    }
+
+    // Normal random numbers, from the Box-Muller transform.
+    m_gauss.resize(1 << GAUSS_BITS);
+    for (std::size_t i = 0; i < m_gauss.size(); i += 2) {
+        float u1 = uniform(1e-6f, 1.0f), u2 = uniform(0.0f, 6.2831853f);
+        float r = std::sqrt(-2.0f * std::log(u1));
+        m_gauss[i] = r * std::cos(u2);
+        m_gauss[i + 1] = r * std::sin(u2);
+    }
+
+    for (int i = 0; i < cfg.object_count; i++) {
+        Object obj;
+        float dir[3], len = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            obj.pos[k] = uniform(OBJECT_MIN[k], OBJECT_MAX[k]);
+            dir[k] = uniform(-1.0f, 1.0f);
+            len += dir[k] * dir[k];
+        }
+        len = std::sqrt(std::max(len, 1e-6f));
+        for (int k = 0; k < 3; k++) {
+            obj.vel[k] = dir[k] / len * cfg.speed;
+        }
+        obj.radius = uniform(0.12f, 0.3f);
+        obj.color = (random() & 0xffffff) | 0x404040;
+        m_objects.push_back(obj);
+    }
+}
+
+unsigned SyntheticSource::random() {
+    // xorshift64*
+    m_rng ^= m_rng >> 12;
+    m_rng ^= m_rng << 25;
+    m_rng ^= m_rng >> 27;
+    return static_cast<unsigned>((m_rng * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+float SyntheticSource::uniform(float lo, float hi) {
+    return lo + (hi - lo) * static_cast<float>(random() >> 8) *
+        (1.0f / 16777216.0f);
+}
+
+void SyntheticSource::move_objects() {
+    float dt = static_cast<float>(1.0 / m_cfg.frame_rate);
+    for (Object &obj : m_objects) {
+        for (int k = 0; k < 3; k++) {
+            obj.pos[k] += obj.vel[k] * dt;
+            if ((obj.pos[k] < OBJECT_MIN[k] && obj.vel[k] < 0.0f) ||
+                (obj.pos[k] > OBJECT_MAX[k] && obj.vel[k] > 0.0f)) {
+                obj.vel[k] = -obj.vel[k];
+            }
+        }
+    }
+}
+
+void SyntheticSource::draw_object(const Object &obj) {
+    const float *c = obj.pos;
+    float r = obj.radius;
+    if (c[2] - r < 0.1f) {
+        return;
+    }
+    // Bounding box of the sphere in the image.
+    float extent = m_intr.fx * r / (c[2] - r) + 1.0f;
+    float u0 = m_intr.cx - m_intr.fx * c[0] / c[2];
+    float v0 = m_intr.cy - m_intr.fy * c[1] / c[2];
+    int x0 = std::max(static_cast<int>(u0 - extent), 0);
+    int x1 = std::min(static_cast<int>(u0 + extent) + 1, m_cfg.width);
+    int y0 = std::max(static_cast<int>(v0 - extent), 0);
+    int y1 = std::min(static_cast<int>(v0 + extent) + 1, m_cfg.height);
+
+    float cc = c[0] * c[0] + c[1] * c[1] + c[2] * c[2] - r * r;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            // Intersect the ray z * (rx, ry, 1) with the sphere.
+            int i = y * m_cfg.width + x;
+            float rx = m_rays.x[i], ry = m_rays.y[i];
+            float a = rx * rx + ry * ry + 1.0f;
+            float b = rx * c[0] + ry * c[1] + c[2];
+            float disc = b * b - a * cc;
+            if (disc < 0.0f) {
+                continue;
+            }
+            float z = (b - std::sqrt(disc)) / a;
+            unsigned short d = static_cast<unsigned short>(
+                std::lround(z * 1000.0f));
+            if (m_depth[i] && d >= m_depth[i]) {
+                continue;
+            }
+            // The sensor gets no return from the grazing edges, where
+            // the discriminant is small compared to its value at the
+            // center.
+            if (disc < 0.05f * a * r * r) {
+                m_depth[i] = 0;
+                continue;
+            }
+            float nz = (z - c[2]) / r;
+            m_depth[i] = d;
+            put_color(&m_color[i * 3], shade(obj.color, 0.3f - 0.7f * nz));
+        }
+    }
+}
+
+bool SyntheticSource::next(const unsigned short *&depth,
+                           const unsigned char *&color,
+                           uint32_t &timestamp) {
+    int n = m_cfg.width * m_cfg.height;
+    for (int i = 0; i < n; i++) {
+        float f = 1.5f - 0.25f * static_cast<float>(m_background[i]) * 1e-3f;
+        unsigned base = m_rays.y[i] * m_background[i] < -900.0f ?
+            0x4a6a8a : 0xa0a0a0;
+        m_depth[i] = m_background[i];
+        put_color(&m_color[i * 3], shade(base, f));
+    }
+
+    if (m_frame >= static_cast<uint64_t>(m_cfg.empty_frames)) {
+        for (const Object &obj : m_objects) {
+            draw_object(obj);
+        }
+        move_objects();
+    }
+
+    // Noise and holes.  The top bits of each random number decide
+    // whether there is a hole, and the bottom bits pick the noise.
+    unsigned hole = static_cast<unsigned>(m_cfg.hole_rate * 4294967295.0);
+    float noise = m_cfg.noise * 1e-6f;
+    unsigned mask = (1u << GAUSS_BITS) - 1;
+    for (int i = 0; i < n; i++) {
+        unsigned r = random();
+        int d = m_depth[i];
+        if (!d) {
+            continue;
+        }
+        if ((r & ~mask) < hole) {
+            m_depth[i] = 0;
+            continue;
+        }
+        float z = static_cast<float>(d);
+        d += static_cast<int>(std::lround(m_gauss[r & mask] * noise * z * z));
+        m_depth[i] = static_cast<unsigned short>(std::min(
+            std::max(d, 1), 0xffff));
+    }
+
+    depth = m_depth.data();
+    color = m_color.data();
+    timestamp = static_cast<uint32_t>(
+        m_frame * static_cast<uint64_t>(
+            KINECT_TIMESTAMP_RATE / m_cfg.frame_rate));
+    m_frame++;
+    return true;
+}
@@ -0,0 +1,111 @@
+#ifndef PCTRACK_SOURCE_HPP
+#define PCTRACK_SOURCE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pcfile.hpp"
+
+/// A source of registered depth and RGB frames, such as a device or a
+/// recording.  Depth is in millimeters, with zero for no data, and
+/// color is packed RGB.
+class FrameSource {
+public:
+    virtual ~FrameSource();
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    /// Test whether frames arrive in real time, as from a device.
+    /// Other sources produce frames as fast as they are requested.
+    virtual bool live() const = 0;
+
+    /// Get the next frame.  The images are valid until the next call.
+    /// Returns false if there are no more frames.
+    virtual bool next(const unsigned short *&depth,
+                      const unsigned char *&color,
+                      uint32_t &timestamp) = 0;
+};
+
+/// Plays back the depth frames of a capture made with pckinect --raw.
+class ReplaySource : public FrameSource {
+private:
+    PointFileReader m_reader;
+    std::size_t m_frame;
+    bool m_loop;
+    std::vector<unsigned short> m_depth;
+    std::vector<unsigned char> m_color;
+
+public:
+    /// Open a capture.  If loop is true, playback starts again at the
+    /// end.
+    ReplaySource(const std::string &path, bool loop);
+
+    int width() const override { return m_reader.header().width; }
+    int height() const override { return m_reader.header().height; }
+    bool live() const override { return false; }
+    bool next(const unsigned short *&depth, const unsigned char *&color,
+              uint32_t &timestamp) override;
+};
+
+/// Parameters for synthetic frames.
+struct SyntheticConfig {
+    int width, height;
+    /// Number of moving objects.
+    int object_count;
+    /// Speed of the objects, in meters per second.
+    float speed;
+    /// Fraction of pixels which randomly have no depth.
+    float hole_rate;
+    /// Standard deviation of depth noise at one meter, in millimeters.
+    /// Noise grows with the square of the depth, as in the Kinect.
+    float noise;
+    /// Number of frames at the start with no objects, for keying.
+    int empty_frames;
+    /// Frame rate used for timestamps and motion.
+    double frame_rate;
+    unsigned seed;
+};
+
+/// Get the default parameters for synthetic frames of a given size.
+SyntheticConfig default_synthetic_config(int width, int height);
+
+/// Generates frames of a room with spheres moving through it, with
+/// sensor noise and holes.  The output is the same for the same seed.
+class SyntheticSource : public FrameSource {
+private:
+    struct Object {
+        float pos[3], vel[3];
+        float radius;
+        unsigned color;
+    };
+
+    SyntheticConfig m_cfg;
+    Intrinsics m_intr;
+    RayTable m_rays;
+    uint64_t m_frame;
+    uint64_t m_rng;
+    std::vector<Object> m_objects;
+    std::vector<unsigned short> m_background;
+    std::vector<float> m_gauss;
+    std::vector<unsigned short> m_depth;
+    std::vector<unsigned char> m_color;
+
+    unsigned random();
+    float uniform(float lo, float hi);
+    void move_objects();
+    void draw_object(const Object &obj);
+
+public:
+    explicit SyntheticSource(const SyntheticConfig &cfg);
+
+    int width() const override { return m_cfg.width; }
+    int height() const override { return m_cfg.height; }
+    bool live() const override { return false; }
+    bool next(const unsigned short *&depth, const unsigned char *&color,
+              uint32_t &timestamp) override;
+};
+
+#endif
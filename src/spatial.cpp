@@ -0,0 +1,425 @@
+#include "spatial.hpp"
+#include "defs.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+namespace {
+
+// Trees over fewer points are built on one thread.
+const std::size_t PARALLEL_BUILD_POINTS = 50000;
+// Most key bits taken from one axis, so that each axis's cell
+// coordinate fits the two bytes of the spreading tables.
+const int MAX_AXIS_BITS = 16;
+// Keys are sorted on three digits of this many bits, which cover the
+// 32 key bits.
+const int RADIX_DIGITS = 3;
+const int RADIX_BITS = 11;
+const uint64_t RADIX_MASK = (1 << RADIX_BITS) - 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// PointGrid
+
+PointGrid::PointGrid(float cell_size)
+    : m_cell_size(cell_size), m_scale(1.0f / cell_size),
+      m_bits(0), m_side(0) {
+    if (!(cell_size > 0.0f)) {
+        die("Cell size must be positive.");
+    }
+}
+
+std::size_t PointGrid::bucket(int x, int y, int z) const {
+    // Wrap the cell coordinates around a cube of buckets, so that
+    // neighboring cells are in neighboring buckets.
+    std::size_t m = m_side - 1;
+    return (static_cast<std::size_t>(x) & m) |
+        ((static_cast<std::size_t>(y) & m) << m_bits) |
+        ((static_cast<std::size_t>(z) & m) << (2 * m_bits));
+}
+
+void PointGrid::build(const Point *points, std::size_t count) {
+    if (count > std::numeric_limits<uint32_t>::max()) {
+        die("Too many points for spatial index.");
+    }
+    // Use at least one bucket for every two points.
+    m_bits = 4;
+    while ((std::size_t(1) << (3 * m_bits)) < count / 2) {
+        m_bits++;
+    }
+    m_side = std::size_t(1) << m_bits;
+    std::size_t size = m_side * m_side * m_side;
+    m_start.assign(size + 1, 0);
+    m_bucket.resize(count);
+
+    // Counting sort: count the points in each bucket, find where each
+    // bucket starts, then move the points into place.
+    for (std::size_t i = 0; i < count; i++) {
+        const float *v = points[i].v;
+        std::size_t b = bucket(cell(v[0]), cell(v[1]), cell(v[2]));
+        m_bucket[i] = static_cast<uint32_t>(b);
+        m_start[b + 1]++;
+    }
+    for (std::size_t b = 0; b < size; b++) {
+        m_start[b + 1] += m_start[b];
+    }
+    m_points.resize(count);
+    for (std::size_t i = count; i-- > 0;) {
+        IndexedPoint &q = m_points[--m_start[m_bucket[i] + 1]];
+        q.v[0] = points[i].v[0];
+        q.v[1] = points[i].v[1];
+        q.v[2] = points[i].v[2];
+        q.index = static_cast<uint32_t>(i);
+    }
+    // Scattering backwards decremented each bucket's end to its start,
+    // so the starts are now one bucket late.
+    for (std::size_t b = 0; b < size; b++) {
+        m_start[b] = m_start[b + 1];
+    }
+    m_start[size] = static_cast<uint32_t>(count);
+}
+
+void PointGrid::radius_search(const float *p, float radius,
+                              std::vector<uint32_t> &out) const {
+    out.clear();
+    for_each_in_radius(p, radius, [&out](const IndexedPoint &q, float) {
+        out.push_back(q.index);
+    });
+}
+
+void PointGrid::count_neighbors(float radius, uint32_t *out,
+                                int thread_count) const {
+    parallel_ranges(m_points.size(), thread_count,
+                    [this, radius, out](std::size_t begin,
+                                        std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const IndexedPoint &p = m_points[i];
+            uint32_t n = 0;
+            for_each_in_radius(p.v, radius,
+                               [&n](const IndexedPoint &, float) { n++; });
+            out[p.index] = n;
+        }
+    });
+}
+
+//////////////////////////////////////////////////////////////////////
+// KdTree
+
+void KdTree::build(const Point *points, std::size_t count,
+                   int thread_count) {
+    if (count > std::numeric_limits<uint32_t>::max()) {
+        die("Too many points for spatial index.");
+    }
+    m_nodes.clear();
+    m_points.resize(count);
+    m_keys.resize(count);
+    m_scratch.resize(count);
+    if (!count) {
+        return;
+    }
+    int threads = count < PARALLEL_BUILD_POINTS ? 1 : thread_count;
+
+    float lo[3], hi[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = hi[k] = points[0].v[k];
+    }
+    std::mutex mutex;
+    parallel_ranges(count, threads,
+                    [&](std::size_t begin, std::size_t end) {
+        float rlo[3], rhi[3];
+        std::copy(lo, lo + 3, rlo);
+        std::copy(hi, hi + 3, rhi);
+        for (std::size_t i = begin; i < end; i++) {
+            for (int k = 0; k < 3; k++) {
+                rlo[k] = std::min(rlo[k], points[i].v[k]);
+                rhi[k] = std::max(rhi[k], points[i].v[k]);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], rlo[k]);
+            hi[k] = std::max(hi[k], rhi[k]);
+        }
+    });
+
+    // Give each key bit, most significant first, to the axis whose
+    // cells are widest, which halves them.  Each axis gets at most
+    // MAX_AXIS_BITS.
+    float extent[3], width[3];
+    int bits[3] = { 0, 0, 0 };
+    for (int k = 0; k < 3; k++) {
+        extent[k] = width[k] = hi[k] - lo[k];
+    }
+    for (int level = 0; level < KEY_BITS; level++) {
+        int axis = -1;
+        for (int k = 0; k < 3; k++) {
+            if (bits[k] < MAX_AXIS_BITS &&
+                (axis < 0 || width[k] > width[axis])) {
+                axis = k;
+            }
+        }
+        m_level_axis[level] = axis;
+        m_level_bit[level] = bits[axis]++;
+        width[axis] *= 0.5f;
+    }
+    for (int level = 0; level < KEY_BITS; level++) {
+        int axis = m_level_axis[level];
+        m_level_bit[level] = bits[axis] - 1 - m_level_bit[level];
+    }
+
+    // Each cell coordinate is spread into its key bits through tables,
+    // one for each byte.
+    uint32_t spread[3][2][256];
+    float inverse[3];
+    for (int k = 0; k < 3; k++) {
+        uint32_t cells = uint32_t(1) << bits[k];
+        std::vector<float> &planes = m_planes[k];
+        planes.resize(cells + 1);
+        for (uint32_t j = 0; j <= cells; j++) {
+            planes[j] = lo[k] + j * (extent[k] / cells);
+        }
+        inverse[k] = extent[k] > 0.0f ? cells / extent[k] : 0.0f;
+        for (int byte = 0; byte < 2; byte++) {
+            for (uint32_t v = 0; v < 256; v++) {
+                uint32_t key = 0;
+                for (int level = 0; level < KEY_BITS; level++) {
+                    int bit = m_level_bit[level] - 8 * byte;
+                    if (m_level_axis[level] == k && bit >= 0 && bit < 8 &&
+                        (v >> bit & 1)) {
+                        key |= uint32_t(1) << (KEY_BITS - 1 - level);
+                    }
+                }
+                spread[k][byte][v] = key;
+            }
+        }
+    }
+
+    // A point's cell is the last whose lower plane is not above it,
+    // using the same planes as the splits, so that the side of every
+    // split agrees with the key even where rounding differs.  The
+    // digits of the keys are counted for sorting at the same time.
+    const float *planes[3];
+    int last[3];
+    for (int k = 0; k < 3; k++) {
+        planes[k] = m_planes[k].data();
+        last[k] = static_cast<int>(m_planes[k].size()) - 2;
+    }
+    uint64_t *keys = m_keys.data();
+    std::vector<uint32_t> counts(RADIX_DIGITS << RADIX_BITS, 0);
+    parallel_ranges(count, threads,
+                    [&](std::size_t begin, std::size_t end) {
+        std::vector<uint32_t> local(counts.size(), 0);
+        for (std::size_t i = begin; i < end; i++) {
+            uint32_t key = 0;
+            for (int k = 0; k < 3; k++) {
+                const float *pk = planes[k];
+                float v = points[i].v[k];
+                float t = (v - lo[k]) * inverse[k];
+                int c = t > 0.0f ? static_cast<int>(
+                    std::min(t, static_cast<float>(last[k]))) : 0;
+                while (c > 0 && v < pk[c]) {
+                    c--;
+                }
+                while (c < last[k] && v >= pk[c + 1]) {
+                    c++;
+                }
+                key |= spread[k][0][c & 0xff] | spread[k][1][c >> 8];
+            }
+            keys[i] = static_cast<uint64_t>(key) << 32 | i;
+            for (int d = 0; d < RADIX_DIGITS; d++) {
+                local[(d << RADIX_BITS) +
+                      (key >> (d * RADIX_BITS) & RADIX_MASK)]++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::size_t j = 0; j < counts.size(); j++) {
+            counts[j] += local[j];
+        }
+    });
+
+    // Least significant digit radix sort on the keys.  Digits on which
+    // every key agrees are skipped.
+    for (int d = 0; d < RADIX_DIGITS; d++) {
+        uint32_t *c = counts.data() + (d << RADIX_BITS);
+        if (*std::max_element(c, c + (1 << RADIX_BITS)) == count) {
+            continue;
+        }
+        uint32_t sum = 0;
+        for (int j = 0; j < 1 << RADIX_BITS; j++) {
+            uint32_t n = c[j];
+            c[j] = sum;
+            sum += n;
+        }
+        int shift = 32 + d * RADIX_BITS;
+        const uint64_t *in = m_keys.data();
+        uint64_t *out = m_scratch.data();
+        for (std::size_t i = 0; i < count; i++) {
+            uint64_t key = in[i];
+            out[c[key >> shift & RADIX_MASK]++] = key;
+        }
+        m_keys.swap(m_scratch);
+    }
+
+    parallel_ranges(count, threads,
+                    [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            uint32_t index = static_cast<uint32_t>(m_keys[i]);
+            IndexedPoint &q = m_points[i];
+            q.v[0] = points[index].v[0];
+            q.v[1] = points[index].v[1];
+            q.v[2] = points[index].v[2];
+            q.index = index;
+        }
+    });
+
+    uint32_t cell[3] = { 0, 0, 0 };
+    build_node(0, static_cast<uint32_t>(count), 0, cell);
+}
+
+// Build the node for a range of sorted points, whose keys agree above
+// the given level.  The cell holds the lowest grid coordinate on each
+// axis which the node covers.
+uint32_t KdTree::build_node(uint32_t begin, uint32_t end, int level,
+                            const uint32_t *cell) {
+    uint32_t id = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    uint32_t lower[3] = { cell[0], cell[1], cell[2] };
+    for (; end - begin > static_cast<uint32_t>(LEAF_SIZE) &&
+             level < KEY_BITS; level++) {
+        int axis = m_level_axis[level];
+        uint32_t step = uint32_t(1) << m_level_bit[level];
+        uint64_t bit = uint64_t(1) << (63 - level);
+        uint32_t mid = static_cast<uint32_t>(std::partition_point(
+            m_keys.begin() + begin, m_keys.begin() + end,
+            [bit](uint64_t key) { return !(key & bit); }) - m_keys.begin());
+        if (mid == end) {
+            continue;
+        }
+        if (mid == begin) {
+            lower[axis] += step;
+            continue;
+        }
+        uint32_t upper[3] = { lower[0], lower[1], lower[2] };
+        upper[axis] += step;
+        float split = m_planes[axis][upper[axis]];
+        build_node(begin, mid, level + 1, lower);
+        uint32_t right = build_node(mid, end, level + 1, upper);
+        Node &n = m_nodes[id];
+        n.axis = axis;
+        n.split = split;
+        n.right = right;
+        n.begin = begin;
+        n.end = end;
+        return id;
+    }
+    Node &n = m_nodes[id];
+    n.axis = -1;
+    n.split = 0.0f;
+    n.right = 0;
+    n.begin = begin;
+    n.end = end;
+    return id;
+}
+
+void KdTree::knn(const float *p, int k, uint32_t *index,
+                 float *dist2) const {
+    for (int i = 0; i < k; i++) {
+        index[i] = UINT32_MAX;
+        dist2[i] = std::numeric_limits<float>::infinity();
+    }
+    if (m_nodes.empty() || k <= 0) {
+        return;
+    }
+
+    // The output is kept sorted, and the last entry is the bound.
+    struct Entry {
+        uint32_t node;
+        float dist2;
+    };
+    // The stack holds at most one entry per level of the tree.
+    Entry stack[MAX_DEPTH + 1];
+    int top = 0;
+    stack[top++] = Entry{0, 0.0f};
+    while (top) {
+        Entry e = stack[--top];
+        if (e.dist2 > dist2[k - 1]) {
+            continue;
+        }
+        const Node *n = &m_nodes[e.node];
+        // Descend to the nearer leaf, pushing the farther children.
+        while (n->axis >= 0) {
+            float d = p[n->axis] - n->split;
+            uint32_t near = d < 0.0f ? e.node + 1 : n->right;
+            uint32_t far = d < 0.0f ? n->right : e.node + 1;
+            float far_dist2 = d * d;
+            if (far_dist2 <= dist2[k - 1]) {
+                stack[top++] = Entry{far, far_dist2};
+            }
+            e.node = near;
+            n = &m_nodes[near];
+        }
+        for (uint32_t i = n->begin; i < n->end; i++) {
+            const IndexedPoint &q = m_points[i];
+            float dx = q.v[0] - p[0], dy = q.v[1] - p[1];
+            float dz = q.v[2] - p[2];
+            float d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 >= dist2[k - 1]) {
+                continue;
+            }
+            int j = k - 1;
+            for (; j > 0 && dist2[j - 1] > d2; j--) {
+                dist2[j] = dist2[j - 1];
+                index[j] = index[j - 1];
+            }
+            dist2[j] = d2;
+            index[j] = q.index;
+        }
+    }
+}
+
+void KdTree::radius_search(const float *p, float radius,
+                           std::vector<uint32_t> &out) const {
+    out.clear();
+    if (m_nodes.empty()) {
+        return;
+    }
+    float r2 = radius * radius;
+    uint32_t stack[MAX_DEPTH + 2];
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const Node &n = m_nodes[stack[--top]];
+        uint32_t id = static_cast<uint32_t>(&n - m_nodes.data());
+        if (n.axis < 0) {
+            for (uint32_t i = n.begin; i < n.end; i++) {
+                const IndexedPoint &q = m_points[i];
+                float dx = q.v[0] - p[0], dy = q.v[1] - p[1];
+                float dz = q.v[2] - p[2];
+                if (dx * dx + dy * dy + dz * dz <= r2) {
+                    out.push_back(q.index);
+                }
+            }
+            continue;
+        }
+        float d = p[n.axis] - n.split;
+        if (d - radius <= 0.0f) {
+            stack[top++] = id + 1;
+        }
+        if (d + radius >= 0.0f) {
+            stack[top++] = n.right;
+        }
+    }
+}
+
+void KdTree::knn_batch(const Point *queries, std::size_t count, int k,
+                       uint32_t *index, float *dist2,
+                       int thread_count) const {
+    parallel_ranges(count, thread_count,
+                    [=](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            knn(queries[i].v, k, index + i * k, dist2 + i * k);
+        }
+    });
+}
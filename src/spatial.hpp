@@ -0,0 +1,223 @@
+#ifndef PCTRACK_SPATIAL_HPP
+#define PCTRACK_SPATIAL_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "point.hpp"
+
+// Spatial indexes over the points of one frame, for radius and nearest
+// neighbor queries.  Indexes keep their own copy of the positions,
+// sorted for locality, and return indexes into the points they were
+// built from.  Buffers are kept between builds, so rebuilding each
+// frame does not allocate once they are large enough.  Queries may be
+// made from several threads at once.
+
+/// A position in an index, with the index of the original point.
+struct IndexedPoint {
+    float v[3];
+    uint32_t index;
+};
+
+/// Uniform grid of cubic cells.  The grid wraps around a cube of
+/// buckets, so its size does not depend on the extent of the points,
+/// and neighboring cells are still near each other in memory.  Points
+/// are sorted into buckets by counting sort.  Cells which share a
+/// bucket are told apart by distance, so this is best for radius
+/// queries with a radius near the cell size.
+class PointGrid {
+private:
+    float m_cell_size, m_scale;
+    int m_bits;
+    std::size_t m_side;
+    std::vector<uint32_t> m_start;
+    std::vector<uint32_t> m_bucket;
+    std::vector<IndexedPoint> m_points;
+
+    int cell(float v) const {
+        return static_cast<int>(std::floor(v * m_scale));
+    }
+    std::size_t bucket(int x, int y, int z) const;
+
+public:
+    /// Create a grid with the given cell size, in meters.
+    explicit PointGrid(float cell_size);
+
+    /// Build the grid over a frame of points.
+    void build(const Point *points, std::size_t count);
+
+    /// Call f(const IndexedPoint &, float dist2) for every point within
+    /// a radius of a position.  Each point is visited once.
+    template<class F>
+    void for_each_in_radius(const float *p, float radius, F f) const;
+
+    /// Find the points within a radius of a position, replacing the
+    /// contents of the output.
+    void radius_search(const float *p, float radius,
+                       std::vector<uint32_t> &out) const;
+
+    /// Count the points within a radius of each point of the frame
+    /// the grid was built from, including the point itself, using the
+    /// given number of threads.  The output has one count per point.
+    void count_neighbors(float radius, uint32_t *out,
+                         int thread_count) const;
+
+    float cell_size() const { return m_cell_size; }
+    std::size_t size() const { return m_points.size(); }
+};
+
+/// Flat kd-tree.  Nodes are stored in depth-first order, with the left
+/// child following its parent, and each leaf holds a contiguous range
+/// of sorted points.
+///
+/// Building does not partition the points level by level.  Each point
+/// gets a key which interleaves the bits of its cell on a grid over
+/// the bounds, taking each bit from the axis whose cells are widest at
+/// that point, and the points are radix sorted by key.  A node's
+/// points then share the key bits above its level, and the split
+/// between its children is where the next bit changes, which is found
+/// by binary search.  Splits are at the middle of the node's grid
+/// cell, and levels which would leave one side empty are skipped.
+/// Nodes are split until they have at most LEAF_SIZE points or reach
+/// MAX_DEPTH, which is the number of key bits.
+class KdTree {
+private:
+    static const int KEY_BITS = 32;
+
+    struct Node {
+        // Split axis, or -1 for leaves.
+        int axis;
+        // For internal nodes, the split value and the right child.
+        float split;
+        uint32_t right;
+        // For leaves, the range of points.
+        uint32_t begin, end;
+    };
+
+    std::vector<Node> m_nodes;
+    std::vector<IndexedPoint> m_points;
+    // Keys in the high half and point indexes in the low half, sorted,
+    // and a buffer for sorting them.
+    std::vector<uint64_t> m_keys, m_scratch;
+    // Positions of the grid planes on each axis.
+    std::vector<float> m_planes[3];
+    // Axis of each key bit, and the bit of the cell coordinate it
+    // comes from.
+    int m_level_axis[KEY_BITS], m_level_bit[KEY_BITS];
+
+    uint32_t build_node(uint32_t begin, uint32_t end, int level,
+                        const uint32_t *cell);
+
+public:
+    static const int LEAF_SIZE = 16;
+    /// Nodes at this depth are leaves, however many points they have.
+    static const int MAX_DEPTH = KEY_BITS;
+
+    /// Build the tree over a frame of points, using the given number
+    /// of threads.
+    void build(const Point *points, std::size_t count,
+               int thread_count = 1);
+
+    /// Find the k nearest points to a position, closest first.  If
+    /// the tree has fewer than k points, the rest of the output is
+    /// filled with index UINT32_MAX and infinite distance.  Distances
+    /// are squared.
+    void knn(const float *p, int k, uint32_t *index, float *dist2) const;
+
+    /// Find the points within a radius of a position, replacing the
+    /// contents of the output.
+    void radius_search(const float *p, float radius,
+                       std::vector<uint32_t> &out) const;
+
+    /// Run knn() for many positions, using the given number of
+    /// threads.  The output has k entries per query.
+    void knn_batch(const Point *queries, std::size_t count, int k,
+                   uint32_t *index, float *dist2, int thread_count) const;
+
+    std::size_t size() const { return m_points.size(); }
+};
+
+/// Run f(begin, end) over ranges which together cover [0, count), on
+/// up to the given number of threads.  The calling thread does the
+/// first range.
+template<class F>
+void parallel_ranges(std::size_t count, int thread_count, F f);
+
+//////////////////////////////////////////////////////////////////////
+// Implementation
+
+template<class F>
+void PointGrid::for_each_in_radius(const float *p, float radius,
+                                   F f) const {
+    if (m_points.empty()) {
+        return;
+    }
+    // Search the cells which overlap the cube around the sphere, which
+    // is at most eight cells if the radius is no more than the cell
+    // size.
+    int lo[3], hi[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = cell(p[k] - radius);
+        hi[k] = cell(p[k] + radius);
+    }
+    float r2 = radius * radius;
+    // Neighboring cells may share a bucket, so remember the buckets
+    // already searched.  Large searches just use a larger list.
+    std::size_t seen_small[27];
+    std::vector<std::size_t> seen_large;
+    std::size_t *seen = seen_small;
+    std::size_t cells = static_cast<std::size_t>(hi[0] - lo[0] + 1) *
+        (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+    if (cells > 27) {
+        seen_large.resize(cells);
+        seen = seen_large.data();
+    }
+    std::size_t seen_count = 0;
+    for (int z = lo[2]; z <= hi[2]; z++) {
+        for (int y = lo[1]; y <= hi[1]; y++) {
+            for (int x = lo[0]; x <= hi[0]; x++) {
+                std::size_t b = bucket(x, y, z);
+                bool dup = false;
+                for (std::size_t i = 0; i < seen_count && !dup; i++) {
+                    dup = seen[i] == b;
+                }
+                if (dup) {
+                    continue;
+                }
+                seen[seen_count++] = b;
+                const IndexedPoint *q = m_points.data() + m_start[b];
+                const IndexedPoint *end = m_points.data() + m_start[b + 1];
+                for (; q != end; q++) {
+                    float dx = q->v[0] - p[0], dy = q->v[1] - p[1];
+                    float dz = q->v[2] - p[2];
+                    float d2 = dx * dx + dy * dy + dz * dz;
+                    if (d2 <= r2) {
+                        f(*q, d2);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template<class F>
+void parallel_ranges(std::size_t count, int thread_count, F f) {
+    std::size_t n = thread_count > 1 ?
+        static_cast<std::size_t>(thread_count) : 1;
+    if (n > count) {
+        n = count ? count : 1;
+    }
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < n; i++) {
+        threads.emplace_back(f, count * i / n, count * (i + 1) / n);
+    }
+    f(0, count / n);
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include "track.hpp"
+#include "defs.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Cell coordinates are stored in 21 bits each, as in VoxelGrid.
+const int COORD_BITS = 21;
+const int64_t COORD_OFFSET = int64_t(1) << (COORD_BITS - 1);
+const uint64_t COORD_MASK = (uint64_t(1) << COORD_BITS) - 1;
+
+// Velocity variance of new tracks, in (m/s)^2.
+const float INITIAL_VELOCITY_VAR = 1.0f;
+
+}
+
+TrackerConfig default_tracker_config() {
+    TrackerConfig cfg;
+    cfg.gate = 0.5f;
+    cfg.process_noise = 3.0f;
+    cfg.measurement_noise = 0.03f;
+    cfg.confirm_hits = 3;
+    cfg.max_misses = 15;
+    return cfg;
+}
+
+Tracker::Tracker(const TrackerConfig &cfg)
+    : m_cfg(cfg), m_next_id(1), m_time(0.0), m_first(true) {
+    if (!(cfg.gate > 0.0f)) {
+        die("Tracker gate must be positive.");
+    }
+}
+
+uint64_t Tracker::cell_key(const float *p, int dx, int dy, int dz) const {
+    const int d[3] = { dx, dy, dz };
+    uint64_t key = 0;
+    for (int i = 0; i < 3; i++) {
+        int64_t c = static_cast<int64_t>(std::floor(p[i] / m_cfg.gate)) +
+            d[i] + COORD_OFFSET;
+        key |= (static_cast<uint64_t>(c) & COORD_MASK) << (i * COORD_BITS);
+    }
+    return key;
+}
+
+void Tracker::predict(Track &t, float dt) {
+    float q = m_cfg.process_noise * m_cfg.process_noise;
+    float dt2 = dt * dt;
+    for (int i = 0; i < 3; i++) {
+        float *c = t.cov[i];
+        t.position[i] += t.velocity[i] * dt;
+        c[0] += dt * (2.0f * c[1] + dt * c[2]) + q * dt2 * dt2 * 0.25f;
+        c[1] += dt * c[2] + q * dt2 * dt * 0.5f;
+        c[2] += q * dt2;
+    }
+}
+
+void Tracker::correct(Track &t, const Blob &b) {
+    float r = m_cfg.measurement_noise * m_cfg.measurement_noise;
+    for (int i = 0; i < 3; i++) {
+        float *c = t.cov[i];
+        float s = c[0] + r;
+        float k0 = c[0] / s, k1 = c[1] / s;
+        float y = b.centroid[i] - t.position[i];
+        t.position[i] += k0 * y;
+        t.velocity[i] += k1 * y;
+        c[2] -= k1 * c[1];
+        c[1] -= k0 * c[1];
+        c[0] -= k0 * c[0];
+        t.size[i] = b.max[i] - b.min[i];
+    }
+    t.pixel_count = b.pixel_count;
+}
+
+void Tracker::assign(const std::vector<Blob> &blobs) {
+    // Sort the objects by cell, so the objects near each track can be
+    // found by searching the neighboring cells.
+    m_cells.clear();
+    for (std::size_t j = 0; j < blobs.size(); j++) {
+        m_cells.emplace_back(cell_key(blobs[j].centroid, 0, 0, 0),
+                             static_cast<uint32_t>(j));
+    }
+    std::sort(m_cells.begin(), m_cells.end());
+
+    float gate2 = m_cfg.gate * m_cfg.gate;
+    m_candidates.clear();
+    for (std::size_t i = 0; i < m_tracks.size(); i++) {
+        const float *p = m_tracks[i].position;
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    std::pair<uint64_t, uint32_t> lo(
+                        cell_key(p, dx, dy, dz), 0);
+                    auto it = std::lower_bound(
+                        m_cells.begin(), m_cells.end(), lo);
+                    for (; it != m_cells.end() && it->first == lo.first;
+                         ++it) {
+                        const float *c = blobs[it->second].centroid;
+                        float d2 = 0.0f;
+                        for (int k = 0; k < 3; k++) {
+                            d2 += (c[k] - p[k]) * (c[k] - p[k]);
+                        }
+                        if (d2 <= gate2) {
+                            Candidate cand;
+                            cand.cost = d2;
+                            cand.track = static_cast<uint32_t>(i);
+                            cand.blob = it->second;
+                            m_candidates.push_back(cand);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Assign the closest pairs first.
+    std::sort(m_candidates.begin(), m_candidates.end(),
+              [](const Candidate &a, const Candidate &b) {
+                  if (a.cost != b.cost) {
+                      return a.cost < b.cost;
+                  }
+                  if (a.track != b.track) {
+                      return a.track < b.track;
+                  }
+                  return a.blob < b.blob;
+              });
+    m_track_blob.assign(m_tracks.size(), -1);
+    m_blob_used.assign(blobs.size(), 0);
+    for (const Candidate &c : m_candidates) {
+        if (m_track_blob[c.track] < 0 && !m_blob_used[c.blob]) {
+            m_track_blob[c.track] = static_cast<int>(c.blob);
+            m_blob_used[c.blob] = 1;
+        }
+    }
+}
+
+void Tracker::update(const std::vector<Blob> &blobs, double time) {
+    float dt = m_first ? 0.0f :
+        static_cast<float>(std::max(time - m_time, 0.0));
+    m_first = false;
+    m_time = time;
+    for (Track &t : m_tracks) {
+        predict(t, dt);
+        t.age++;
+    }
+
+    assign(blobs);
+    for (std::size_t i = 0; i < m_tracks.size(); i++) {
+        Track &t = m_tracks[i];
+        if (m_track_blob[i] >= 0) {
+            correct(t, blobs[m_track_blob[i]]);
+            t.hits++;
+            t.misses = 0;
+            if (t.hits >= m_cfg.confirm_hits) {
+                t.confirmed = true;
+            }
+        } else {
+            t.hits = 0;
+            t.misses++;
+        }
+    }
+    int max_misses = m_cfg.max_misses;
+    m_tracks.erase(
+        std::remove_if(m_tracks.begin(), m_tracks.end(),
+                       [max_misses](const Track &t) {
+                           return t.misses > (t.confirmed ? max_misses : 0);
+                       }),
+        m_tracks.end());
+
+    float r = m_cfg.measurement_noise * m_cfg.measurement_noise;
+    for (std::size_t j = 0; j < blobs.size(); j++) {
+        if (m_blob_used[j]) {
+            continue;
+        }
+        const Blob &b = blobs[j];
+        Track t;
+        t.id = m_next_id++;
+        for (int i = 0; i < 3; i++) {
+            t.position[i] = b.centroid[i];
+            t.velocity[i] = 0.0f;
+            t.size[i] = b.max[i] - b.min[i];
+            t.cov[i][0] = r;
+            t.cov[i][1] = 0.0f;
+            t.cov[i][2] = INITIAL_VELOCITY_VAR;
+        }
+        t.pixel_count = b.pixel_count;
+        t.age = 0;
+        t.hits = 1;
+        t.misses = 0;
+        t.confirmed = t.hits >= m_cfg.confirm_hits;
+        m_tracks.push_back(t);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+// TrackWriter
+
+TrackWriter::TrackWriter() : m_fp(nullptr), m_count(0) {}
+
+TrackWriter::~TrackWriter() {
+    if (m_fp) {
+        std::fclose(m_fp);
+    }
+}
+
+void TrackWriter::open(const std::string &path) {
+    m_fp = std::fopen(path.c_str(), "w");
+    if (!m_fp) {
+        die("Could not open file: %s", path.c_str());
+    }
+    m_path = path;
+    m_count = 0;
+    std::fputs("timestamp,id,x,y,z,vx,vy,vz,size_x,size_y,size_z,"
+               "pixels,age,misses\n", m_fp);
+}
+
+void TrackWriter::write(uint64_t timestamp,
+                        const std::vector<Track> &tracks) {
+    for (const Track &t : tracks) {
+        if (!t.confirmed) {
+            continue;
+        }
+        std::fprintf(m_fp,
+                     "%llu,%u,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f,"
+                     "%.3f,%.3f,%.3f,%u,%d,%d\n",
+                     static_cast<unsigned long long>(timestamp), t.id,
+                     t.position[0], t.position[1], t.position[2],
+                     t.velocity[0], t.velocity[1], t.velocity[2],
+                     t.size[0], t.size[1], t.size[2],
+                     t.pixel_count, t.age, t.misses);
+        m_count++;
+    }
+}
+
+void TrackWriter::close() {
+    if (m_fp && std::fclose(m_fp)) {
+        m_fp = nullptr;
+        die("Could not write file: %s", m_path.c_str());
+    }
+    m_fp = nullptr;
+}
@@ -0,0 +1,122 @@
+#ifndef PCTRACK_TRACK_HPP
+#define PCTRACK_TRACK_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "segment.hpp"
+
+/// Parameters for the object tracker.
+struct TrackerConfig {
+    /// Largest distance between a track's predicted position and an
+    /// object assigned to it, in meters.
+    float gate;
+    /// Standard deviation of the acceleration of objects, in m/s^2.
+    float process_noise;
+    /// Standard deviation of measured object positions, in meters.
+    float measurement_noise;
+    /// Number of consecutive frames in which a new track must be seen
+    /// before it is confirmed.
+    int confirm_hits;
+    /// Number of consecutive frames in which a confirmed track can be
+    /// missed before it is deleted.
+    int max_misses;
+};
+
+/// Get the default tracker parameters.
+TrackerConfig default_tracker_config();
+
+/// An object which is tracked over time.  Positions are in meters.
+struct Track {
+    /// Identifier, unique over the life of the tracker.
+    unsigned id;
+    /// Filtered position and velocity.
+    float position[3];
+    float velocity[3];
+    /// Extent of the last object assigned to the track.
+    float size[3];
+    /// Pixel count of the last object assigned to the track.
+    unsigned pixel_count;
+    /// Number of frames since the track was created.
+    int age;
+    /// Number of consecutive frames in which the track was seen, and
+    /// in which it was missed.
+    int hits, misses;
+    /// Whether the track has been seen for long enough to report.
+    bool confirmed;
+    /// Kalman filter covariance for each axis, as position variance,
+    /// covariance of position and velocity, and velocity variance.
+    float cov[3][3];
+};
+
+/// Multi-object tracker.  Each track has a constant-velocity Kalman
+/// filter per axis.  Each frame, tracks are predicted forward and
+/// assigned to objects greedily in order of distance, considering only
+/// pairs within the gate, which are found with a grid of cells the
+/// size of the gate.  Objects which are not assigned start new tracks,
+/// and tracks which are missed for too long are deleted.  Scratch
+/// buffers are kept between frames.
+class Tracker {
+private:
+    struct Candidate {
+        float cost;
+        uint32_t track, blob;
+    };
+
+    TrackerConfig m_cfg;
+    std::vector<Track> m_tracks;
+    unsigned m_next_id;
+    double m_time;
+    bool m_first;
+    std::vector<std::pair<uint64_t, uint32_t>> m_cells;
+    std::vector<Candidate> m_candidates;
+    std::vector<int> m_track_blob;
+    std::vector<char> m_blob_used;
+
+    uint64_t cell_key(const float *p, int dx, int dy, int dz) const;
+    void predict(Track &t, float dt);
+    void correct(Track &t, const Blob &b);
+    void assign(const std::vector<Blob> &blobs);
+
+public:
+    explicit Tracker(const TrackerConfig &cfg);
+
+    /// Update the tracks with the objects in a frame.  Time is in
+    /// seconds, and must not decrease.
+    void update(const std::vector<Blob> &blobs, double time);
+
+    /// Get all current tracks, including ones not yet confirmed.
+    const std::vector<Track> &tracks() const { return m_tracks; }
+};
+
+/// Writes confirmed tracks to a CSV file, one row per track per frame.
+/// Errors are fatal.
+class TrackWriter {
+private:
+    std::FILE *m_fp;
+    std::string m_path;
+    unsigned long m_count;
+
+public:
+    TrackWriter();
+    TrackWriter(const TrackWriter &) = delete;
+    ~TrackWriter();
+    TrackWriter &operator=(const TrackWriter &) = delete;
+
+    /// Create a file and write the column names.
+    void open(const std::string &path);
+
+    /// Write the confirmed tracks for a frame.  The timestamp is in
+    /// ticks of the device clock.
+    void write(uint64_t timestamp, const std::vector<Track> &tracks);
+
+    void close();
+
+    /// Get the number of rows written so far.
+    unsigned long count() const { return m_count; }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "voxel.hpp"
+#include "defs.hpp"
+
+#include <cmath>
+
+namespace {
+
+// Cell coordinates are stored in 21 bits each, which covers about
+// 10 km at 1 cm cells.
+const int COORD_BITS = 21;
+const int64_t COORD_OFFSET = int64_t(1) << (COORD_BITS - 1);
+const uint64_t COORD_MASK = (uint64_t(1) << COORD_BITS) - 1;
+
+inline uint64_t cell_coord(float v, float scale) {
+    int64_t c = static_cast<int64_t>(std::floor(v * scale)) + COORD_OFFSET;
+    return static_cast<uint64_t>(c) & COORD_MASK;
+}
+
+}
+
+VoxelGrid::VoxelGrid(float cell_size)
+    : m_cell_size(cell_size), m_scale(1.0f / cell_size),
+      m_mask(0), m_shift(64), m_stamp(0) {
+    if (!(cell_size > 0.0f)) {
+        die("Voxel size must be positive.");
+    }
+}
+
+void VoxelGrid::reserve(std::size_t count) {
+    // Keep the load factor at most one half.
+    std::size_t size = 16;
+    int bits = 4;
+    while (size < count * 2) {
+        size *= 2;
+        bits++;
+    }
+    if (size > m_cells.size()) {
+        m_cells.assign(size, Cell());
+        m_mask = size - 1;
+        m_shift = 64 - bits;
+        m_stamp = 0;
+    }
+    if (m_order.size() < count) {
+        m_order.resize(count);
+    }
+}
+
+std::size_t VoxelGrid::apply(const Point *in, std::size_t count,
+                             Point *out) {
+    reserve(count);
+    // Cells from earlier frames are stale, rather than cleared.
+    if (++m_stamp == 0) {
+        for (Cell &c : m_cells) {
+            c.stamp = 0;
+        }
+        m_stamp = 1;
+    }
+
+    std::size_t cell_count = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        const Point &p = in[i];
+        uint64_t key = cell_coord(p.v[0], m_scale) |
+            (cell_coord(p.v[1], m_scale) << COORD_BITS) |
+            (cell_coord(p.v[2], m_scale) << (2 * COORD_BITS));
+        std::size_t slot = static_cast<std::size_t>(
+            (key * 0x9e3779b97f4a7c15ull) >> m_shift);
+        Cell *c;
+        while (true) {
+            c = &m_cells[slot];
+            if (c->stamp != m_stamp) {
+                c->key = key;
+                c->stamp = m_stamp;
+                c->count = 0;
+                c->sum[0] = c->sum[1] = c->sum[2] = 0.0f;
+                c->color[0] = c->color[1] = c->color[2] = 0;
+                m_order[cell_count++] = static_cast<uint32_t>(slot);
+                break;
+            }
+            if (c->key == key) {
+                break;
+            }
+            slot = (slot + 1) & m_mask;
+        }
+        c->count++;
+        c->sum[0] += p.v[0];
+        c->sum[1] += p.v[1];
+        c->sum[2] += p.v[2];
+        c->color[0] += p.color & 0xff;
+        c->color[1] += (p.color >> 8) & 0xff;
+        c->color[2] += (p.color >> 16) & 0xff;
+    }
+
+    for (std::size_t i = 0; i < cell_count; i++) {
+        const Cell &c = m_cells[m_order[i]];
+        float inv = 1.0f / static_cast<float>(c.count);
+        unsigned half = c.count / 2;
+        Point &p = out[i];
+        p.v[0] = c.sum[0] * inv;
+        p.v[1] = c.sum[1] * inv;
+        p.v[2] = c.sum[2] * inv;
+        p.color = ((c.color[0] + half) / c.count) |
+            (((c.color[1] + half) / c.count) << 8) |
+            (((c.color[2] + half) / c.count) << 16);
+    }
+    return cell_count;
+}
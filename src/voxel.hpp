@@ -0,0 +1,47 @@
+#ifndef PCTRACK_VOXEL_HPP
+#define PCTRACK_VOXEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "point.hpp"
+
+/// Voxel grid filter, which replaces the points in each cubic cell
+/// with one point at their average position and color.  Cells are
+/// found with an open-addressing hash table which is kept between
+/// frames, so filtering does not allocate once the table is large
+/// enough.
+class VoxelGrid {
+private:
+    struct Cell {
+        uint64_t key;
+        unsigned stamp;
+        unsigned count;
+        float sum[3];
+        unsigned color[3];
+    };
+
+    float m_cell_size, m_scale;
+    std::vector<Cell> m_cells;
+    std::size_t m_mask;
+    int m_shift;
+    unsigned m_stamp;
+    std::vector<uint32_t> m_order;
+
+    void reserve(std::size_t count);
+
+public:
+    /// Create a filter with the given cell size, in meters.
+    explicit VoxelGrid(float cell_size);
+
+    /// Filter points.  Output points are in the order in which their
+    /// cells first appear in the input.  The output must have room for
+    /// count points, and may be the same as the input.  Returns the
+    /// number of output points.
+    std::size_t apply(const Point *in, std::size_t count, Point *out);
+
+    float cell_size() const { return m_cell_size; }
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "sync.hpp"
+
+int main(int argc, char *argv[]) {
+    const char *offsets_path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--offsets" && i + 1 < argc) {
+            offsets_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() < 2) {
+        die("Usage: ts_align [--offsets FILE] SETTINGS.json SIGNALS...");
+    }
+
+    // Streams are numbered in the order of the files, and within each
+    // file in order.
+    Config cfg = read_config(args[0]);
+    std::vector<ActivitySignal> signals;
+    for (std::size_t i = 1; i < args.size(); i++) {
+        std::size_t first = signals.size();
+        if (!read_signals(args[i], signals)) {
+            std::fprintf(stderr, "Error: Failed to read signals: %s\n",
+                         args[i]);
+            return 1;
+        }
+        for (std::size_t j = first; j < signals.size(); j++) {
+            const ActivitySignal &s = signals[j];
+            std::printf("Stream %zu: %s, %zu samples at %.2f/s, %.1f s\n",
+                        j, args[i], s.size(), s.rate, s.size() / s.rate);
+        }
+    }
+
+    std::vector<const ActivitySignal *> streams;
+    for (const ActivitySignal &s : signals) {
+        streams.push_back(&s);
+    }
+    std::vector<StreamOffset> offsets = estimate_offsets(cfg.sync, streams);
+    print_offsets(stdout, offsets, false);
+    if (offsets_path) {
+        std::FILE *fp = std::fopen(offsets_path, "w");
+        if (!fp) {
+            die("Failed to create offset file.");
+        }
+        print_offsets(fp, offsets, true);
+        if (std::fclose(fp)) {
+            die("Failed to write offset file.");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "blobs.hpp"
+#include "config.hpp"
+#include "foreground.hpp"
+
+// Benchmark of reduced scale processing.  Each frame of a video is
+// processed at full resolution over the whole frame, which is the
+// reference, and at each scale over the video's region of interest.
+// The blobs of each are compared with the reference, so the speedup
+// of each scale can be weighed against the accuracy of the centroids.
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+// Number of frames processed by default.
+const int BENCH_FRAMES = 600;
+// Number of frames which are processed but not measured, while the
+// background models settle.
+const int BENCH_WARMUP = 100;
+// Reference blobs smaller than this are not compared, in pixels at
+// full resolution.  Specks this small are expected to vanish at low
+// scales, and are not used for alignment anyway.
+const double MIN_AREA = 50.0;
+// A reference blob is matched by the nearest blob within twice its
+// major axis, or within this many pixels.
+const double MATCH_DISTANCE = 4.0;
+
+const double DEFAULT_SCALES[] = { 1.0, 0.75, 0.5, 0.33, 0.25 };
+
+// One way of processing the video, and its results.
+struct Variant {
+    double scale;
+    std::unique_ptr<ForegroundMask> fg;
+    cv::Mat mask;
+    std::vector<Blob> blobs;
+    std::vector<double> times;
+    // Distance from each matched reference blob to its match.
+    std::vector<double> errors;
+    // Distance between the centroids of the whole foreground.
+    std::vector<double> fg_errors;
+    long long blob_count;
+    long long ref_count;
+    long long missed;
+
+    Variant() : scale(1.0), blob_count(0), ref_count(0), missed(0) { }
+};
+
+double mean(const std::vector<double> &x) {
+    double sum = 0.0;
+    for (double v : x) {
+        sum += v;
+    }
+    return x.empty() ? 0.0 : sum / x.size();
+}
+
+// Get a percentile.  The values are sorted.
+double percentile(std::vector<double> &x, double fraction) {
+    if (x.empty()) {
+        return 0.0;
+    }
+    std::sort(x.begin(), x.end());
+    std::size_t i = static_cast<std::size_t>(fraction * x.size());
+    return x[std::min(i, x.size() - 1)];
+}
+
+// Get the area-weighted centroid of the blobs whose centers are in a
+// region.  Returns false if there are none.
+bool blob_centroid(const std::vector<Blob> &blobs, const cv::Rect &region,
+                   double &x, double &y) {
+    double area = 0.0;
+    x = 0.0;
+    y = 0.0;
+    for (const Blob &b : blobs) {
+        if (region.contains(cv::Point(b.x, b.y))) {
+            x += b.x * b.area;
+            y += b.y * b.area;
+            area += b.area;
+        }
+    }
+    if (!(area > 0.0)) {
+        return false;
+    }
+    x /= area;
+    y /= area;
+    return true;
+}
+
+// Compare the blobs of a variant with the reference, for reference
+// blobs inside the variant's region.
+void compare(const std::vector<Blob> &ref, Variant &v) {
+    cv::Rect region = v.fg->region();
+    for (const Blob &r : ref) {
+        if (r.area < MIN_AREA ||
+            !region.contains(cv::Point(r.x, r.y))) {
+            continue;
+        }
+        v.ref_count++;
+        double best = HUGE_VAL;
+        for (const Blob &b : v.blobs) {
+            best = std::min<double>(best, std::hypot(b.x - r.x, b.y - r.y));
+        }
+        if (best <= std::max(2.0 * r.major, MATCH_DISTANCE)) {
+            v.errors.push_back(best);
+        } else {
+            v.missed++;
+        }
+    }
+    double rx, ry, vx, vy;
+    if (blob_centroid(ref, region, rx, ry) &&
+        blob_centroid(v.blobs, region, vx, vy)) {
+        v.fg_errors.push_back(std::hypot(vx - rx, vy - ry));
+    }
+}
+
+std::vector<double> parse_scales(const char *str) {
+    std::vector<double> scales;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        double scale = std::atof(item.c_str());
+        if (!(scale > 0.0 && scale <= 1.0)) {
+            die("Scale must be between 0 and 1.");
+        }
+        scales.push_back(scale);
+    }
+    if (scales.empty()) {
+        die("No scales given.");
+    }
+    return scales;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    int frame_limit = BENCH_FRAMES;
+    std::vector<double> scales(
+        DEFAULT_SCALES,
+        DEFAULT_SCALES + sizeof(DEFAULT_SCALES) / sizeof(*DEFAULT_SCALES));
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frame_limit = std::atoi(argv[++i]);
+            if (frame_limit <= BENCH_WARMUP) {
+                die("Frame count must be more than the warmup.");
+            }
+        } else if (arg == "--scales" && i + 1 < argc) {
+            scales = parse_scales(argv[++i]);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        die("Usage: ts_bench [--frames N] [--scales S,S...] "
+            "SETTINGS.json VIDEO");
+    }
+
+    Config cfg = read_config(args[0]);
+    cv::VideoCapture cap;
+    if (!cap.open(args[1])) {
+        die("Failed to open video.");
+    }
+    cv::Size frame_size(cap.get(CV_CAP_PROP_FRAME_WIDTH),
+                        cap.get(CV_CAP_PROP_FRAME_HEIGHT));
+    if (frame_size.width <= 0 || frame_size.height <= 0) {
+        die("Unknown frame size.");
+    }
+    // Time each variant on one thread, so that small frames are not
+    // penalized for parallelizing worse.
+    cv::setNumThreads(1);
+
+    VideoConfig video = video_config(cfg, args[1]);
+    std::vector<Variant> variants(scales.size() + 1);
+    {
+        VideoConfig full = video;
+        for (int &x : full.roi) {
+            x = 0;
+        }
+        full.scale = 1.0;
+        variants[0].fg.reset(
+            new ForegroundMask(cfg.bg_subtract, full, frame_size));
+    }
+    for (std::size_t i = 0; i < scales.size(); i++) {
+        Variant &v = variants[i + 1];
+        VideoConfig vc = video;
+        vc.scale = scales[i];
+        v.scale = scales[i];
+        v.fg.reset(new ForegroundMask(cfg.bg_subtract, vc, frame_size));
+    }
+
+    cv::Mat frame;
+    std::vector<std::vector<cv::Point>> contours;
+    int frameno = 0;
+    for (; frameno < frame_limit; frameno++) {
+        if (!cap.read(frame) || !frame.data) {
+            break;
+        }
+        bool timed = frameno >= BENCH_WARMUP;
+        for (Variant &v : variants) {
+            Clock::time_point t0 = Clock::now();
+            v.fg->apply(frame, v.mask);
+            find_blobs(v.mask, contours, v.blobs);
+            v.fg->map_blobs(v.blobs);
+            Clock::time_point t1 = Clock::now();
+            if (timed) {
+                v.times.push_back(seconds(t1 - t0));
+                v.blob_count += v.blobs.size();
+            }
+        }
+        if (timed) {
+            for (std::size_t i = 1; i < variants.size(); i++) {
+                compare(variants[0].blobs, variants[i]);
+            }
+        }
+        std::printf("\rframe %d", frameno);
+        std::fflush(stdout);
+    }
+    std::putchar('\n');
+    int timed = frameno - BENCH_WARMUP;
+    if (timed <= 0) {
+        die("Video is shorter than the warmup.");
+    }
+
+    // Errors are in pixels at full resolution.
+    cv::Rect region = variants.back().fg->region();
+    std::printf("%s: %d frames at %dx%d, region %dx%d+%d+%d\n", args[1],
+                timed, frame_size.width, frame_size.height, region.width,
+                region.height, region.x, region.y);
+    std::printf("%-10s %9s %8s %7s %9s %9s %7s %9s\n", "variant",
+                "ms/frame", "speedup", "blobs", "err mean", "err p90",
+                "missed", "fg err");
+    double ref_time = mean(variants[0].times);
+    for (std::size_t i = 0; i < variants.size(); i++) {
+        Variant &v = variants[i];
+        char name[16];
+        if (i == 0) {
+            std::snprintf(name, sizeof(name), "full");
+        } else {
+            std::snprintf(name, sizeof(name), "scale %.2f", v.scale);
+        }
+        double t = mean(v.times);
+        std::printf("%-10s %9.3f %7.2fx %7.2f", name, t * 1000.0,
+                    t > 0.0 ? ref_time / t : 0.0,
+                    static_cast<double>(v.blob_count) / timed);
+        if (i == 0) {
+            std::printf(" %9s %9s %7s %9s\n", "-", "-", "-", "-");
+            continue;
+        }
+        double missed = v.ref_count ?
+            100.0 * v.missed / v.ref_count : 0.0;
+        std::printf(" %9.2f %9.2f %6.1f%% %9.2f\n", mean(v.errors),
+                    percentile(v.errors, 0.9), missed, mean(v.fg_errors));
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "blobs.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void find_blobs(cv::Mat &mask,
+                std::vector<std::vector<cv::Point>> &contours,
+                std::vector<Blob> &blobs) {
+    cv::findContours(
+        mask,
+        contours,
+        cv::RETR_EXTERNAL,
+        cv::CHAIN_APPROX_SIMPLE);
+    blobs.clear();
+    for (const auto &contour : contours) {
+        auto m = cv::moments(contour);
+        if (!(m.m00 > 0.0)) {
+            continue;
+        }
+        // Axes are the square roots of the eigenvalues of the
+        // covariance.
+        double a = m.mu20 / m.m00, b = m.mu11 / m.m00, c = m.mu02 / m.m00;
+        double mid = 0.5 * (a + c);
+        double r = std::sqrt(0.25 * (a - c) * (a - c) + b * b);
+        Blob blob;
+        blob.x = m.m10 / m.m00;
+        blob.y = m.m01 / m.m00;
+        blob.major = std::sqrt(mid + r);
+        blob.minor = std::sqrt(std::max(mid - r, 0.0));
+        blob.angle = 0.5 * std::atan2(2.0 * b, a - c) * (180.0 / M_PI);
+        blob.area = m.m00;
+        blobs.push_back(blob);
+    }
+}
+
+BlobWriter::BlobWriter() : m_fp(nullptr), m_binary(false) { }
+
+BlobWriter::~BlobWriter() {
+    close();
+}
+
+bool BlobWriter::open(const char *path, bool binary) {
+    close();
+    m_fp = std::fopen(path, binary ? "wb" : "w");
+    if (!m_fp) {
+        return false;
+    }
+    m_binary = binary;
+    if (binary) {
+        BlobFileHeader head;
+        std::memcpy(head.magic, BLOB_MAGIC, sizeof(head.magic));
+        head.version = BLOB_VERSION;
+        head.record_size = sizeof(BlobRecord);
+        std::fwrite(&head, sizeof(head), 1, m_fp);
+    } else {
+        std::fputs("video,frame,blob,x,y,major,minor,angle,area\n", m_fp);
+    }
+    return true;
+}
+
+bool BlobWriter::close() {
+    if (!m_fp) {
+        return true;
+    }
+    bool ok = !std::ferror(m_fp);
+    ok = !std::fclose(m_fp) && ok;
+    m_fp = nullptr;
+    return ok;
+}
+
+void BlobWriter::write(int video, int frame,
+                       const std::vector<Blob> &blobs) {
+    if (blobs.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_binary) {
+        for (const Blob &blob : blobs) {
+            BlobRecord rec;
+            rec.video = video;
+            rec.frame = frame;
+            rec.blob = blob;
+            std::fwrite(&rec, sizeof(rec), 1, m_fp);
+        }
+    } else {
+        for (std::size_t i = 0; i < blobs.size(); i++) {
+            const Blob &b = blobs[i];
+            std::fprintf(m_fp, "%d,%d,%zu,%.2f,%.2f,%.2f,%.2f,%.1f,%.0f\n",
+                         video, frame, i, b.x, b.y, b.major, b.minor,
+                         b.angle, b.area);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef TIMESYNC_BLOBS_HPP
+#define TIMESYNC_BLOBS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Blobs found in the foreground mask of a video, and the files they
+// are written to.
+//
+// Blobs are written either as CSV, with a header row, or as binary
+// records.  A binary file starts with BlobFileHeader, followed by one
+// BlobRecord per blob.  All values are little-endian.  Videos are
+// numbered from zero in the order they were given.  Frames without
+// blobs have no rows.
+
+/// Magic number at the start of a binary blob file.
+const char BLOB_MAGIC[8] = {'T', 'S', 'B', 'L', 'O', 'B', 'S', '\0'};
+
+const uint32_t BLOB_VERSION = 1;
+
+/// A connected region of the foreground, in pixels.
+struct Blob {
+    /// Centroid.
+    float x, y;
+    /// Standard deviations along the major and minor axes.
+    float major, minor;
+    /// Angle of the major axis from the x axis, in degrees.
+    float angle;
+    /// Area, in pixels.
+    float area;
+};
+
+struct BlobFileHeader {
+    char magic[8];
+    uint32_t version;
+    /// Size of each record, in bytes.
+    uint32_t record_size;
+};
+
+struct BlobRecord {
+    uint32_t video;
+    uint32_t frame;
+    Blob blob;
+};
+
+static_assert(sizeof(BlobFileHeader) == 16, "bad blob header size");
+static_assert(sizeof(BlobRecord) == 32, "bad blob record size");
+
+/// Find the blobs in a foreground mask.  The mask is modified.  Blobs
+/// with zero area are skipped.  The contour vector is scratch space.
+void find_blobs(cv::Mat &mask,
+                std::vector<std::vector<cv::Point>> &contours,
+                std::vector<Blob> &blobs);
+
+/// Writes blobs from any number of threads to one file.
+class BlobWriter {
+private:
+    std::FILE *m_fp;
+    bool m_binary;
+    std::mutex m_lock;
+
+public:
+    BlobWriter();
+    BlobWriter(const BlobWriter &) = delete;
+    ~BlobWriter();
+    BlobWriter &operator=(const BlobWriter &) = delete;
+
+    /// Create the file.  Returns false on failure.
+    bool open(const char *path, bool binary);
+
+    /// Close the file.  Returns false if writing failed.
+    bool close();
+
+    /// Write the blobs of one frame.  Each frame's blobs are written
+    /// together, but frames from different videos may be interleaved.
+    void write(int video, int frame, const std::vector<Blob> &blobs);
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "config.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <rapidjson/document.h>
+
+using rapidjson::Value;
+
+void die(const char *msg) {
+    std::fprintf(stderr, "Error: %s\n", msg);
+    std::exit(1);
+}
+
+namespace {
+
+void parse_config(BgSubtractConfig &cfg, const Value &value) {
+    cfg.history = value["history"].GetInt();
+    cfg.var_threshold = value["var_threshold"].GetDouble();
+    cfg.erosion = value["erosion"].GetInt();
+    cfg.dilation = value["dilation"].GetInt();
+    cfg.scale = 1.0;
+    if (value.HasMember("scale")) {
+        cfg.scale = value["scale"].GetDouble();
+    }
+    if (!(cfg.scale > 0.0 && cfg.scale <= 1.0)) {
+        die("Scale must be between 0 and 1.");
+    }
+}
+
+// Missing values are taken from the default settings.
+void parse_config(VideoConfig &cfg, const Value &value,
+                  const BgSubtractConfig &defaults) {
+    for (int &x : cfg.roi) {
+        x = 0;
+    }
+    cfg.scale = defaults.scale;
+    if (value.HasMember("roi")) {
+        const Value &roi = value["roi"];
+        if (!roi.IsArray() || roi.Size() != 4) {
+            die("Region of interest must be [x, y, width, height].");
+        }
+        for (rapidjson::SizeType i = 0; i < 4; i++) {
+            cfg.roi[i] = roi[i].GetInt();
+        }
+        if (cfg.roi[0] < 0 || cfg.roi[1] < 0 || cfg.roi[2] < 0 ||
+            cfg.roi[3] < 0) {
+            die("Region of interest must not be negative.");
+        }
+    }
+    if (value.HasMember("scale")) {
+        cfg.scale = value["scale"].GetDouble();
+    }
+    if (!(cfg.scale > 0.0 && cfg.scale <= 1.0)) {
+        die("Scale must be between 0 and 1.");
+    }
+}
+
+void parse_config(SyncConfig &cfg, const Value &value) {
+    cfg.max_offset = value["max_offset"].GetDouble();
+    cfg.detrend = value["detrend"].GetDouble();
+    cfg.segments = value["segments"].GetInt();
+    cfg.segment_search = value["segment_search"].GetDouble();
+}
+
+void parse_config(Config &cfg, const Value &value) {
+    parse_config(cfg.bg_subtract, value["bg_subtract"]);
+    cfg.sync = default_sync_config();
+    if (value.HasMember("sync")) {
+        parse_config(cfg.sync, value["sync"]);
+    }
+    if (value.HasMember("videos")) {
+        const Value &videos = value["videos"];
+        for (auto it = videos.MemberBegin(); it != videos.MemberEnd();
+             ++it) {
+            parse_config(cfg.videos[it->name.GetString()], it->value,
+                         cfg.bg_subtract);
+        }
+    }
+}
+
+std::string read_file(const char *path) {
+    std::ifstream fp(path);
+    std::string str;
+    fp.seekg(0, std::ios::end);
+    str.reserve(fp.tellg());
+    fp.seekg(0, std::ios::beg);
+    str.assign(std::istreambuf_iterator<char>(fp),
+               std::istreambuf_iterator<char>());
+    return str;
+}
+
+}
+
+Config read_config(const char *path) {
+    rapidjson::Document doc;
+    {
+        std::string contents = read_file(path);
+        doc.Parse(contents.c_str());
+    }
+    Config cfg;
+    parse_config(cfg, doc);
+    return cfg;
+}
+
+VideoConfig video_config(const Config &cfg, const char *path) {
+    std::string name = path;
+    auto it = cfg.videos.find(name);
+    if (it == cfg.videos.end()) {
+        std::size_t slash = name.find_last_of('/');
+        if (slash != std::string::npos) {
+            it = cfg.videos.find(name.substr(slash + 1));
+        }
+    }
+    if (it != cfg.videos.end()) {
+        return it->second;
+    }
+    VideoConfig video;
+    for (int &x : video.roi) {
+        x = 0;
+    }
+    video.scale = cfg.bg_subtract.scale;
+    return video;
+}
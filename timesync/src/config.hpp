@@ -0,0 +1,49 @@
+#ifndef TIMESYNC_CONFIG_HPP
+#define TIMESYNC_CONFIG_HPP
+
+#include <map>
+#include <string>
+
+#include "sync.hpp"
+
+// Settings for the timesync tools, read from a JSON file.  See
+// settings.json for an example.
+
+__attribute__((noreturn))
+void die(const char *msg);
+
+struct BgSubtractConfig {
+    int history;
+    double var_threshold;
+    /// Kernel radii, in pixels at full resolution.
+    int erosion;
+    int dilation;
+    /// Scale at which frames are processed, from 0 to 1.
+    double scale;
+};
+
+/// Settings for one video.
+struct VideoConfig {
+    /// Region of interest, as x, y, width and height in pixels.  Zero
+    /// width or height means the whole frame.
+    int roi[4];
+    /// Scale at which frames are processed.
+    double scale;
+};
+
+struct Config {
+    BgSubtractConfig bg_subtract;
+    SyncConfig sync;
+    /// Per-video settings, by path or file name.
+    std::map<std::string, VideoConfig> videos;
+};
+
+/// Read the settings file.
+Config read_config(const char *path);
+
+/// Get the settings for a video.  Settings are found by the video's
+/// path, or else by its file name.  Videos without settings use the
+/// whole frame at the default scale.
+VideoConfig video_config(const Config &cfg, const char *path);
+
+#endif
@@ -1,63 +1,38 @@
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <opencv2/opencv.hpp>
-#include <rapidjson/document.h>
 
-using rapidjson::Value;
+#include "blobs.hpp"
+#include "config.hpp"
+#include "foreground.hpp"
+#include "sync.hpp"
 
-void die(const char *msg) {
-    std::fprintf(stderr, "Error: %s\n", msg);
-    std::exit(1);
-}
-
-struct BgSubtractConfig {
-    int history;
-    double var_threshold;
-    int erosion;
-    int dilation;
-};
+typedef std::chrono::steady_clock Clock;
 
-struct Config {
-    BgSubtractConfig bg_subtract;
-};
-
-void parse_config(BgSubtractConfig &cfg, const Value &value) {
-    cfg.history = value["history"].GetInt();
-    cfg.var_threshold = value["var_threshold"].GetDouble();
-    cfg.erosion = value["erosion"].GetInt();
-    cfg.dilation = value["dilation"].GetInt();
+double seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
 }
 
-void parse_config(Config &cfg, const Value &value) {
-    parse_config(cfg.bg_subtract, value["bg_subtract"]);
-}
-
-std::string read_file(const char *path) {
-    std::ifstream fp(path);
-    std::string str;
-    fp.seekg(0, std::ios::end);
-    str.reserve(fp.tellg());
-    fp.seekg(0, std::ios::beg);
-    str.assign(std::istreambuf_iterator<char>(fp),
-               std::istreambuf_iterator<char>());
-    return str;
-}
-
-Config read_config(const char *path) {
-    rapidjson::Document doc;
-    {
-        std::string contents = read_file(path);
-        doc.Parse(contents.c_str());
-    }
-    Config cfg;
-    parse_config(cfg, doc);
-    return cfg;
-}
+// Time between progress updates.
+const Clock::duration PROGRESS_INTERVAL = std::chrono::milliseconds(250);
+// Time to wait for a key between preview updates, in ms.
+const int PREVIEW_INTERVAL = 30;
+// Frame rate of videos which do not give one.
+const double DEFAULT_FRAME_RATE = 30.0;
+// Number of frames in flight in each video's pipeline.
+const int PIPELINE_SLOTS = 4;
 
 struct MatInfo {
     const cv::Mat &m;
@@ -85,16 +60,6 @@ MatInfo mat_info(const cv::Mat &m) {
     return MatInfo{m};
 }
 
-cv::Mat get_kernel(int d) {
-    if (d <= 0) {
-        return cv::Mat();
-    }
-    return cv::getStructuringElement(
-        cv::MORPH_RECT,
-        cv::Size(d*2+1, d*2+1),
-        cv::Point(d, d));
-}
-
 const unsigned char COLORS[][3] = {
     { 0, 255, 255 },
     { 255, 0, 255 },
@@ -114,85 +79,404 @@ cv::Scalar color(int i) {
     return cv::Scalar(c[0], c[1], c[2]);
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        die("Usage: ts_extract SETTINGS.json VIDEO...");
+// A video and the progress of its worker.  The worker updates the
+// counters, and the main thread reads them to show progress.
+struct VideoJob {
+    enum State { WAITING, RUNNING, DONE, FAILED };
+
+    const char *path;
+    std::atomic<int> state;
+    std::atomic<int> frame;
+    // Number of frames in the video, or zero if it is not known.
+    std::atomic<int> frame_count;
+    // Time spent on the video, in seconds, valid once it is done.
+    double time;
+    // Motion activity of each frame, valid once it is done.
+    ActivitySignal signal;
+
+    // Latest frame with the blobs drawn on it, for display.  The
+    // worker only copies a frame once the last one has been shown.
+    std::mutex preview_lock;
+    cv::Mat preview;
+    bool preview_ready;
+
+    VideoJob()
+        : path(nullptr), state(WAITING), frame(0), frame_count(0),
+          time(0.0), preview_ready(false) { }
+};
+
+// Queue between pipeline stages.  Pop waits until there is an item,
+// and returns false once the queue is closed and empty.
+template<class T>
+class StageQueue {
+private:
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::deque<T> m_items;
+    bool m_closed;
+
+public:
+    StageQueue() : m_closed(false) { }
+
+    void push(T item) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_items.push_back(item);
+        m_cond.notify_one();
     }
 
-    Config cfg = read_config(argv[1]);
-    cv::Mat frame, mask, dilation_kernel, erosion_kernel, mask2;
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [this]() {
+            return m_closed || !m_items.empty();
+        });
+        if (m_items.empty()) {
+            return false;
+        }
+        item = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_closed = true;
+        m_cond.notify_all();
+    }
+};
+
+// A frame in flight through the pipeline.  Slots are reused, so the
+// frame and mask buffers are only allocated once.
+struct FrameSlot {
+    int frameno;
+    cv::Mat frame, mask;
+    // Fraction of the mask in the foreground.
+    float foreground;
+    std::vector<Blob> blobs;
+};
+
+// Extract the moving blobs from one video.  Each video has its own
+// background model, so videos can be processed on separate threads.
+// Stops early if the stop flag is set.
+//
+// Each video is a pipeline of three stages, so that decoding, the
+// background model, and finding blobs overlap: a decode thread reads
+// frames, this thread updates the background model and cleans up the
+// mask, and a third thread finds the blobs, writes them, and draws
+// them if they are shown.  Frames pass between the stages in a fixed
+// set of slots, which return to the decoder once they are done.
+void process_video(const Config &cfg, int video, VideoJob &job,
+                   bool show, BlobWriter *writer,
+                   const std::atomic<bool> &stop) {
+    Clock::time_point start = Clock::now();
     cv::VideoCapture cap;
-    // These values are OpenCV's defaults, except that we don't want
-    // shadows.
-    cv::BackgroundSubtractorMOG2 bg_sub(
-        cfg.bg_subtract.history,
-        cfg.bg_subtract.var_threshold,
-        true);
-    std::vector<std::vector<cv::Point>> contours;
-    std::vector<cv::Vec4i> hierarchy;
+    if (!cap.open(job.path)) {
+        job.state = VideoJob::FAILED;
+        return;
+    }
+    job.frame_count = std::max(
+        static_cast<int>(cap.get(CV_CAP_PROP_FRAME_COUNT)), 0);
+    job.signal.rate = cap.get(CV_CAP_PROP_FPS);
+    if (!(job.signal.rate > 0.0)) {
+        std::fprintf(stderr, "Warning: Unknown frame rate, using %g: %s\n",
+                     DEFAULT_FRAME_RATE, job.path);
+        job.signal.rate = DEFAULT_FRAME_RATE;
+    }
+    cv::Size frame_size(cap.get(CV_CAP_PROP_FRAME_WIDTH),
+                        cap.get(CV_CAP_PROP_FRAME_HEIGHT));
+    if (frame_size.width <= 0 || frame_size.height <= 0) {
+        job.state = VideoJob::FAILED;
+        return;
+    }
+    ForegroundMask fg(cfg.bg_subtract, video_config(cfg, job.path),
+                      frame_size);
 
-    if (!cap.open(argv[2])) {
-        die("Failed to open video.");
+    FrameSlot slots[PIPELINE_SLOTS];
+    StageQueue<FrameSlot *> free_slots, decoded, masked;
+    for (FrameSlot &slot : slots) {
+        free_slots.push(&slot);
     }
 
-    dilation_kernel = get_kernel(cfg.bg_subtract.dilation);
-    erosion_kernel = get_kernel(cfg.bg_subtract.erosion);
+    std::thread decoder([&]() {
+        FrameSlot *slot;
+        for (int frameno = 0; !stop && free_slots.pop(slot); frameno++) {
+            if (!cap.read(slot->frame) || !slot->frame.data) {
+                break;
+            }
+            slot->frameno = frameno;
+            decoded.push(slot);
+        }
+        decoded.close();
+    });
 
-    cv::namedWindow("Mask", cv::WINDOW_AUTOSIZE);
-    for (int frameno = 0; ; frameno++) {
-        if (!cap.read(frame) || !frame.data) {
-            break;
+    std::thread finder([&]() {
+        std::vector<std::vector<cv::Point>> contours;
+        ActivitySignal &signal = job.signal;
+        bool had_centroid = false;
+        cv::Point2d last_centroid;
+        FrameSlot *slot;
+        while (masked.pop(slot)) {
+            int width = slot->frame.cols;
+            find_blobs(slot->mask, contours, slot->blobs);
+            fg.map_blobs(slot->blobs);
+            if (writer) {
+                writer->write(video, slot->frameno, slot->blobs);
+            }
+
+            // The centroid of the foreground is the mean of the blob
+            // centroids, weighted by area.
+            double area = 0.0, speed = 0.0;
+            cv::Point2d centroid(0.0, 0.0);
+            for (const Blob &b : slot->blobs) {
+                centroid.x += b.x * b.area;
+                centroid.y += b.y * b.area;
+                area += b.area;
+            }
+            if (area > 0.0) {
+                centroid.x /= area;
+                centroid.y /= area;
+                if (had_centroid) {
+                    double dx = centroid.x - last_centroid.x;
+                    double dy = centroid.y - last_centroid.y;
+                    speed = std::sqrt(dx * dx + dy * dy) / width *
+                        signal.rate;
+                }
+                last_centroid = centroid;
+            }
+            had_centroid = area > 0.0;
+            signal.foreground.push_back(slot->foreground);
+            signal.speed.push_back(speed);
+
+            if (show) {
+                for (std::size_t i = 0; i < slot->blobs.size(); i++) {
+                    const Blob &b = slot->blobs[i];
+                    cv::ellipse(slot->frame, cv::Point(b.x, b.y),
+                                cv::Size(b.major, b.minor), b.angle,
+                                0, 360, color(i), 2, 8);
+                }
+                if (fg.has_roi()) {
+                    cv::rectangle(slot->frame, fg.region(),
+                                  cv::Scalar(255, 255, 255), 1);
+                }
+                std::lock_guard<std::mutex> lock(job.preview_lock);
+                if (!job.preview_ready) {
+                    slot->frame.copyTo(job.preview);
+                    job.preview_ready = true;
+                }
+            }
+            job.frame = slot->frameno + 1;
+            free_slots.push(slot);
         }
-        if (mask2.empty()) {
-            mask2 = mask.clone();
+        // Wake the decoder if it is waiting for a slot after a stop.
+        free_slots.close();
+    });
+
+    FrameSlot *slot;
+    while (decoded.pop(slot)) {
+        fg.apply(slot->frame, slot->mask);
+        slot->foreground = static_cast<double>(
+            cv::countNonZero(slot->mask)) / slot->mask.total();
+        masked.push(slot);
+    }
+    masked.close();
+    finder.join();
+    decoder.join();
+
+    job.time = seconds(Clock::now() - start);
+    job.state = VideoJob::DONE;
+}
+
+// Print one line with the progress of every video, replacing the
+// last one.
+void print_progress(const std::vector<VideoJob> &jobs, double elapsed) {
+    long long frames = 0;
+    int done = 0;
+    std::string streams;
+    for (const VideoJob &job : jobs) {
+        int frame = job.frame, count = job.frame_count;
+        char buf[32];
+        frames += frame;
+        switch (job.state) {
+        case VideoJob::WAITING:
+            std::snprintf(buf, sizeof(buf), " --");
+            break;
+        case VideoJob::RUNNING:
+            if (count > 0) {
+                std::snprintf(buf, sizeof(buf), " %d%%",
+                              std::min(frame * 100 / count, 99));
+            } else {
+                std::snprintf(buf, sizeof(buf), " %d", frame);
+            }
+            break;
+        case VideoJob::DONE:
+            done++;
+            std::snprintf(buf, sizeof(buf), " done");
+            break;
+        default:
+            done++;
+            std::snprintf(buf, sizeof(buf), " fail");
+            break;
         }
-        std::printf("\rframe %d", frameno);
-        std::fflush(stdout);
-        bg_sub(frame, mask);
-        cv::threshold(mask, mask2, 200, 255, cv::THRESH_BINARY);
-        std::swap(mask, mask2);
-        if (!erosion_kernel.empty()) {
-            cv::erode(mask, mask2, erosion_kernel);
-            std::swap(mask, mask2);
+        streams += buf;
+    }
+    std::printf("\r%d/%zu videos, %lld frames, %.0f frames/s:%s",
+                done, jobs.size(), frames,
+                elapsed > 0.0 ? frames / elapsed : 0.0, streams.c_str());
+    std::fflush(stdout);
+}
+
+// Show the latest frame of each video, in its own window.  Returns
+// false if escape was pressed.
+bool show_previews(std::vector<VideoJob> &jobs) {
+    for (VideoJob &job : jobs) {
+        std::lock_guard<std::mutex> lock(job.preview_lock);
+        if (job.preview_ready) {
+            cv::imshow(job.path, job.preview);
+            job.preview_ready = false;
         }
-        if (!dilation_kernel.empty()) {
-            cv::dilate(mask, mask2, dilation_kernel);
-            std::swap(mask, mask2);
+    }
+    int key = cv::waitKey(PREVIEW_INTERVAL);
+    return key < 0 || (key & 0xff) != 27;
+}
+
+int main(int argc, char *argv[]) {
+    int thread_count = std::thread::hardware_concurrency();
+    bool show = true, binary = false;
+    const char *blobs_path = nullptr, *signals_path = nullptr;
+    const char *offsets_path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            thread_count = std::atoi(argv[++i]);
+            if (thread_count < 1) {
+                die("Job count must be positive.");
+            }
+        } else if (arg == "--headless") {
+            show = false;
+        } else if (arg == "--blobs" && i + 1 < argc) {
+            blobs_path = argv[++i];
+        } else if (arg == "--binary") {
+            binary = true;
+        } else if (arg == "--signals" && i + 1 < argc) {
+            signals_path = argv[++i];
+        } else if (arg == "--offsets" && i + 1 < argc) {
+            offsets_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
         }
-        cv::findContours(
-            mask,
-            contours,
-            hierarchy,
-            cv::RETR_EXTERNAL,
-            cv::CHAIN_APPROX_SIMPLE);
-        for (int i = 0, n = contours.size(); i < n; i++) {
-            auto c = color(i);
-            if (false) {
-                cv::drawContours(
-                    frame,
-                    contours,
-                    i,
-                    c,
-                    1,
-                    8,
-                    hierarchy);
+    }
+    if (args.size() < 2) {
+        die("Usage: ts_extract [--jobs N] [--headless] "
+            "[--blobs FILE [--binary]] [--signals FILE] [--offsets FILE] "
+            "SETTINGS.json VIDEO...");
+    }
+
+    Config cfg = read_config(args[0]);
+    std::vector<VideoJob> jobs(args.size() - 1);
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+        jobs[i].path = args[i + 1];
+    }
+    BlobWriter writer;
+    if (blobs_path && !writer.open(blobs_path, binary)) {
+        die("Failed to create blob file.");
+    }
+
+    // Each worker takes the next video until there are none left.
+    // OpenCV's own threads are shared out between the workers, so the
+    // machine is not oversubscribed.
+    thread_count = std::max(
+        std::min(thread_count, static_cast<int>(jobs.size())), 1);
+    if (thread_count > 1) {
+        int cores = std::thread::hardware_concurrency();
+        cv::setNumThreads(std::max(cores / thread_count, 1));
+    }
+    std::atomic<bool> stop(false);
+    std::atomic<std::size_t> next_job(0);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < thread_count; i++) {
+        threads.emplace_back([&]() {
+            for (;;) {
+                std::size_t j = next_job++;
+                if (j >= jobs.size() || stop) {
+                    break;
+                }
+                jobs[j].state = VideoJob::RUNNING;
+                process_video(cfg, j, jobs[j], show,
+                              blobs_path ? &writer : nullptr, stop);
+            }
+        });
+    }
+
+    // The main thread owns the windows, since HighGUI is not thread
+    // safe.
+    Clock::time_point last_print;
+    for (;;) {
+        bool running = false;
+        for (const VideoJob &job : jobs) {
+            if (job.state == VideoJob::WAITING ||
+                job.state == VideoJob::RUNNING) {
+                running = true;
             }
-            auto m = cv::moments(contours[i]);
-            cv::Point pt(m.m10 / m.m00, m.m01 / m.m00);
-            cv::Size sz(std::sqrt(m.mu20 / m.m00),
-                        std::sqrt(m.mu02 / m.m00));
-            cv::ellipse(frame, pt, sz, 0, 0, 360, c, 2, 8);
         }
-        cv::imshow("Mask", frame);
-        int key = cv::waitKey(1);
-        if (key >= 0) {
-            key &= 0xff;
-            if (key == 27) {
-                break;
+        Clock::time_point now = Clock::now();
+        if (!running || now - last_print >= PROGRESS_INTERVAL) {
+            print_progress(jobs, seconds(now - start));
+            last_print = now;
+        }
+        if (!running || stop) {
+            break;
+        }
+        if (show) {
+            if (!show_previews(jobs)) {
+                stop = true;
             }
+        } else {
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(PREVIEW_INTERVAL));
         }
     }
+    for (std::thread &t : threads) {
+        t.join();
+    }
     std::putchar('\n');
+    if (!writer.close()) {
+        die("Failed to write blob file.");
+    }
+
+    bool failed = false;
+    for (const VideoJob &job : jobs) {
+        if (job.state == VideoJob::DONE) {
+            std::printf("%s: %d frames, %.1f s, %.0f frames/s\n",
+                        job.path, static_cast<int>(job.frame), job.time,
+                        job.time > 0.0 ? job.frame / job.time : 0.0);
+        } else if (job.state == VideoJob::FAILED) {
+            std::fprintf(stderr, "Error: Failed to open video: %s\n",
+                         job.path);
+            failed = true;
+        }
+    }
+
+    std::vector<const ActivitySignal *> signals;
+    for (const VideoJob &job : jobs) {
+        signals.push_back(&job.signal);
+    }
+    if (signals_path && !write_signals(signals_path, signals)) {
+        die("Failed to write signal file.");
+    }
+    std::vector<StreamOffset> offsets =
+        estimate_offsets(cfg.sync, signals);
+    print_offsets(stdout, offsets, false);
+    if (offsets_path) {
+        std::FILE *fp = std::fopen(offsets_path, "w");
+        if (!fp) {
+            die("Failed to create offset file.");
+        }
+        print_offsets(fp, offsets, true);
+        if (std::fclose(fp)) {
+            die("Failed to write offset file.");
+        }
+    }
 
-    return 0;
+    return failed ? 1 : 0;
 }
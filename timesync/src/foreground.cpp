@@ -0,0 +1,78 @@
+#include "foreground.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+cv::Mat get_kernel(int d) {
+    if (d <= 0) {
+        return cv::Mat();
+    }
+    return cv::getStructuringElement(
+        cv::MORPH_RECT,
+        cv::Size(d*2+1, d*2+1),
+        cv::Point(d, d));
+}
+
+}
+
+// These values are OpenCV's defaults, except that we don't want
+// shadows.
+ForegroundMask::ForegroundMask(const BgSubtractConfig &cfg,
+                               const VideoConfig &video,
+                               cv::Size frame_size)
+    : m_bg_sub(cfg.history, cfg.var_threshold, true),
+      m_erosion_kernel(get_kernel(std::lround(cfg.erosion * video.scale))),
+      m_dilation_kernel(
+          get_kernel(std::lround(cfg.dilation * video.scale))),
+      m_region(0, 0, frame_size.width, frame_size.height),
+      m_frame_size(frame_size), m_scale(video.scale) {
+    if (video.roi[2] > 0 && video.roi[3] > 0) {
+        m_region = m_region & cv::Rect(video.roi[0], video.roi[1],
+                                       video.roi[2], video.roi[3]);
+        if (m_region.area() <= 0) {
+            die("Region of interest is outside the frame.");
+        }
+    }
+}
+
+void ForegroundMask::apply(const cv::Mat &frame, cv::Mat &mask) {
+    if (m_scale < 1.0) {
+        cv::Size size(std::max<int>(std::lround(m_region.width * m_scale), 1),
+                      std::max<int>(std::lround(m_region.height * m_scale),
+                                    1));
+        cv::resize(frame(m_region), m_input, size, 0, 0, cv::INTER_AREA);
+        m_bg_sub(m_input, m_temp);
+    } else if (has_roi()) {
+        // The region is not contiguous in memory.
+        frame(m_region).copyTo(m_input);
+        m_bg_sub(m_input, m_temp);
+    } else {
+        m_bg_sub(frame, m_temp);
+    }
+    cv::threshold(m_temp, mask, 200, 255, cv::THRESH_BINARY);
+    if (!m_erosion_kernel.empty()) {
+        cv::erode(mask, m_temp, m_erosion_kernel);
+        std::swap(mask, m_temp);
+    }
+    if (!m_dilation_kernel.empty()) {
+        cv::dilate(mask, m_temp, m_dilation_kernel);
+        std::swap(mask, m_temp);
+    }
+}
+
+void ForegroundMask::map_blobs(std::vector<Blob> &blobs) const {
+    if (m_scale == 1.0 && !has_roi()) {
+        return;
+    }
+    // Pixel centers are at half-integer positions at both scales.
+    double inv = 1.0 / m_scale;
+    for (Blob &b : blobs) {
+        b.x = m_region.x + (b.x + 0.5) * inv - 0.5;
+        b.y = m_region.y + (b.y + 0.5) * inv - 0.5;
+        b.major *= inv;
+        b.minor *= inv;
+        b.area *= inv * inv;
+    }
+}
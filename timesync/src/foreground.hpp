@@ -0,0 +1,50 @@
+#ifndef TIMESYNC_FOREGROUND_HPP
+#define TIMESYNC_FOREGROUND_HPP
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "blobs.hpp"
+#include "config.hpp"
+
+/// Background subtraction and cleanup of the foreground mask.
+///
+/// Only the region of interest of each frame is used, and it is
+/// shrunk to the video's scale first.  Background subtraction,
+/// morphology and contours all cost in proportion to the pixels, so
+/// at half scale they do about a quarter of the work.  The kernels
+/// shrink with the frame, so blobs keep their shape.
+class ForegroundMask {
+private:
+    cv::BackgroundSubtractorMOG2 m_bg_sub;
+    cv::Mat m_erosion_kernel, m_dilation_kernel;
+    cv::Mat m_input, m_temp;
+    cv::Rect m_region;
+    cv::Size m_frame_size;
+    double m_scale;
+
+public:
+    /// Create a mask for frames of the given size.  Errors are fatal.
+    ForegroundMask(const BgSubtractConfig &cfg, const VideoConfig &video,
+                   cv::Size frame_size);
+
+    /// Update the background model with a frame and get the mask of
+    /// the foreground.  The mask covers the region of interest, at
+    /// the reduced scale.
+    void apply(const cv::Mat &frame, cv::Mat &mask);
+
+    /// Map blobs found in the mask to full resolution frame
+    /// coordinates.  This may be called from another thread.
+    void map_blobs(std::vector<Blob> &blobs) const;
+
+    /// Get the region of interest, in frame coordinates.
+    cv::Rect region() const { return m_region; }
+
+    /// Test whether only part of the frame is used.
+    bool has_roi() const {
+        return m_region.size() != m_frame_size;
+    }
+};
+
+#endif
@@ -0,0 +1,344 @@
+#include "sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+
+// Segments shorter than this are too short to align reliably, in
+// seconds.
+const double MIN_SEGMENT = 30.0;
+
+// Offsets are only searched where the streams overlap by at least
+// this fraction of the shorter stream.
+const double MIN_OVERLAP = 0.25;
+
+// Resample a signal with linear interpolation.
+std::vector<float> resample(const std::vector<float> &x,
+                            double from, double to) {
+    if (from == to || x.size() < 2) {
+        return x;
+    }
+    std::size_t n = static_cast<std::size_t>(
+        std::floor((x.size() - 1) * to / from)) + 1;
+    std::vector<float> y(n);
+    for (std::size_t i = 0; i < n; i++) {
+        double t = i * from / to;
+        std::size_t j = std::min(static_cast<std::size_t>(t), x.size() - 2);
+        double f = t - j;
+        y[i] = x[j] * (1.0 - f) + x[j + 1] * f;
+    }
+    return y;
+}
+
+// Remove the moving average over a window, and scale to unit
+// variance.  A constant signal becomes zero.
+void normalize(std::vector<float> &x, int window) {
+    std::size_t n = x.size();
+    std::vector<double> sum(n + 1, 0.0);
+    for (std::size_t i = 0; i < n; i++) {
+        sum[i + 1] = sum[i] + x[i];
+    }
+    std::size_t half = std::max(window / 2, 1);
+    std::vector<float> y(n);
+    double var = 0.0;
+    for (std::size_t i = 0; i < n; i++) {
+        std::size_t lo = i > half ? i - half : 0;
+        std::size_t hi = std::min(i + half + 1, n);
+        y[i] = x[i] - (sum[hi] - sum[lo]) / (hi - lo);
+        var += y[i] * y[i];
+    }
+    double scale = var > 0.0 ? 1.0 / std::sqrt(var / n) : 0.0;
+    for (std::size_t i = 0; i < n; i++) {
+        x[i] = y[i] * scale;
+    }
+}
+
+// Correlate two signals at every lag, with the FFT, and add the
+// result to the output.  Element k + b.size() - 1 of the output is
+// the sum of a[n + k] * b[n], for lags k from 1 - b.size() to
+// a.size() - 1.
+void correlate(const float *a, std::size_t na,
+               const float *b, std::size_t nb,
+               std::vector<double> &out) {
+    int n = cv::getOptimalDFTSize(na + nb - 1);
+    cv::Mat fa(1, n, CV_64FC1, cv::Scalar(0)), fb(1, n, CV_64FC1,
+                                                  cv::Scalar(0));
+    double *pa = fa.ptr<double>(), *pb = fb.ptr<double>();
+    std::copy(a, a + na, pa);
+    std::copy(b, b + nb, pb);
+    cv::dft(fa, fa);
+    cv::dft(fb, fb);
+    cv::mulSpectrums(fa, fb, fa, 0, true);
+    cv::dft(fa, fa, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+    out.resize(na + nb - 1, 0.0);
+    pa = fa.ptr<double>();
+    for (std::size_t i = 0; i < out.size(); i++) {
+        long k = static_cast<long>(i) - static_cast<long>(nb - 1);
+        out[i] += pa[(k + n) % n];
+    }
+}
+
+// A signal resampled and normalized for correlation.
+struct Channels {
+    std::vector<float> c[2];
+
+    std::size_t size() const { return c[0].size(); }
+};
+
+Channels prepare(const ActivitySignal &s, double rate, int window) {
+    Channels ch;
+    ch.c[0] = resample(s.foreground, s.rate, rate);
+    ch.c[1] = resample(s.speed, s.rate, rate);
+    ch.c[1].resize(ch.c[0].size(), 0.0f);
+    for (std::vector<float> &x : ch.c) {
+        normalize(x, window);
+    }
+    return ch;
+}
+
+// Peak of a correlation, in samples.
+struct Peak {
+    double lag;
+    double score;
+};
+
+// Find the peak correlation between all of one signal and samples
+// [begin, end) of another, for lags from lo to hi, relative to the
+// start of the second signal.  The lag is refined to a fraction of a
+// sample by fitting a parabola through the peak.
+Peak find_peak(const Channels &a, const Channels &b,
+               std::size_t begin, std::size_t end, long lo, long hi) {
+    std::size_t na = a.size(), nb = end - begin;
+    std::vector<double> corr;
+    for (int i = 0; i < 2; i++) {
+        correlate(a.c[i].data(), na, b.c[i].data() + begin, nb, corr);
+    }
+    // Normalize by the overlap at each lag, so that the score is a
+    // correlation coefficient.
+    long min_overlap = std::max<long>(
+        std::min(na, nb) * MIN_OVERLAP, 2);
+    std::vector<double> score(corr.size(), -HUGE_VAL);
+    long shift = begin;
+    for (std::size_t i = 0; i < corr.size(); i++) {
+        long k = static_cast<long>(i) - static_cast<long>(nb - 1);
+        long overlap = std::min<long>(na, nb + k) - std::max<long>(0, k);
+        if (overlap >= min_overlap && k - shift >= lo && k - shift <= hi) {
+            score[i] = corr[i] / (2.0 * overlap);
+        }
+    }
+    std::size_t best = std::max_element(score.begin(), score.end()) -
+        score.begin();
+    Peak peak;
+    peak.score = score[best];
+    if (peak.score == -HUGE_VAL) {
+        peak.lag = 0.0;
+        peak.score = 0.0;
+        return peak;
+    }
+    double delta = 0.0;
+    if (best > 0 && best + 1 < score.size() &&
+        score[best - 1] > -HUGE_VAL && score[best + 1] > -HUGE_VAL) {
+        double y0 = score[best - 1], y1 = score[best], y2 = score[best + 1];
+        double d = y0 - 2.0 * y1 + y2;
+        if (d < 0.0) {
+            delta = 0.5 * (y0 - y2) / d;
+        }
+    }
+    peak.lag = static_cast<long>(best) - static_cast<long>(nb - 1) -
+        shift + delta;
+    return peak;
+}
+
+}
+
+SyncConfig default_sync_config() {
+    SyncConfig cfg;
+    cfg.max_offset = 600.0;
+    cfg.detrend = 5.0;
+    cfg.segments = 4;
+    cfg.segment_search = 2.0;
+    return cfg;
+}
+
+OffsetEstimate estimate_offset(const SyncConfig &cfg,
+                               const ActivitySignal &a,
+                               const ActivitySignal &b) {
+    OffsetEstimate est;
+    est.offset = 0.0;
+    est.drift = 0.0;
+    est.score = 0.0;
+    est.segments = 1;
+    if (a.size() < 2 || b.size() < 2 || !(a.rate > 0.0) ||
+        !(b.rate > 0.0)) {
+        return est;
+    }
+    double rate = std::max(a.rate, b.rate);
+    int window = std::max(static_cast<int>(cfg.detrend * rate), 2);
+    Channels ca = prepare(a, rate, window), cb = prepare(b, rate, window);
+    long range = static_cast<long>(cfg.max_offset * rate);
+    Peak peak = find_peak(ca, cb, 0, cb.size(), -range, range);
+    est.offset = peak.lag / rate;
+    est.score = peak.score;
+    if (cfg.segments < 2 || !(peak.score > 0.0)) {
+        return est;
+    }
+
+    // Align segments of the second stream near the overall offset,
+    // and fit a line through their offsets.  Segments which match
+    // much worse than the whole are left out.
+    int segments = std::min<long>(
+        cfg.segments, cb.size() / static_cast<long>(MIN_SEGMENT * rate));
+    if (segments < 2) {
+        return est;
+    }
+    std::size_t length = cb.size() / segments;
+    long search = std::max<long>(cfg.segment_search * rate, 1);
+    double st = 0.0, so = 0.0, stt = 0.0, sto = 0.0;
+    int used = 0;
+    for (int s = 0; s < segments; s++) {
+        std::size_t begin = s * length;
+        long center = std::lround(peak.lag);
+        Peak p = find_peak(ca, cb, begin, begin + length,
+                           center - search, center + search);
+        if (!(p.score > 0.5 * peak.score)) {
+            continue;
+        }
+        double t = (begin + 0.5 * length) / rate, o = p.lag / rate;
+        st += t;
+        so += o;
+        stt += t * t;
+        sto += t * o;
+        used++;
+    }
+    double det = used * stt - st * st;
+    if (used < 2 || !(det > 0.0)) {
+        return est;
+    }
+    est.drift = (used * sto - st * so) / det;
+    est.offset = (so - est.drift * st) / used;
+    est.segments = used;
+    return est;
+}
+
+std::vector<StreamOffset> estimate_offsets(
+    const SyncConfig &cfg,
+    const std::vector<const ActivitySignal *> &signals) {
+    std::vector<StreamOffset> offsets;
+    for (std::size_t i = 0; i < signals.size(); i++) {
+        for (std::size_t j = i + 1; j < signals.size(); j++) {
+            if (!signals[i]->size() || !signals[j]->size()) {
+                continue;
+            }
+            StreamOffset off;
+            off.a = i;
+            off.b = j;
+            off.est = estimate_offset(cfg, *signals[i], *signals[j]);
+            offsets.push_back(off);
+        }
+    }
+    return offsets;
+}
+
+void print_offsets(std::FILE *fp, const std::vector<StreamOffset> &offsets,
+                   bool csv) {
+    if (csv) {
+        std::fputs("a,b,offset,drift,score,segments\n", fp);
+        for (const StreamOffset &off : offsets) {
+            std::fprintf(fp, "%d,%d,%.4f,%.2f,%.3f,%d\n", off.a, off.b,
+                         off.est.offset, off.est.drift * 1e6,
+                         off.est.score, off.est.segments);
+        }
+        return;
+    }
+    if (offsets.empty()) {
+        return;
+    }
+    std::fputs("Offsets, where time t in B is time t + offset + drift * t "
+               "in A:\n", fp);
+    std::fprintf(fp, "%4s %4s %12s %12s %6s %8s\n", "A", "B",
+                 "offset (s)", "drift (ppm)", "score", "segments");
+    for (const StreamOffset &off : offsets) {
+        std::fprintf(fp, "%4d %4d %12.4f %12.2f %6.3f %8d\n", off.a, off.b,
+                     off.est.offset, off.est.drift * 1e6, off.est.score,
+                     off.est.segments);
+    }
+}
+
+bool write_signals(const char *path,
+                   const std::vector<const ActivitySignal *> &signals) {
+    std::FILE *fp = std::fopen(path, "w");
+    if (!fp) {
+        return false;
+    }
+    std::fputs("stream,frame,time,foreground,speed\n", fp);
+    for (std::size_t i = 0; i < signals.size(); i++) {
+        const ActivitySignal &s = *signals[i];
+        for (std::size_t j = 0; j < s.size(); j++) {
+            std::fprintf(fp, "%zu,%zu,%.4f,%.6f,%.6f\n", i, j, j / s.rate,
+                         s.foreground[j], s.speed[j]);
+        }
+    }
+    bool ok = !std::ferror(fp);
+    return !std::fclose(fp) && ok;
+}
+
+bool read_signals(const char *path, std::vector<ActivitySignal> &signals) {
+    std::FILE *fp = std::fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    // Skip the header.
+    int c;
+    while ((c = std::fgetc(fp)) != EOF && c != '\n') { }
+
+    // Streams are numbered within each file, so they are added in the
+    // order they first appear.
+    std::size_t base = signals.size();
+    std::map<int, std::size_t> streams;
+    std::vector<double> first_time, last_time;
+    bool ok = true;
+    for (;;) {
+        int stream;
+        unsigned long frame;
+        double time;
+        float foreground, speed;
+        int n = std::fscanf(fp, "%d,%lu,%lf,%f,%f", &stream, &frame, &time,
+                            &foreground, &speed);
+        if (n == EOF) {
+            break;
+        }
+        if (n != 5) {
+            ok = false;
+            break;
+        }
+        auto it = streams.find(stream);
+        if (it == streams.end()) {
+            it = streams.insert(
+                std::make_pair(stream, first_time.size())).first;
+            signals.push_back(ActivitySignal());
+            first_time.push_back(time);
+            last_time.push_back(time);
+        }
+        ActivitySignal &s = signals[base + it->second];
+        s.foreground.push_back(foreground);
+        s.speed.push_back(speed);
+        last_time[it->second] = time;
+    }
+    ok = !std::ferror(fp) && ok;
+    std::fclose(fp);
+
+    for (std::size_t i = 0; i < first_time.size(); i++) {
+        ActivitySignal &s = signals[base + i];
+        double span = last_time[i] - first_time[i];
+        if (s.size() < 2 || !(span > 0.0)) {
+            ok = false;
+            continue;
+        }
+        s.rate = (s.size() - 1) / span;
+    }
+    return ok;
+}
@@ -0,0 +1,103 @@
+#ifndef TIMESYNC_SYNC_HPP
+#define TIMESYNC_SYNC_HPP
+
+#include <cstdio>
+#include <vector>
+
+// Time offsets between streams, from the motion in each.
+//
+// Each stream is reduced to an activity signal, sampled once per
+// frame: the fraction of the image in the foreground, and the speed
+// of the foreground's centroid.  People entering, leaving and moving
+// change both at the same moments in every stream which sees them, so
+// the offset between two streams is the lag which best correlates
+// their signals.  The correlation is computed for every lag at once
+// with the FFT, so aligning hours of video takes seconds.
+
+/// Per-frame motion activity of one stream, sampled at a fixed rate
+/// starting at time zero.
+struct ActivitySignal {
+    /// Samples per second.
+    double rate;
+    /// Fraction of the image in the foreground.
+    std::vector<float> foreground;
+    /// Speed of the centroid of the foreground, in image widths per
+    /// second, or zero when there is no foreground in this frame or
+    /// the last one.
+    std::vector<float> speed;
+
+    ActivitySignal() : rate(0.0) { }
+
+    std::size_t size() const { return foreground.size(); }
+};
+
+/// Parameters for offset estimation.
+struct SyncConfig {
+    /// Largest offset to search, in seconds.
+    double max_offset;
+    /// Window of the moving average removed from the signals before
+    /// correlating them, in seconds.
+    double detrend;
+    /// Number of segments the second stream is split into to measure
+    /// drift.  With one, drift is not measured.
+    int segments;
+    /// Segments are only aligned within this distance of the overall
+    /// offset, in seconds.
+    double segment_search;
+};
+
+/// Get the default offset estimation parameters.
+SyncConfig default_sync_config();
+
+/// Offset and drift between two streams.  A frame at time t in the
+/// second stream shows the same moment as time t + offset + drift * t
+/// in the first.
+struct OffsetEstimate {
+    /// Offset, in seconds.
+    double offset;
+    /// Drift, in seconds per second.
+    double drift;
+    /// Peak correlation, from -1 to 1.  Values near zero mean that no
+    /// match was found.
+    double score;
+    /// Number of segments used to measure drift.
+    int segments;
+};
+
+/// Estimate the offset and drift between two streams.  Signals at
+/// different rates are resampled to the higher rate.  Returns a score
+/// of zero if the signals are too short to compare.
+OffsetEstimate estimate_offset(const SyncConfig &cfg,
+                               const ActivitySignal &a,
+                               const ActivitySignal &b);
+
+/// Offset between a pair of streams, by their position in a list.
+struct StreamOffset {
+    int a, b;
+    OffsetEstimate est;
+};
+
+/// Estimate the offset between every pair of streams.  Empty signals
+/// are skipped.
+std::vector<StreamOffset> estimate_offsets(
+    const SyncConfig &cfg,
+    const std::vector<const ActivitySignal *> &signals);
+
+/// Print offsets as a table, or as CSV with a header row.  Drift is
+/// printed in parts per million.
+void print_offsets(std::FILE *fp, const std::vector<StreamOffset> &offsets,
+                   bool csv);
+
+/// Write signals as CSV, with one row per frame: the stream's
+/// position in the list, the frame number, the time in seconds, the
+/// foreground fraction and the centroid speed.  Returns false on
+/// failure.
+bool write_signals(const char *path,
+                   const std::vector<const ActivitySignal *> &signals);
+
+/// Read a signal file, as written by write_signals or by pcactivity,
+/// and add each of its streams to a list.  The sample rate of each
+/// stream is taken from its times.  Returns false on failure.
+bool read_signals(const char *path, std::vector<ActivitySignal> &signals);
+
+#endif